@@ -12,6 +12,7 @@
 #include "imgui/imgui_impl_sdl.h"
 #include "imgui/imgui_impl_opengl3.h"
 #include <chrono>
+#include <math.h>
 
 AppBase::AppBase()
 {
@@ -90,6 +91,12 @@ void PrintShaderInfoLog(GLuint shader)
 	}
 }
 
+// the quad every program draws with. LVertexPos2D and LTexCoord are bound to the same
+// locations in all of them so they share mVAO
+const GLchar * AppBase::s_vertex_shader_source =
+	"#version 150\nin vec2 LVertexPos2D; in vec2 LTexCoord; out vec2 texCoord; uniform float LFlipY;"
+	"void main() { texCoord = vec2( LTexCoord.x, mix( LTexCoord.y, 1.0 - LTexCoord.y, LFlipY ) ); gl_Position = vec4( LVertexPos2D.x, LVertexPos2D.y, 0, 1 ); }";
+
 bool AppBase::init_gl_shaders()
 {
 	bool success{ true };
@@ -99,9 +106,7 @@ bool AppBase::init_gl_shaders()
 
 	// ----------- create vertex shader ----------------------------------------------
 	mVertexShader = glCreateShader(GL_VERTEX_SHADER);
-	const GLchar* vertexShaderSource[] = {
-	"#version 150\nin vec2 LVertexPos2D; void main() { gl_Position = vec4( LVertexPos2D.x, LVertexPos2D.y, 0, 1 ); }"
-	};
+	const GLchar* vertexShaderSource[] = { s_vertex_shader_source };
 
 	glShaderSource(mVertexShader, 1, vertexShaderSource, NULL);
 	glCompileShader(mVertexShader);
@@ -118,9 +123,20 @@ bool AppBase::init_gl_shaders()
 
 	// ---------- create the fragment shader ------------------------------------
 	mFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	// sharp bilinear: inside a texel it samples the nearest texel centre, only the last
+	// viewport pixel before an edge blends, so any scale stays crisp without shimmering
 	const GLchar* fragmentShaderSource[] =
 	{
-		"#version 150\nout vec4 LFragment; void main() { LFragment = vec4( 1.0, 1.0, 1.0, 1.0 ); }"
+		"#version 150\nin vec2 texCoord; uniform sampler2D LTexture; uniform vec2 LSourceSize; uniform float LSharpScale; out vec4 LFragment;"
+		"void main() {"
+		"  vec2 uv = texCoord;"
+		"  if (LSharpScale > 1.0) {"
+		"    vec2 texel = texCoord * LSourceSize;"
+		"    vec2 centre_dist = fract(texel) - 0.5;"
+		"    float region = 0.5 - 0.5 / LSharpScale;"
+		"    uv = (floor(texel) + (centre_dist - clamp(centre_dist, -region, region)) * LSharpScale + 0.5) / LSourceSize;"
+		"  }"
+		"  LFragment = texture( LTexture, uv ); }"
 	};
 
 	glShaderSource(mFragmentShader, 1, fragmentShaderSource, NULL);
@@ -159,9 +175,63 @@ bool AppBase::init_gl_shaders()
 		success = false;
 	}
 
+	mTexCoordLocation = glGetAttribLocation(mShaderProgramID, "LTexCoord");
+	if (mTexCoordLocation == -1)
+	{
+		printf("LTexCoord is not a valid glsl program variable!\n");
+		success = false;
+	}
+
+	mTextureLocation = glGetUniformLocation(mShaderProgramID, "LTexture");
+	mFlipYLocation = glGetUniformLocation(mShaderProgramID, "LFlipY");
+	mSourceSizeLocation = glGetUniformLocation(mShaderProgramID, "LSourceSize");
+	mSharpScaleLocation = glGetUniformLocation(mShaderProgramID, "LSharpScale");
+
 	return success;
 }
 
+GLuint AppBase::build_shader_program(const GLchar * fragment_source)
+{
+	GLuint program = glCreateProgram();
+	GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+	GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+
+	glShaderSource(vertex_shader, 1, &s_vertex_shader_source, NULL);
+	glCompileShader(vertex_shader);
+	glShaderSource(fragment_shader, 1, &fragment_source, NULL);
+	glCompileShader(fragment_shader);
+
+	GLint compiled = GL_FALSE;
+	glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &compiled);
+	if (compiled != GL_TRUE)
+	{
+		printf("Unable to compile fragment shader %d!\n", fragment_shader);
+		PrintShaderInfoLog(fragment_shader);
+	}
+
+	glAttachShader(program, vertex_shader);
+	glAttachShader(program, fragment_shader);
+	glBindAttribLocation(program, mVertexPos2DLocation, "LVertexPos2D");
+	glBindAttribLocation(program, mTexCoordLocation, "LTexCoord");
+	glLinkProgram(program);
+
+	// the program keeps what it needs
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (compiled != GL_TRUE || linked != GL_TRUE)
+	{
+		printf("Error linking program %d!\n", program);
+		PrintProgramLog(program);
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
 bool AppBase::init_imgui()
 {
 	// Initialize imgui
@@ -184,9 +254,15 @@ bool AppBase::Initialize()
 {
 	mEditorMode = false;
 	mUpdatePaused = false;
+	mScaleMode = APPBASE_SCALE_STRETCH;
 
 	mShaderProgramID = 0;
 	mVertexPos2DLocation = 0;
+	mTexCoordLocation = 0;
+	mTextureLocation = -1;
+	mFlipYLocation = -1;
+	mSourceSizeLocation = -1;
+	mSharpScaleLocation = -1;
 	mVAO = 0;
 	mVBO = 0;
 	mIBO = 0;
@@ -216,30 +292,39 @@ bool AppBase::Initialize()
 		return false;
 	}
 
-	// some gl buffers to get us a triangle
-	// a triangle to draw
+	// one quad covering the whole viewport, everything gets drawn as a texture on it
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-	//VBO data
+	//VBO data, x y u v
 	GLfloat const VertexData[] = {
-		0.0f, 0.5f,
-		0.5f, -0.5f,
-		-0.5f, -0.5f
+		-1.0f, -1.0f, 0.0f, 0.0f,
+		1.0f, -1.0f, 1.0f, 0.0f,
+		1.0f, 1.0f, 1.0f, 1.0f,
+		-1.0f, 1.0f, 0.0f, 1.0f
 	};
 
 	GLuint const IndexData[] = {
-		0, 1, 2
+		0, 1, 2,
+		0, 2, 3
 	};
 
-	mVBO;
+	glGenVertexArrays(1, &mVAO);
+	glBindVertexArray(mVAO);
+
 	glGenBuffers(1, &mVBO);
 	glBindBuffer(GL_ARRAY_BUFFER, mVBO);
-	glBufferData(GL_ARRAY_BUFFER, 2 * 3 * sizeof(GLfloat), VertexData, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(VertexData), VertexData, GL_STATIC_DRAW);
 
-	mIBO;
 	glGenBuffers(1, &mIBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * sizeof(GLuint), IndexData, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(IndexData), IndexData, GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(mVertexPos2DLocation);
+	glVertexAttribPointer(mVertexPos2DLocation, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)0);
+	glEnableVertexAttribArray(mTexCoordLocation);
+	glVertexAttribPointer(mTexCoordLocation, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+
+	glBindVertexArray(0);
 
 	////////////////// open gl render texture ////////////////////////////////////////
 
@@ -294,10 +379,11 @@ using namespace std::chrono_literals;
 void AppBase::Run()
 {
 	using clock = std::chrono::high_resolution_clock;
-	// tick at 400hz for now, needs to be configurable though!
-	const auto target_time = 16.667ms;
+	// update() runs at exactly target_framerate, the accumulator is kept in a unit that
+	// holds both nanoseconds and 1/60ths exactly so no fraction gets dropped
+	const auto target_time = std::chrono::duration<long long, std::ratio<1, 60>>(1);
 	auto current_time = std::chrono::steady_clock::now();
-	auto time_accumulator = 0ns;
+	std::common_type_t<std::chrono::nanoseconds, decltype(target_time)> time_accumulator{ 0 };
 
 	// Loop until the user closes the window
 	bool shouldQuit = false;
@@ -332,15 +418,19 @@ void AppBase::Run()
 
 		while (time_accumulator >= target_time)
 		{
-			time_accumulator -= std::chrono::duration_cast<std::chrono::nanoseconds>(target_time);
+			time_accumulator -= target_time;
 
 			// update game logic if not paused
 			if (!mUpdatePaused)
 			{
 				update();
 			}
+		}
 
-			// game render frame
+		// game render frame once per presented frame (however many updates that was),
+		// the render texture keeps the last one when nothing changed
+		if (needs_render())
+		{
 			render_begin();
 			render();
 			render_end();
@@ -398,6 +488,12 @@ void AppBase::render_begin()
 	glClear(GL_COLOR_BUFFER_BIT);
 }
 
+bool AppBase::needs_render()
+{
+	// override to skip redraws when the game knows its output hasn't changed
+	return true;
+}
+
 void AppBase::render()
 {
 	// override this, do the game rendering
@@ -431,20 +527,29 @@ void AppBase::render_gamemode()
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	// fit the render texture, anything but stretch keeps its aspect and letterboxes
+	float sharp_scale = 0.0f;
+	if (mScaleMode != APPBASE_SCALE_STRETCH)
+	{
+		float scale_x = (float)win_w / m_internal_render_width;
+		float scale_y = (float)win_h / m_internal_render_height;
+		float scale = scale_x < scale_y ? scale_x : scale_y;
+		if (mScaleMode == APPBASE_SCALE_INTEGER)
+		{
+			scale = scale < 1.0f ? 1.0f : floorf(scale);
+		}
+		else
+		{
+			sharp_scale = scale;
+		}
+
+		int w = (int)(m_internal_render_width * scale);
+		int h = (int)(m_internal_render_height * scale);
+		glViewport((win_w - w) / 2, (win_h - h) / 2, w, h);
+	}
+
 	// blit our tex to a quad 
-	glEnable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, mLGRenderTex);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glColor4ub(255, 255, 255, 0);
-	glBegin(GL_QUADS);
-	glTexCoord2i(0, 0); glVertex2i(0, 0);
-	glTexCoord2i(0, 1); glVertex2i(0, win_h);
-	glTexCoord2i(1, 1); glVertex2i(win_w, win_h);
-	glTexCoord2i(1, 0); glVertex2i(win_w, 0);
-	glEnd();
-	glDisable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, NULL);
+	draw_texture_quad(mLGRenderTex, false, sharp_scale, m_internal_render_width, m_internal_render_height);
 	glBindFramebuffer(GL_FRAMEBUFFER, NULL);
 }
 
@@ -479,6 +584,36 @@ void AppBase::finish_render()
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void AppBase::draw_texture_quad(GLuint texture, bool flip_y, float sharp_scale, int texture_width, int texture_height)
+{
+	glUseProgram(mShaderProgramID);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glUniform1i(mTextureLocation, 0);
+	glUniform1f(mFlipYLocation, flip_y ? 1.0f : 0.0f);
+	glUniform2f(mSourceSizeLocation, (float)texture_width, (float)texture_height);
+	glUniform1f(mSharpScaleLocation, sharp_scale);
+
+	// sharp bilinear does its blending with the hardware filter
+	if (sharp_scale > 1.0f)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	glBindVertexArray(mVAO);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+	glBindVertexArray(0);
+
+	if (sharp_scale > 1.0f)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, NULL);
+	glUseProgram(0);
+}
+
 void AppBase::sdl_input(SDL_Event event)
 {
 	// override to get sdl input
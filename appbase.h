@@ -4,6 +4,12 @@
 #define DEFAULT_INTERNAL_RENDER_WIDTH 320
 #define DEFAULT_INTERNAL_RENDER_HEIGHT 240
 
+// how render_gamemode fits the render texture to the window
+#define APPBASE_SCALE_STRETCH 0 // fill the window, nearest
+#define APPBASE_SCALE_INTEGER 1 // biggest whole multiple that fits, centered
+#define APPBASE_SCALE_SHARP 2 // biggest size that keeps the aspect, sharp bilinear
+#define APPBASE_SCALE_COUNT 3
+
 class AppBase : public AppCore
 {
 private:
@@ -24,6 +30,8 @@ private:
 	bool init_gl_shaders();
 	bool init_imgui();
 
+	static const GLchar * s_vertex_shader_source;
+
 protected:
 	int m_internal_render_width;
 	int m_internal_render_height;
@@ -32,13 +40,19 @@ protected:
 
 	bool mEditorMode;
 	bool mUpdatePaused;
+	int mScaleMode;
 	
 	const int target_framerate = 60;
 
 	long long tick_count;
 
 	GLuint mShaderProgramID;
-	GLuint mVertexPos2DLocation;
+	GLint mVertexPos2DLocation;
+	GLint mTexCoordLocation;
+	GLint mTextureLocation;
+	GLint mFlipYLocation;
+	GLint mSourceSizeLocation;
+	GLint mSharpScaleLocation;
 	GLuint mVAO;
 	GLuint mVBO;
 	GLuint mIBO;
@@ -55,6 +69,7 @@ protected:
 	virtual void update();
 	virtual void editor_update();
 
+	virtual bool needs_render();
 	void render_begin();
 	virtual void render();
 	void render_end();
@@ -64,5 +79,14 @@ protected:
 
 	virtual void finish_render();
 
+	// draws texture over the whole viewport of whatever framebuffer is bound, through
+	// the shader program. flip_y puts the texture's first row at the top. a sharp_scale above 1
+	// (viewport pixels per texel) samples it sharp bilinear, which needs the texture's size
+	void draw_texture_quad(GLuint texture, bool flip_y, float sharp_scale = 0.0f, int texture_width = 0, int texture_height = 0);
+
+	// links fragment_source with the quad vertex shader, so the program can draw with
+	// mVAO like the main one. returns 0 and prints the log if it doesn't compile
+	GLuint build_shader_program(const GLchar * fragment_source);
+
 	virtual void sdl_input(SDL_Event event);
 };
\ No newline at end of file
@@ -1,22 +1,50 @@
 #include "chip8.h"
+#include "chip8jit.h"
 #include <stdio.h>
-#include <iostream>
-#include <fstream>
+#include <string.h>
+#include <chrono>
+
+static_assert(CHIP8_OP_COUNT <= CHIP8_PROFILE_MAX_OPS, "chip8_op doesn't fit in a Chip8Profile");
 
 void empty_log(const char* fmt, ...)
 {
 
 }
 
+// levels above CHIP8_TRACE_MAX_LEVEL fold away at compile time, otherwise it's one compare
+#define CHIP8_TRACE(level, event) \
+	do { if ((level) <= CHIP8_TRACE_MAX_LEVEL && (level) <= trace_level) trace_event((level), (event)); } while (0)
+
+// 00FB/00FC scroll distance, in pixels of whichever resolution is on
+#define CHIP8_SCREEN_SCROLL_X 4
+
 void Chip8::reset()
 {
 	clear_memory();
 	clear_screen();
 	clear_keys();
+	hires = false;
+	screen_dirty = CHIP8_SCREEN_ALL_ROWS;
+	memset(rpl_flags, 0, sizeof(rpl_flags));
 
 	// set the program counter to the entry point
 	prog_count = CHIP8_WORK_MEM_START;
 	index_reg = 0;
+	opcode = 0;
+	last_opcode = 0;
+
+	delay_timer = 0;
+	sound_timer = 0;
+	system_ticks = 0;
+	timer_phase = 0;
+	frame_phase = 0;
+	time_phase = 0;
+	seed_random();
+
+	memset(error_counts, 0, sizeof(error_counts));
+
+	user_keypressed = false;
+	last_keypressed = 0;
 
 	// clear registers
 	for (int i = 0; i < CHIP8_TOTAL_V_REGS; i++)
@@ -31,34 +59,59 @@ void Chip8::reset()
 		stack[i] = 0x00;
 	}
 
-	// load font set
-	for (int i = 0; i < CHIP8_FONTSET_SIZE; i++)
-	{
-		memory[CHIP8_FONTSET_MEM_START + i] = chip8_fontset[i];
-	}
+	// load font sets
+	memcpy(memory + CHIP8_FONTSET_MEM_START, chip8_fontset, CHIP8_FONTSET_SIZE);
+	memcpy(memory + CHIP8_BIGFONT_MEM_START, chip8_bigfont, CHIP8_BIGFONT_SIZE);
 
-	// copy the rom into memory, we keep the rom because
-	// all of memory is work ram, so the 'rom' could be modified at runtime
-	for (int i = CHIP8_WORK_MEM_START; i < CHIP8_TOTAL_MEMSIZE; i++)
+	// copy the rom into memory from the image, we keep the image because all of memory is
+	// work ram, so the 'rom' could be modified at runtime. the rest was cleared above
+	if (rom_image)
 	{
-		memory[i] = romcopy[i];
+		memcpy(memory + CHIP8_WORK_MEM_START, rom_image->GetData(), rom_image->GetSize());
 	}
+
+	// all of work ram just changed
+	invalidate_decode_all();
+
+	CHIP8_TRACE(CHIP8_TRACE_INFO, CHIP8_TRACE_EVENT_RESET);
 }
 
 void Chip8::clear_memory()
 {
-	for (int i = CHIP8_WORK_MEM_START; i < CHIP8_TOTAL_MEMSIZE; i++)
+	// the interpreter area too, anything a rom stored down there (or whatever the heap
+	// had in it) would otherwise survive a reset
+	memset(memory, 0x00, CHIP8_TOTAL_MEMSIZE);
+}
+
+void Chip8::clear_screen()
+{
+	// all of it whatever the resolution, so the part lores doesn't use is always blank
+	for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++)
 	{
-		memory[i] = 0x00;
+		uint64_t lit = 0;
+		for (int w = 0; w < CHIP8_SCREEN_ROW_WORDS; w++)
+		{
+			lit |= screen_rows[y][w];
+			screen_rows[y][w] = 0;
+		}
+
+		// roms that run off into empty ram clear over and over, that shouldn't count as drawing
+		if (lit)
+		{
+			screen_dirty |= 1ULL << y;
+		}
 	}
 }
 
-void Chip8::clear_screen()
+void Chip8::set_hires(bool enabled)
 {
-	for (int i = 0; i < CHIP8_GRAPHICSMEM_TOTAL; i++)
+	// the screen is cleared on a switch either way, and every row is drawn at a new size
+	if (hires != enabled)
 	{
-		screen_buf[i] = 0x00;
+		hires = enabled;
+		screen_dirty = CHIP8_SCREEN_ALL_ROWS;
 	}
+	clear_screen();
 }
 
 void Chip8::clear_keys()
@@ -73,33 +126,186 @@ Chip8::Chip8()
 {
 	// so there's always a function here
 	log = &empty_log;
+	trace_level = CHIP8_TRACE_NONE;
+	trace = nullptr;
+	profiling = false;
+	profile = nullptr;
+	trace_file = nullptr;
+	memset(error_counts, 0, sizeof(error_counts));
 
 	// set default config
 	ambig_8XY6_8XYE_VY_mode = AMBIG_8XY6_DEFAULT;
 	ambig_BNNN_mode = AMBIG_BNNN_ADD_VX;
 	ambig_FX55_FX65_mode = AMBIG_FX55_FX65_DEFAULT;
+	select_quirk_policy();
+
+	cpu_hz = CHIP8_DEFAULT_CPU_HZ;
+	timer_phase = 0;
+	frame_phase = 0;
+	time_phase = 0;
+
+	random_seed = CHIP8_DEFAULT_RANDOM_SEED;
+	seed_random();
+
+	core_mode = CHIP8_CORE_DEFAULT;
+	jit = nullptr;
+	invalidate_decode_all();
+
+	memset(screen_rows, 0, sizeof(screen_rows));
+	hires = false;
+	screen_dirty = CHIP8_SCREEN_ALL_ROWS;
+	memset(rpl_flags, 0, sizeof(rpl_flags));
 }
 
 Chip8::~Chip8()
 {
+	delete jit;
+	delete trace;
+	delete profile;
+	delete trace_file;
 }
 
 void Chip8::Init()
 {
 }
 
-void Chip8::Tick(long long sys_ticks)
+void Chip8::Tick()
+{
+	Run(1);
+}
+
+long long Chip8::Run(long long count)
+{
+	if (profiling || trace_file)
+	{
+		return run_instrumented(count);
+	}
+
+	if (core_mode == CHIP8_CORE_SWITCH)
+	{
+		return (this->*s_switch_runs[quirk_policy])(count);
+	}
+
+	if (core_mode == CHIP8_CORE_THREADED)
+	{
+		return (this->*s_threaded_runs[quirk_policy])(count);
+	}
+
+	// compiled blocks can't trace each instruction, so instruction tracing
+	// drops back to the interpreter
+	if (core_mode == CHIP8_CORE_JIT && jit && trace_level < CHIP8_TRACE_INSTR)
+	{
+		return run_jit(count);
+	}
+
+	return (this->*s_predecoded_runs[quirk_policy])(count);
+}
+
+long long Chip8::RunFrame()
+{
+	return Run(StartFrame());
+}
+
+long long Chip8::StartFrame()
+{
+	frame_phase += cpu_hz;
+	long long count = frame_phase / CHIP8_TIMER_HZ;
+	frame_phase %= CHIP8_TIMER_HZ;
+
+	return count;
+}
+
+long long Chip8::RunFor(long long nanoseconds)
+{
+	long long total = 0;
+
+	// a second at a time keeps nanoseconds * cpu_hz well inside 64 bits
+	while (nanoseconds > 0)
+	{
+		long long chunk = nanoseconds < 1000000000LL ? nanoseconds : 1000000000LL;
+		nanoseconds -= chunk;
+
+		time_phase += chunk * cpu_hz;
+		long long count = time_phase / 1000000000LL;
+		time_phase %= 1000000000LL;
+
+		total += Run(count);
+	}
+
+	return total;
+}
+
+void Chip8::SetRandomSeed(uint64_t seed)
+{
+	random_seed = seed;
+	seed_random();
+}
+
+uint64_t Chip8::GetRandomSeed()
+{
+	return random_seed;
+}
+
+void Chip8::seed_random()
+{
+	// pcg32's own seeding, so nearby seeds don't give nearby sequences
+	random_state = 0;
+	next_random();
+	random_state += random_seed;
+	next_random();
+}
+
+uint8_t Chip8::next_random()
+{
+	// pcg32 (xsh rr), one 64 bit multiply-add a call and no shared state, so every
+	// instance (batch worker, lockstep lane) has its own stream
+	uint64_t old_state = random_state;
+	random_state = old_state * 6364136223846793005ULL + 1442695040888963407ULL;
+	uint32_t xorshifted = (uint32_t)(((old_state >> 18) ^ old_state) >> 27);
+	uint32_t rot = (uint32_t)(old_state >> 59);
+	uint32_t result = (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+
+	// the top bits are the best ones
+	return (uint8_t)(result >> 24);
+}
+
+uint32_t Chip8::GetCPUFrequency()
 {
-	system_ticks = sys_ticks;
-	// Fetch opcode
-	fetch_opcode();
+	return cpu_hz;
+}
+
+void Chip8::SetCPUFrequency(uint32_t hz)
+{
+	if (hz < CHIP8_MIN_CPU_HZ) hz = CHIP8_MIN_CPU_HZ;
+	if (hz > CHIP8_MAX_CPU_HZ) hz = CHIP8_MAX_CPU_HZ;
+
+	// keep how far through the current timer period we are
+	timer_phase = (uint32_t)((uint64_t)timer_phase * hz / cpu_hz);
+	time_phase = 0;
+	cpu_hz = hz;
+}
+
+void Chip8::step()
+{
+	// Fetch the already decoded opcode, decoding it on a cache miss. every core runs the
+	// same handlers, so single instructions outside the core loops all come through here
+	const chip8_instr & ins = fetch_decoded();
+	last_opcode = opcode;
+	opcode = ins.opcode;
 
-	// Execute opcode
-	execute_opcode();
+	execute_instr(ins);
+}
 
-	// Update timers (should tick at 60hz)
-	if (delay_timer > 0) delay_timer--;
-	if (sound_timer > 0) sound_timer--;
+void Chip8::end_tick()
+{
+	// Update timers, 60hz of emulated time
+	timer_phase += CHIP8_TIMER_HZ;
+	if (timer_phase >= cpu_hz)
+	{
+		timer_phase -= cpu_hz;
+		if (delay_timer > 0) delay_timer--;
+		if (sound_timer > 0) sound_timer--;
+	}
 	if (sound_timer > 0)
 	{
 		// beep!
@@ -108,62 +314,278 @@ void Chip8::Tick(long long sys_ticks)
 	user_keypressed = false;
 }
 
+void Chip8::tick_timers(long long instructions)
+{
+	// end_tick()'s timer update for a run of instructions in one go
+	uint64_t phase = timer_phase + (uint64_t)instructions * CHIP8_TIMER_HZ;
+	if (phase < cpu_hz)
+	{
+		// the usual case for a short run, no tick and no divide
+		timer_phase = (uint32_t)phase;
+		return;
+	}
+	uint64_t ticks = phase / cpu_hz;
+	timer_phase = (uint32_t)(phase % cpu_hz);
+
+	delay_timer = (delay_timer > ticks) ? (uint8_t)(delay_timer - ticks) : 0;
+	sound_timer = (sound_timer > ticks) ? (uint8_t)(sound_timer - ticks) : 0;
+}
+
+bool Chip8::GetHiRes()
+{
+	return hires;
+}
+
+int Chip8::GetScreenWidth()
+{
+	return hires ? CHIP8_HIRES_WIDTH : CHIP8_GRAPHICS_WIDTH;
+}
+
+int Chip8::GetScreenHeight()
+{
+	return hires ? CHIP8_HIRES_HEIGHT : CHIP8_GRAPHICS_HEIGHT;
+}
+
 uint8_t * Chip8::GetScreenBuf()
 {
+	int width = GetScreenWidth();
+	int height = GetScreenHeight();
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			screen_buf[x + y * width] = (screen_rows[y][x >> 6] & CHIP8_SCREEN_ROW_BIT(x)) ? 1 : 0;
+		}
+	}
 	return screen_buf;
 }
 
+const uint64_t * Chip8::GetScreenRows()
+{
+	return screen_rows[0];
+}
+
+uint64_t Chip8::GetScreenDirtyRows()
+{
+	return screen_dirty;
+}
+
+void Chip8::ClearScreenDirty()
+{
+	screen_dirty = 0;
+}
+
+uint64_t Chip8::GetScreenHash()
+{
+	// only the words the resolution uses
+	int height = GetScreenHeight();
+	int words = hires ? CHIP8_SCREEN_ROW_WORDS : 1;
+	uint64_t hash = 14695981039346656037ULL;
+	for (int y = 0; y < height; y++)
+	{
+		for (int w = 0; w < words; w++)
+		{
+			hash ^= screen_rows[y][w];
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+long long Chip8::GetInstructionCount()
+{
+	return system_ticks;
+}
+
 void Chip8::Reset()
 {
 	reset();
 }
 
-bool Chip8::LoadROM(uint8_t * rom, long size)
+// chip8_savestate flags
+#define CHIP8_STATE_FLAG_8XY6 0x01
+#define CHIP8_STATE_FLAG_BNNN 0x02
+#define CHIP8_STATE_FLAG_FX55 0x04
+#define CHIP8_STATE_FLAG_KEYPRESSED 0x08
+#define CHIP8_STATE_FLAG_HIRES 0x10
+
+// decode cache entries are only dropped for the parts of memory a load actually changes
+#define CHIP8_STATE_MEMORY_CHUNK 64
+
+long Chip8::SaveState(uint8_t * buf, long size)
+{
+	if (buf == nullptr || size < CHIP8_SAVESTATE_SIZE)
+	{
+		return 0;
+	}
+
+	chip8_savestate & state = *(chip8_savestate*)buf;
+	memset(&state, 0, sizeof(state));
+
+	state.magic = CHIP8_SAVESTATE_MAGIC;
+	state.version = CHIP8_SAVESTATE_VERSION;
+	state.system_ticks = system_ticks;
+	state.time_phase = time_phase;
+	state.random_seed = random_seed;
+	state.random_state = random_state;
+	state.cpu_hz = cpu_hz;
+	state.timer_phase = timer_phase;
+	state.frame_phase = frame_phase;
+	memcpy(state.screen_rows, screen_rows, sizeof(screen_rows));
+	memcpy(state.stack, stack, sizeof(stack));
+	state.stack_pointer = stack_pointer;
+	state.index_reg = index_reg;
+	state.prog_count = prog_count;
+	state.opcode = opcode;
+	state.last_opcode = last_opcode;
+	memcpy(state.memory, memory, sizeof(memory));
+	memcpy(state.v_reg, v_reg, sizeof(v_reg));
+	memcpy(state.keys, keys, sizeof(keys));
+	memcpy(state.rpl_flags, rpl_flags, sizeof(rpl_flags));
+	state.delay_timer = delay_timer;
+	state.sound_timer = sound_timer;
+	state.last_keypressed = last_keypressed;
+
+	if (ambig_8XY6_8XYE_VY_mode) state.flags |= CHIP8_STATE_FLAG_8XY6;
+	if (ambig_BNNN_mode) state.flags |= CHIP8_STATE_FLAG_BNNN;
+	if (ambig_FX55_FX65_mode) state.flags |= CHIP8_STATE_FLAG_FX55;
+	if (user_keypressed) state.flags |= CHIP8_STATE_FLAG_KEYPRESSED;
+	if (hires) state.flags |= CHIP8_STATE_FLAG_HIRES;
+
+	return CHIP8_SAVESTATE_SIZE;
+}
+
+bool Chip8::LoadState(const uint8_t * buf, long size)
 {
-	int charp = 0;
+	if (buf == nullptr || size < CHIP8_SAVESTATE_SIZE)
+	{
+		return false;
+	}
+
+	const chip8_savestate & state = *(const chip8_savestate*)buf;
+	if (state.magic != CHIP8_SAVESTATE_MAGIC || state.version != CHIP8_SAVESTATE_VERSION)
+	{
+		return false;
+	}
+
+	// the timers divide by it
+	if (state.cpu_hz < CHIP8_MIN_CPU_HZ || state.cpu_hz > CHIP8_MAX_CPU_HZ || state.timer_phase >= state.cpu_hz)
+	{
+		return false;
+	}
+
+	// 00EE indexes the stack with it, a full stack is as far as 2NNN takes it
+	if (state.stack_pointer > CHIP8_STACK_SIZE)
+	{
+		return false;
+	}
 
-	if (rom != nullptr && size > 0 && size <= CHIP8_TOTAL_MEMSIZE - 0x200)
+	// forking many runs off one snapshot mostly rewrites memory with what's already there,
+	// so only copy (and throw away decodes for) the chunks that differ
+	for (int i = 0; i < CHIP8_TOTAL_MEMSIZE; i += CHIP8_STATE_MEMORY_CHUNK)
 	{
-		for (int i = 0; i < size; i++)
+		if (memcmp(memory + i, state.memory + i, CHIP8_STATE_MEMORY_CHUNK) != 0)
 		{
-			romcopy[i + 0x200] = rom[i];
-			printf("%X ", rom[i]);
-			charp++;
-			if (charp == 16)
-			{
-				printf("\n");
-				charp = 0;
-			}
+			memcpy(memory + i, state.memory + i, CHIP8_STATE_MEMORY_CHUNK);
+			invalidate_decode(i, CHIP8_STATE_MEMORY_CHUNK);
 		}
 	}
-	else
+
+	system_ticks = state.system_ticks;
+	time_phase = state.time_phase;
+	random_seed = state.random_seed;
+	random_state = state.random_state;
+	cpu_hz = state.cpu_hz;
+	timer_phase = state.timer_phase;
+	frame_phase = state.frame_phase;
+	// only rows that come back different need redrawing, on top of whatever was already
+	// pending. unless the resolution changed, then they all do
+	bool state_hires = (state.flags & CHIP8_STATE_FLAG_HIRES) != 0;
+	if (state_hires != hires)
+	{
+		hires = state_hires;
+		screen_dirty = CHIP8_SCREEN_ALL_ROWS;
+	}
+	for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++)
+	{
+		if (memcmp(screen_rows[y], state.screen_rows[y], sizeof(screen_rows[y])) != 0)
+		{
+			memcpy(screen_rows[y], state.screen_rows[y], sizeof(screen_rows[y]));
+			screen_dirty |= 1ULL << y;
+		}
+	}
+	memcpy(stack, state.stack, sizeof(stack));
+	stack_pointer = state.stack_pointer;
+	index_reg = state.index_reg;
+	// any value is safe, every fetch masks it. not masked here, a rom running off the end of
+	// memory takes it past 0xFFF and the snapshot has to come back exactly as it was
+	prog_count = state.prog_count;
+	opcode = state.opcode;
+	last_opcode = state.last_opcode;
+	memcpy(v_reg, state.v_reg, sizeof(v_reg));
+	memcpy(keys, state.keys, sizeof(keys));
+	memcpy(rpl_flags, state.rpl_flags, sizeof(rpl_flags));
+	delay_timer = state.delay_timer;
+	sound_timer = state.sound_timer;
+	last_keypressed = state.last_keypressed;
+	user_keypressed = (state.flags & CHIP8_STATE_FLAG_KEYPRESSED) != 0;
+
+	// goes through the setter so the jit hears about it
+	bool shift_mode = (state.flags & CHIP8_STATE_FLAG_8XY6) != 0;
+	if (shift_mode != ambig_8XY6_8XYE_VY_mode)
+	{
+		SetConfig_8XY6_8XYE_VY_mode(shift_mode);
+	}
+	ambig_BNNN_mode = (state.flags & CHIP8_STATE_FLAG_BNNN) != 0;
+	ambig_FX55_FX65_mode = (state.flags & CHIP8_STATE_FLAG_FX55) != 0;
+	select_quirk_policy();
+
+	CHIP8_TRACE(CHIP8_TRACE_INFO, CHIP8_TRACE_EVENT_STATE_LOADED);
+
+	return true;
+}
+
+bool Chip8::LoadROM(uint8_t * rom, long size)
+{
+	std::shared_ptr<const Chip8ROMImage> image = Chip8ROMImage::Copy(rom, size);
+	if (!image)
+	{
+		printf("Chip8 ROM was null or size [%li] was 0 or bigger than available space.", size);
+		return false;
+	}
+
+	return LoadROMImage(image);
+}
+
+bool Chip8::LoadROMImage(std::shared_ptr<const Chip8ROMImage> image)
+{
+	if (!image)
 	{
-		printf("Chip8 ROM was null or size [%i] was 0 or bigger than available space.", size);
 		return false;
 	}
 
+	// shared, not copied, the image is read only
+	rom_image = image;
+
+	CHIP8_TRACE(CHIP8_TRACE_INFO, CHIP8_TRACE_EVENT_ROM_LOADED);
+
+	// addresses from another rom mean nothing
+	if (profile)
+	{
+		profile->Clear();
+	}
+
 	return true;
 }
 
 bool Chip8::LoadROMFromFile(const char * filename)
 {
-	std::streampos begin;
-	std::streampos end;
-	unsigned char buffer [1024*16];//wayyy big
-	for (int i = 0; i < 1024 * 16; i++) { buffer[i] = 0; }
 	bool success = true;
 
-	FILE * fp = fopen(filename, "rb");
-	if (fp)
+	std::shared_ptr<const Chip8ROMImage> image = Chip8ROMImage::Load(filename);
+	if (image)
 	{
-		fseek(fp, 0, SEEK_END);
-		long filesize = ftell(fp);
-		rewind(fp);
-		fseek(fp, 0, SEEK_SET);
-		int r = fread(buffer, sizeof(unsigned char), filesize, fp);
-		fclose(fp);
-		
-		success = LoadROM((uint8_t*)buffer, filesize);
+		success = LoadROMImage(image);
 	}
 	else
 	{
@@ -176,11 +598,103 @@ bool Chip8::LoadROMFromFile(const char * filename)
 	return success;
 }
 
+std::shared_ptr<const Chip8ROMImage> Chip8::GetROMImage()
+{
+	return rom_image;
+}
+
 void Chip8::SetLogFunc(chip8_log_func func)
 {
 	log = func;
 }
 
+uint8_t Chip8::GetTraceLevel()
+{
+	return trace_level;
+}
+
+void Chip8::SetTraceLevel(uint8_t level)
+{
+	if (level > CHIP8_TRACE_MAX_LEVEL)
+	{
+		level = CHIP8_TRACE_MAX_LEVEL;
+	}
+
+	if (level != CHIP8_TRACE_NONE && trace == nullptr)
+	{
+		trace = new Chip8TraceRing();
+	}
+
+	trace_level = level;
+}
+
+Chip8TraceRing * Chip8::GetTrace()
+{
+	return trace;
+}
+
+uint32_t Chip8::GetErrorCount(uint8_t event)
+{
+	return event < CHIP8_TRACE_EVENT_COUNT ? error_counts[event] : 0;
+}
+
+bool Chip8::GetProfiling()
+{
+	return profiling;
+}
+
+void Chip8::SetProfiling(bool enabled)
+{
+	if (enabled && profile == nullptr)
+	{
+		profile = new Chip8Profile();
+	}
+
+	profiling = enabled;
+}
+
+Chip8Profile * Chip8::GetProfile()
+{
+	return profile;
+}
+
+bool Chip8::BeginTraceFile(const char * path)
+{
+	EndTraceFile();
+
+	trace_file = new Chip8TraceFile();
+	if (!trace_file->Open(path))
+	{
+		printf("Chip8 could not create trace file: %s\n", path);
+		delete trace_file;
+		trace_file = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void Chip8::EndTraceFile()
+{
+	delete trace_file;
+	trace_file = nullptr;
+}
+
+Chip8TraceFile * Chip8::GetTraceFile()
+{
+	return trace_file;
+}
+
+void Chip8::trace_event(uint8_t level, uint8_t event)
+{
+	trace->Push(level, event, (uint32_t)system_ticks, prog_count, opcode, index_reg);
+}
+
+void Chip8::error_event(uint8_t event)
+{
+	error_counts[event]++;
+	CHIP8_TRACE(CHIP8_TRACE_ERROR, event);
+}
+
 void Chip8::SetKey(uint8_t key, bool pressed)
 {
 	if (key >= 0 && key < 16)
@@ -235,6 +749,16 @@ short Chip8::GetProgCount()
 	return prog_count;
 }
 
+unsigned short Chip8::GetStackPointer()
+{
+	return stack_pointer;
+}
+
+unsigned short * Chip8::GetStack()
+{
+	return stack;
+}
+
 bool Chip8::GetConfig_8XY6_8XYE_VY_mode()
 {
 	return ambig_8XY6_8XYE_VY_mode;
@@ -243,6 +767,13 @@ bool Chip8::GetConfig_8XY6_8XYE_VY_mode()
 void Chip8::SetConfig_8XY6_8XYE_VY_mode(bool mode)
 {
 	ambig_8XY6_8XYE_VY_mode = mode;
+	select_quirk_policy();
+
+	// compiled shifts have the old mode baked in
+	if (jit)
+	{
+		jit->Flush();
+	}
 }
 
 bool Chip8::GetConfig_BNNN_ADD_mode()
@@ -253,6 +784,7 @@ bool Chip8::GetConfig_BNNN_ADD_mode()
 void Chip8::SetConfig_BNNN_ADD_mode(bool mode)
 {
 	ambig_BNNN_mode = mode;
+	select_quirk_policy();
 }
 
 bool Chip8::GetConfig_FX55_FX65_VY_mode()
@@ -263,355 +795,1271 @@ bool Chip8::GetConfig_FX55_FX65_VY_mode()
 void Chip8::SetConfig_FX55_FX65_VY_mode(bool mode)
 {
 	ambig_FX55_FX65_mode = mode;
+	select_quirk_policy();
 }
 
-void Chip8::fetch_opcode()
+uint8_t Chip8::GetQuirkPolicy()
 {
-	last_opcode = opcode;
-
-	uint8_t byte1 = memory[prog_count];
-	uint8_t byte2 = memory[prog_count + 1];
-
-	// merge the two opcodes by shifting the first
-	//  byte left by 8 so it occupies the first byte
-	//  of the unsigned short
-	opcode = byte1 << 8 | byte2;
+	return quirk_policy;
 }
 
-void Chip8::execute_opcode()
+void Chip8::SetQuirkPolicy(uint8_t policy)
 {
-	uint8_t n0 = get_nibble_0(opcode);
-	uint8_t n1 = get_nibble_1(opcode);
-	uint8_t n2 = get_nibble_2(opcode);
-	uint8_t n3 = get_nibble_3(opcode);
-
-	short NNN = get_nibbles123(opcode);
-	uint8_t NN = get_nibbles23(opcode);
-	uint8_t N = n3;
-	uint8_t X = n1;
-	uint8_t Y = n2;
-
-	int temp1 = 0;
-	int temp2 = 0;
-	int temp3 = 0;
-
-	log("Executing: 0x%X\n", opcode);
-	log("Split: 0x%X 0x%X 0x%X 0x%X\n", n0, n1, n2, n3);
-	log("NNN: 0x%X\n", (short)NNN);
-	log("NN : 0x%X\n", NN);
-	log("N  : 0x%X\n", N);
-	log("X  : 0x%X\n", X);
-	log("Y  : 0x%X\n", Y);
-	log("\n", Y);
-	
-	if (opcode == 0x0)
-	{
-		log("Unknown or unimplemented opcode 0x%X\n", opcode);
-		log("Previous opcode was 0x%X\n", last_opcode);
+	if (((policy & CHIP8_QUIRK_8XY6) != 0) != ambig_8XY6_8XYE_VY_mode)
+	{
+		SetConfig_8XY6_8XYE_VY_mode((policy & CHIP8_QUIRK_8XY6) != 0);
 	}
+	SetConfig_BNNN_ADD_mode((policy & CHIP8_QUIRK_BNNN) != 0);
+	SetConfig_FX55_FX65_VY_mode((policy & CHIP8_QUIRK_FX55) != 0);
+}
 
-	// check the left-most 2 bytes for the opcode in most cases
-	switch (n0) // check the first nibble only
-	{
-		//case: 0x0NNN: not needed for emulation
+void Chip8::select_quirk_policy()
+{
+	quirk_policy = (ambig_8XY6_8XYE_VY_mode ? CHIP8_QUIRK_8XY6 : 0) |
+		(ambig_BNNN_mode ? CHIP8_QUIRK_BNNN : 0) |
+		(ambig_FX55_FX65_mode ? CHIP8_QUIRK_FX55 : 0);
+	op_handlers = s_op_tables[quirk_policy];
+}
 
-	case 0x0: // 0x00..
+uint8_t Chip8::GetCoreMode()
+{
+	return core_mode;
+}
 
-		switch (n3)
+void Chip8::SetCoreMode(uint8_t mode)
+{
+	if (mode < CHIP8_CORE_COUNT)
+	{
+		core_mode = mode;
+	}
+
+	if (core_mode == CHIP8_CORE_JIT && jit == nullptr)
+	{
+		jit = new Chip8Jit();
+		if (!jit->Init())
 		{
-			case 0x0: // 0x00E0 - Clears the screen
-				clear_screen();
-				break;
-			case 0xE: // 0x00EE - returns from a subroutine
-				// pop the stack pointer? and move prog_counter back to it
-				stack_pointer--;
-				prog_count = stack[stack_pointer];
-				break;
-			default:
-				break;
-				log("Unknown or unimplemented opcode 0x%X\n", opcode);
+			// stays in jit mode, but everything runs through the predecoded interpreter
+			delete jit;
+			jit = nullptr;
 		}
+	}
+}
 
-		break;
+const char * Chip8::GetCoreName(uint8_t mode)
+{
+	switch (mode)
+	{
+		case CHIP8_CORE_SWITCH: return "switch";
+		case CHIP8_CORE_PREDECODED: return "predecoded";
+		case CHIP8_CORE_THREADED: return "threaded";
+		case CHIP8_CORE_JIT: return "jit";
+		default: return "unknown";
+	}
+}
 
-	case 0x1: // 0x1NNN - GOTO NNN
-		prog_count = NNN; //clear off the top nibble
-		prog_count -= 2;
-		break;
+const char * Chip8::GetOpName(uint8_t op)
+{
+	switch (op)
+	{
+#define CHIP8_OP_NAME(name) case CHIP8_OP_##name: return #name;
+		CHIP8_OPCODE_LIST(CHIP8_OP_NAME)
+#undef CHIP8_OP_NAME
+		default: return "?";
+	}
+}
 
-	case 0x2: // 0x2NNN - Calls subroutine at NNN
-		stack[stack_pointer] = prog_count;
-		stack_pointer++;
-		prog_count = NNN;
-		prog_count -= 2;
+void Chip8::InvalidateDecodeCache()
+{
+	invalidate_decode_all();
+}
 
-		break;
+void Chip8::fetch_opcode()
+{
+	last_opcode = opcode;
+
+	uint8_t byte1 = memory[prog_count & (CHIP8_TOTAL_MEMSIZE - 1)];
+	uint8_t byte2 = memory[(prog_count + 1) & (CHIP8_TOTAL_MEMSIZE - 1)];
+
+	// merge the two opcodes by shifting the first
+	//  byte left by 8 so it occupies the first byte
+	//  of the unsigned short
+	opcode = byte1 << 8 | byte2;
+}
+
+template <uint8_t Q>
+void Chip8::execute_opcode()
+{
+	// the original interpreter, a nested switch on the opcode's nibbles straight into the
+	// handlers with no decode cache and no table. it has to cover the same opcodes as
+	// decode_opcode(), chip8bench checks every core ends up in the same state
+	chip8_instr ins;
+	ins.opcode = opcode;
+	ins.NNN = get_nibbles123(opcode);
+	ins.NN = get_nibbles23(opcode);
+	ins.N = get_nibble_3(opcode);
+	ins.X = get_nibble_1(opcode);
+	ins.Y = get_nibble_2(opcode);
+	ins.op = CHIP8_OP_UNKNOWN;
+
+	CHIP8_TRACE(CHIP8_TRACE_INSTR, CHIP8_TRACE_EVENT_EXEC);
 
-	case 0x3: // 0x3XNN - Skip next instruction if VX equals NN
-		if (v_reg[X] == NN)
+	// check the left-most 2 bytes for the opcode in most cases
+	switch (get_nibble_0(opcode)) // check the first nibble only
+	{
+	case 0x0: // 0x00..
+		if ((ins.NNN & 0xFF0) == 0x0C0)
+		{
+			op_00CN<Q>(ins);
+			break;
+		}
+		switch (ins.NNN) // super-chip
 		{
-			prog_count += 2;
+			case 0x0FB: op_00FB<Q>(ins); break;
+			case 0x0FC: op_00FC<Q>(ins); break;
+			case 0x0FD: op_00FD<Q>(ins); break;
+			case 0x0FE: op_00FE<Q>(ins); break;
+			case 0x0FF: op_00FF<Q>(ins); break;
+			default:
+				switch (ins.N)
+				{
+					case 0x0: op_00E0<Q>(ins); break;
+					case 0xE: op_00EE<Q>(ins); break;
+					default: op_0NNN<Q>(ins); break;
+				}
+				break;
 		}
 		break;
 
-	case 0x4: // 0x4XNN - Skip next instruction is VX not equal to NN
-		if (v_reg[X] != NN)
+	case 0x1: op_1NNN<Q>(ins); break;
+	case 0x2: op_2NNN<Q>(ins); break;
+	case 0x3: op_3XNN<Q>(ins); break;
+	case 0x4: op_4XNN<Q>(ins); break;
+	case 0x5: op_5XY0<Q>(ins); break;
+	case 0x6: op_6XNN<Q>(ins); break;
+	case 0x7: op_7XNN<Q>(ins); break;
+
+	case 0x8: // 0x8... math operators
+		switch (ins.N) // check the right-most nibble
 		{
-			prog_count += 2;
+			case 0x0: op_8XY0<Q>(ins); break;
+			case 0x1: op_8XY1<Q>(ins); break;
+			case 0x2: op_8XY2<Q>(ins); break;
+			case 0x3: op_8XY3<Q>(ins); break;
+			case 0x4: op_8XY4<Q>(ins); break;
+			case 0x5: op_8XY5<Q>(ins); break;
+			case 0x6: op_8XY6<Q>(ins); break;
+			case 0x7: op_8XY7<Q>(ins); break;
+			case 0xE: op_8XYE<Q>(ins); break;
+			default: op_UNKNOWN<Q>(ins); break;
 		}
 		break;
 
-	case 0x5: // 0x4XY0 - Skip next instruction if VX equal to VY
-		if (v_reg[X] == v_reg[Y])
+	case 0x9: op_9XY0<Q>(ins); break;
+	case 0xA: op_ANNN<Q>(ins); break;
+	case 0xB: op_BNNN<Q>(ins); break;
+	case 0xC: op_CXNN<Q>(ins); break;
+	case 0xD:
+		if (ins.N == 0)
 		{
-			prog_count += 2;
+			op_DXY0<Q>(ins);
+		}
+		else
+		{
+			op_DXYN<Q>(ins);
 		}
 		break;
 
-	case 0x6: // 0x6XNN - Set VX to NN
-		v_reg[X] = NN;
+	case 0xE:
+		switch (ins.N)
+		{
+			case 0xE: op_EX9E<Q>(ins); break;
+			case 0x1: op_EXA1<Q>(ins); break;
+			default: op_UNKNOWN<Q>(ins); break;
+		}
 		break;
 
-	case 0x7: // 0x7XNN - Adds NN to VX (does not set carry flag!)
-		v_reg[X] += NN;
+	case 0xF: // all 0xFX..
+		switch (ins.NN)
+		{
+			case 0x07: op_FX07<Q>(ins); break;
+			case 0x0A: op_FX0A<Q>(ins); break;
+			case 0x15: op_FX15<Q>(ins); break;
+			case 0x18: op_FX18<Q>(ins); break;
+			case 0x1E: op_FX1E<Q>(ins); break;
+			case 0x29: op_FX29<Q>(ins); break;
+			case 0x30: op_FX30<Q>(ins); break;
+			case 0x33: op_FX33<Q>(ins); break;
+			case 0x55: op_FX55<Q>(ins); break;
+			case 0x65: op_FX65<Q>(ins); break;
+			case 0x75: op_FX75<Q>(ins); break;
+			case 0x85: op_FX85<Q>(ins); break;
+			default: op_UNKNOWN<Q>(ins); break;
+		}
 		break;
+	}
 
-	case 0x8: // 0x8... math operators I think
+	// every instruction is 2 bytes
+	prog_count += 2;
+}
 
-		switch (n3) // check the right-most nibble
+template <uint8_t Q>
+long long Chip8::run_switch(long long count)
+{
+	for (long long i = 0; i < count; i++)
+	{
+		fetch_opcode();
+		execute_opcode<Q>();
+		end_tick();
+		system_ticks++;
+	}
+
+	return count > 0 ? count : 0;
+}
+
+template <uint8_t Q>
+long long Chip8::run_predecoded(long long count)
+{
+	for (long long i = 0; i < count; i++)
+	{
+		const chip8_instr & ins = fetch_decoded();
+		last_opcode = opcode;
+		opcode = ins.opcode;
+		CHIP8_TRACE(CHIP8_TRACE_INSTR, CHIP8_TRACE_EVENT_EXEC);
+
+		// one dense switch on the decoded op, the handlers for this policy get inlined
+		// into it where a call through s_op_handlers<Q> couldn't be
+		switch (ins.op)
 		{
-			case 0x0: // 0x8XY0 - Sets VX to value of VY
-				v_reg[X] = v_reg[Y];
-				break;
-			case 0x1: // 0x8XY1 - Sets VX to VX bitwise OR'ed with VY
-				v_reg[X] = v_reg[X] | v_reg[Y];
-				break;
-			case 0x2: // 0x8XY2 - Sets VX to VX bitwise ANDed with VY
-				v_reg[X] = v_reg[X] & v_reg[Y];
-				break;
-			case 0x3: // 0x8XY3 - Sets VX to VX XORed with VY
-				v_reg[X] = v_reg[X] ^ v_reg[Y];
-				break;
-			case 0x4: // 0x8XY4 - Adds VY to VX, VF set to 1 when there's a carry
-				temp1 = v_reg[X];
-				v_reg[X] += v_reg[Y];
-				v_reg[15] = (v_reg[X] < temp1) ? 1 : 0;
-				break;
-			case 0x5: // 0x8XY5 - VY is subtracted from VX, VF is set 0 when borrow, 1 when not
-				v_reg[15] = (v_reg[X] > v_reg[Y]) ? 1 : 0;
-				v_reg[X] -= v_reg[Y];
+#define CHIP8_OP_CASE(name) case CHIP8_OP_##name: op_##name<Q>(ins); break;
+			CHIP8_OPCODE_LIST(CHIP8_OP_CASE)
+#undef CHIP8_OP_CASE
+			default: break;
+		}
 
-				break;
-			case 0x6: // 0x8XY6 - Stores least significant bit of VX in VF then shifts VX right by 1
-				// temp1 == lsb
-				if (ambig_8XY6_8XYE_VY_mode == AMBIG_8XY6_SHIFTMODE_SET_VX_TO_VY)
-				{
-					v_reg[X] = v_reg[Y];
-				}
+		prog_count += 2;
+		end_tick();
+		system_ticks++;
+	}
 
-				temp1 = v_reg[X] & 0x00000001;
-				v_reg[15] = temp1;
-				v_reg[X] = v_reg[X] >> 1;
-			
-				break;
-			case 0x7: // 0x8XY7 - Sets VX to VY minus VX, VF is set 0 when there's a borrow, 1 when not
-				v_reg[15] = (v_reg[Y] < v_reg[X]) ? 0 : 1;
-				v_reg[X] = v_reg[Y] - v_reg[X];
-				break;
-			case 0xE: // 0x8XYE - Stores the most significant bit of VX in VF and then shifts VX left by 1
-				// temp1 == msb
-				if (ambig_8XY6_8XYE_VY_mode == AMBIG_8XY6_SHIFTMODE_SET_VX_TO_VY)
-				{
-					v_reg[X] = v_reg[Y];
-				}
+	return count > 0 ? count : 0;
+}
 
-				temp1 = (v_reg[X] >> 7);
-				v_reg[15] = temp1;
-				v_reg[X] = v_reg[X] << 1; 
-				break;
+template <uint8_t Q>
+const Chip8::chip8_op_handler Chip8::s_op_handlers[CHIP8_OP_COUNT] =
+{
+	&Chip8::op_UNKNOWN<Q>, // CHIP8_OP_UNDECODED, never dispatched
+#define CHIP8_OP_HANDLER(name) &Chip8::op_##name<Q>,
+	CHIP8_OPCODE_LIST(CHIP8_OP_HANDLER)
+#undef CHIP8_OP_HANDLER
+};
+
+const Chip8::chip8_op_handler * const Chip8::s_op_tables[CHIP8_QUIRK_POLICIES] =
+{
+	s_op_handlers<0>, s_op_handlers<1>, s_op_handlers<2>, s_op_handlers<3>,
+	s_op_handlers<4>, s_op_handlers<5>, s_op_handlers<6>, s_op_handlers<7>
+};
+
+const Chip8::chip8_run_func Chip8::s_switch_runs[CHIP8_QUIRK_POLICIES] =
+{
+	&Chip8::run_switch<0>, &Chip8::run_switch<1>, &Chip8::run_switch<2>, &Chip8::run_switch<3>,
+	&Chip8::run_switch<4>, &Chip8::run_switch<5>, &Chip8::run_switch<6>, &Chip8::run_switch<7>
+};
+
+const Chip8::chip8_run_func Chip8::s_predecoded_runs[CHIP8_QUIRK_POLICIES] =
+{
+	&Chip8::run_predecoded<0>, &Chip8::run_predecoded<1>, &Chip8::run_predecoded<2>, &Chip8::run_predecoded<3>,
+	&Chip8::run_predecoded<4>, &Chip8::run_predecoded<5>, &Chip8::run_predecoded<6>, &Chip8::run_predecoded<7>
+};
+
+const Chip8::chip8_run_func Chip8::s_jit_fallbacks[CHIP8_QUIRK_POLICIES] =
+{
+	&Chip8::run_threaded<0, true>, &Chip8::run_threaded<1, true>, &Chip8::run_threaded<2, true>, &Chip8::run_threaded<3, true>,
+	&Chip8::run_threaded<4, true>, &Chip8::run_threaded<5, true>, &Chip8::run_threaded<6, true>, &Chip8::run_threaded<7, true>
+};
+
+const Chip8::chip8_run_func Chip8::s_threaded_runs[CHIP8_QUIRK_POLICIES] =
+{
+	&Chip8::run_threaded<0>, &Chip8::run_threaded<1>, &Chip8::run_threaded<2>, &Chip8::run_threaded<3>,
+	&Chip8::run_threaded<4>, &Chip8::run_threaded<5>, &Chip8::run_threaded<6>, &Chip8::run_threaded<7>
+};
+
+void Chip8::decode_opcode(unsigned short op, chip8_instr & ins)
+{
+	uint8_t n0 = get_nibble_0(op);
+	uint8_t n3 = get_nibble_3(op);
+
+	ins.opcode = op;
+	ins.NNN = get_nibbles123(op);
+	ins.NN = get_nibbles23(op);
+	ins.N = n3;
+	ins.X = get_nibble_1(op);
+	ins.Y = get_nibble_2(op);
+	ins.op = CHIP8_OP_UNKNOWN;
+
+	// check the left-most 2 bytes for the opcode in most cases
+	switch (n0) // check the first nibble only
+	{
+	case 0x0: // 0x00..
+		if ((ins.NNN & 0xFF0) == 0x0C0)
+		{
+			ins.op = CHIP8_OP_00CN; // super-chip scroll down
+			break;
+		}
+		switch (ins.NNN) // super-chip
+		{
+			case 0x0FB: ins.op = CHIP8_OP_00FB; break;
+			case 0x0FC: ins.op = CHIP8_OP_00FC; break;
+			case 0x0FD: ins.op = CHIP8_OP_00FD; break;
+			case 0x0FE: ins.op = CHIP8_OP_00FE; break;
+			case 0x0FF: ins.op = CHIP8_OP_00FF; break;
 			default:
-				log("Unknown or unimplemented opcode 0x%X\n", opcode);
+				switch (n3)
+				{
+					case 0x0: ins.op = CHIP8_OP_00E0; break;
+					case 0xE: ins.op = CHIP8_OP_00EE; break;
+					default: ins.op = CHIP8_OP_0NNN; break; // not needed for emulation
+				}
 				break;
 		}
+		break;
+
+	case 0x1: ins.op = CHIP8_OP_1NNN; break;
+	case 0x2: ins.op = CHIP8_OP_2NNN; break;
+	case 0x3: ins.op = CHIP8_OP_3XNN; break;
+	case 0x4: ins.op = CHIP8_OP_4XNN; break;
+	case 0x5: ins.op = CHIP8_OP_5XY0; break;
+	case 0x6: ins.op = CHIP8_OP_6XNN; break;
+	case 0x7: ins.op = CHIP8_OP_7XNN; break;
+
+	case 0x8: // 0x8... math operators
+		switch (n3) // check the right-most nibble
+		{
+			case 0x0: ins.op = CHIP8_OP_8XY0; break;
+			case 0x1: ins.op = CHIP8_OP_8XY1; break;
+			case 0x2: ins.op = CHIP8_OP_8XY2; break;
+			case 0x3: ins.op = CHIP8_OP_8XY3; break;
+			case 0x4: ins.op = CHIP8_OP_8XY4; break;
+			case 0x5: ins.op = CHIP8_OP_8XY5; break;
+			case 0x6: ins.op = CHIP8_OP_8XY6; break;
+			case 0x7: ins.op = CHIP8_OP_8XY7; break;
+			case 0xE: ins.op = CHIP8_OP_8XYE; break;
+			default: break;
+		}
+		break;
+
+	case 0x9: ins.op = CHIP8_OP_9XY0; break;
+	case 0xA: ins.op = CHIP8_OP_ANNN; break;
+	case 0xB: ins.op = CHIP8_OP_BNNN; break;
+	case 0xC: ins.op = CHIP8_OP_CXNN; break;
+	case 0xD: ins.op = n3 == 0 ? CHIP8_OP_DXY0 : CHIP8_OP_DXYN; break;
 
+	case 0xE:
+		switch (n3)
+		{
+			case 0xE: ins.op = CHIP8_OP_EX9E; break;
+			case 0x1: ins.op = CHIP8_OP_EXA1; break;
+			default: break;
+		}
 		break;
 
-	case 0x9: // 0x9XY0 - Skips the next instruction if VX does not equal VY
-		if (v_reg[X] != v_reg[Y])
+	case 0xF: // all 0xFX..
+		switch (ins.NN)
 		{
-			prog_count += 2;
+			case 0x07: ins.op = CHIP8_OP_FX07; break;
+			case 0x0A: ins.op = CHIP8_OP_FX0A; break;
+			case 0x15: ins.op = CHIP8_OP_FX15; break;
+			case 0x18: ins.op = CHIP8_OP_FX18; break;
+			case 0x1E: ins.op = CHIP8_OP_FX1E; break;
+			case 0x29: ins.op = CHIP8_OP_FX29; break;
+			case 0x30: ins.op = CHIP8_OP_FX30; break;
+			case 0x33: ins.op = CHIP8_OP_FX33; break;
+			case 0x55: ins.op = CHIP8_OP_FX55; break;
+			case 0x65: ins.op = CHIP8_OP_FX65; break;
+			case 0x75: ins.op = CHIP8_OP_FX75; break;
+			case 0x85: ins.op = CHIP8_OP_FX85; break;
+			default: break;
 		}
 		break;
 
-	case 0xA: // 0xANNN - Sets index_counter to the address NNN
-		index_reg = NNN;
+	default:
 		break;
+	}
+}
 
-	case 0xB: // 0xBNNN - Jumps to address NNN + V0
+const chip8_instr & Chip8::fetch_decoded()
+{
+	unsigned int offset = (unsigned int)prog_count - CHIP8_WORK_MEM_START;
 
-		if (ambig_BNNN_mode == AMBIG_BNNN_ADD_V0)
+	// the last byte of ram can't hold a whole instruction, decode that one
+	// (and anything outside work ram) every time
+	if (offset < CHIP8_DECODE_CACHE_SIZE - 1)
+	{
+		chip8_instr & ins = decode_cache[offset];
+		if (ins.op == CHIP8_OP_UNDECODED)
 		{
-			prog_count = NNN + v_reg[0];
+			decode_opcode(memory[prog_count] << 8 | memory[prog_count + 1], ins);
 		}
-		else
+		return ins;
+	}
+
+	// the caller moves opcode into last_opcode itself, so read the bytes without fetch_opcode()
+	uint8_t byte1 = memory[prog_count & (CHIP8_TOTAL_MEMSIZE - 1)];
+	uint8_t byte2 = memory[(prog_count + 1) & (CHIP8_TOTAL_MEMSIZE - 1)];
+	decode_opcode(byte1 << 8 | byte2, decode_scratch);
+	return decode_scratch;
+}
+
+void Chip8::execute_instr(const chip8_instr & ins)
+{
+	CHIP8_TRACE(CHIP8_TRACE_INSTR, CHIP8_TRACE_EVENT_EXEC);
+
+	(this->*op_handlers[ins.op])(ins);
+
+	// every instruction is 2 bytes
+	prog_count += 2;
+}
+
+// gcc and clang can take the address of a label, which lets every handler
+// jump straight to the next one instead of going back through a loop
+#if defined(__GNUC__) || defined(__clang__)
+#define CHIP8_HAS_COMPUTED_GOTO 1
+#else
+#define CHIP8_HAS_COMPUTED_GOTO 0
+#endif
+
+template <uint8_t Q, bool UntilBlock>
+long long Chip8::run_threaded(long long count)
+{
+	// UntilBlock is the jit core's fallback, it stops as soon as the next pc might
+	// have a compiled block. either way it returns how many instructions it ran
+	if (count <= 0)
+	{
+		return 0;
+	}
+
+	long long remaining = count;
+	const chip8_instr * ins;
+
+#if CHIP8_HAS_COMPUTED_GOTO
+	static void * const s_labels[CHIP8_OP_COUNT] =
+	{
+		&&label_UNDECODED,
+#define CHIP8_OP_LABEL(name) &&label_##name,
+		CHIP8_OPCODE_LIST(CHIP8_OP_LABEL)
+#undef CHIP8_OP_LABEL
+	};
+
+#define CHIP8_THREADED_DISPATCH() \
+	ins = &fetch_decoded(); \
+	last_opcode = opcode; \
+	opcode = ins->opcode; \
+	CHIP8_TRACE(CHIP8_TRACE_INSTR, CHIP8_TRACE_EVENT_EXEC); \
+	goto *s_labels[ins->op]
+
+	CHIP8_THREADED_DISPATCH();
+
+	// each handler finishes the tick and dispatches the next instruction itself
+#define CHIP8_OP_THREADED(name) \
+label_##name: \
+	op_##name<Q>(*ins); \
+	prog_count += 2; \
+	end_tick(); \
+	system_ticks++; \
+	if (--remaining == 0) goto done; \
+	if (UntilBlock && jit->MayHaveBlock(prog_count)) goto done; \
+	CHIP8_THREADED_DISPATCH();
+
+	CHIP8_OPCODE_LIST(CHIP8_OP_THREADED)
+#undef CHIP8_OP_THREADED
+#undef CHIP8_THREADED_DISPATCH
+
+label_UNDECODED: // fetch_decoded never hands these out
+done:
+	return count - remaining;
+#else
+	// no computed goto (msvc), a dense switch is the next best thing
+	while (remaining > 0)
+	{
+		ins = &fetch_decoded();
+		last_opcode = opcode;
+		opcode = ins->opcode;
+		CHIP8_TRACE(CHIP8_TRACE_INSTR, CHIP8_TRACE_EVENT_EXEC);
+
+		switch (ins->op)
 		{
-			prog_count = NNN + v_reg[X];
+#define CHIP8_OP_CASE(name) case CHIP8_OP_##name: op_##name<Q>(*ins); break;
+			CHIP8_OPCODE_LIST(CHIP8_OP_CASE)
+#undef CHIP8_OP_CASE
+			default: break;
 		}
 
-		prog_count -= 2;
-		break;
+		prog_count += 2;
+		end_tick();
+		system_ticks++;
+		remaining--;
 
-	case 0xC: // 0xCXNN - Sets VX to result of bitwise AND op on a random number (0-255) and NN (rand() & NN)
-		// temp1 == rand
-		temp1 = system_ticks % 256; // not rand at all really, but hey
-		v_reg[X] = temp1 & NN;
-		break;
+		if (UntilBlock && jit->MayHaveBlock(prog_count))
+		{
+			break;
+		}
+	}
+
+	return count - remaining;
+#endif
+}
+
+long long Chip8::run_jit(long long count)
+{
+	long long remaining = count;
 
-	case 0xD: // 0xDXYN - Draw a sprite at coordinate (VX, VY), width 8 pixels, height N pixels
-				// read as bit-coded starting from memory location index_counter, index_counter does not change
-				// VF is set to 1 if any screen pixels are flipped from SET to UNSET when draw, 0 if not
+	while (remaining > 0)
 	{
-		uint8_t sprite = 0;
-		uint8_t bit1 = 0;
-		uint8_t oldBit = 0;
+		// compiled code chains from block to block by itself, it comes back here when the
+		// next pc isn't compiled yet, can't be, or the next block doesn't fit in what's left
+		// (so Run stops on the exact instruction)
+		const chip8_jit_block * block = jit->GetBlock(memory, prog_count, ambig_8XY6_8XYE_VY_mode);
+		if (block && block->length > remaining)
+		{
+			// the end of the run, it's not worth coming back to the jit for a few instructions
+			return count - remaining + (this->*s_predecoded_runs[quirk_policy])(remaining);
+		}
 
-		v_reg[15] = 0;
-		for (short py = 0; py < N; py++)
+		if (block)
 		{
-			sprite = memory[index_reg + py];
-			for (short px = 0; px < 8; px++)
+			chip8_jit_context ctx;
+			ctx.v_reg = v_reg;
+			ctx.stack = stack;
+			ctx.remaining = remaining;
+			ctx.index_reg = index_reg;
+			ctx.prog_count = prog_count;
+			ctx.stack_pointer = stack_pointer;
+			ctx.opcode = opcode;
+			ctx.last_opcode = last_opcode;
+
+			jit->Enter(ctx, prog_count);
+
+			index_reg = ctx.index_reg;
+			prog_count = ctx.prog_count;
+			stack_pointer = ctx.stack_pointer;
+			opcode = ctx.opcode;
+			last_opcode = ctx.last_opcode;
+
+			long long ran = remaining - ctx.remaining;
+			if (ran > 0)
 			{
-				bit1 = sprite & (0x80 >> px);
-				int gfx_idx = ((short)v_reg[X] + px) + ((short)(v_reg[Y] + py) * 64);
-				oldBit = (screen_buf[gfx_idx]);
-				
-				if (bit1 && (screen_buf[gfx_idx]))
-				{
-					// if it was unset, set VF
-					v_reg[15] = 1;
-				}
+				// same as running end_tick() once per instruction
+				tick_timers(ran);
+				user_keypressed = false;
 
-				screen_buf[gfx_idx] ^= bit1;
+				system_ticks += ran;
+				remaining -= ran;
+				continue;
 			}
 		}
 
-		break;
+		// whatever the blocks can't do (draws, key waits, memory ops, a call with the stack
+		// full), through the interpreter up to the next pc that can have a block
+		remaining -= (this->*s_jit_fallbacks[quirk_policy])(remaining);
 	}
-	case 0xE: 
-		switch (n3)
+
+	return count > 0 ? count : 0;
+}
+
+long long Chip8::run_instrumented(long long count)
+{
+	// always the predecoded path, whatever the core, so every instruction has its chip8_op
+	// and a before and after. the counts and trace records don't depend on the core, the
+	// sampled times are the interpreter's
+	uint8_t before[CHIP8_TOTAL_V_REGS];
+
+	for (long long i = 0; i < count; i++)
+	{
+		unsigned short pc = prog_count;
+		const chip8_instr & ins = fetch_decoded();
+		last_opcode = opcode;
+		opcode = ins.opcode;
+
+		// the instruction can write over its own cache entry
+		uint8_t op = ins.op;
+
+		if (trace_file)
 		{
-			case 0xE: // 0xEX9E - Skips next instruction if the key stored in VX is pressed
-				// temp 1 == key num
-				temp1 = v_reg[X];
-				if (temp1 <= 15 && keys[temp1])
-				{
-					prog_count += 2;
-				}
-				break;
-			case 0x1: // 0xEXA1 - Skips next instruction if the key stored in VX is not pressed
-				temp1 = v_reg[X];
-				if (temp1 <= 15 && !keys[temp1])
-				{
-					prog_count += 2;
-				}
-				break;
-			default:
-				log("Unknown or unimplemented opcode 0x%X\n", opcode);
-				break;
+			memcpy(before, v_reg, sizeof(before));
 		}
 
-		break;
+		if (profiling)
+		{
+			profile->Count(op, pc);
+		}
 
-	case 0xF: // all 0xFX..
-		switch ((NN))
+		if (profiling && profile->SampleDue())
 		{
-			case 0x07: // 0xFX07 - Sets VX to the value of the delay timer
-				v_reg[X] = delay_timer;
-				break;
-			case 0x0A: // 0xFX0A - A key press is awaited and then stored in VX (Blocking operation!)
-				if (user_keypressed)
-				{
-					v_reg[X] = last_keypressed;
-				}
-				else
-				{
-					prog_count -= 2;
-				}
-				break;
-			case 0x15: // 0xFX15 - Sets delay_timer to VX
-				delay_timer = v_reg[X];
-				break;
-			case 0x18: // 0xFX18 - Sets sound timer to VX
-				sound_timer = v_reg[X];
-				break;
-			case 0x1E: // 0xFX1E - Adds VX to index_counter, VF is not affected
-				index_reg += v_reg[X];
-				break;
-			case 0x29: // 0xFX29 - Sets index_counter to location of the sprite for the character in VX
-							// sprite means font sprite for the CHAR 0-F
-				// temp1 == character num
-				temp1 = v_reg[X];
-				if (temp1 <= 15)
-				{
-					index_reg = CHIP8_FONTSET_MEM_START + (16 * temp1);
-				}
-				
-				break;
-			case 0x33: // 0xFX33 - Stores the binary-coded decimel representation of VX, with the most significant
-								// three digits at the address in index_counter, the middle digit at index+1, and the least
-								// significant digit at index+2
-								// or: take the decimal representation of VX, place the hundreds digit in memory 
-								// at location in I, the tens digit at location I+1, and the ones digit at location I+2
-				temp1 = v_reg[X];
-				temp1 = v_reg[X] / 100;
-				temp2 = (v_reg[X] - (temp1*100)) / 10;
-				temp3 = (v_reg[X]) % 10;
-				memory[index_reg] = temp1;
-				memory[index_reg+1] = temp2;
-				memory[index_reg+2] = temp3;
-				break;
-			case 0x55: // 0xFX55 - Stores V0 to VX (including VX) in memory starting at address index_counter.
-						// the offset from index_counter is increased by 1 for each value written. 
-						// But index_count itself is not modified
-				temp1 = index_reg;//temp1 == address
-				if (X > 15) X = 15;
-				for (int i = 0; i <= X; i++)
-				{
-					memory[temp1+i] = v_reg[i];
-				}
+			auto start = std::chrono::steady_clock::now();
+			execute_instr(ins);
+			auto end = std::chrono::steady_clock::now();
+			profile->Sample(op, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+		else
+		{
+			execute_instr(ins);
+		}
 
-				if (ambig_FX55_FX65_mode == AMBIG_FX55_FX65_INC_I)
-				{
-					index_reg += X;
-				}
+		if (trace_file)
+		{
+			write_trace_record(pc, before);
+		}
 
-				break;
-			case 0x65: // 0xFX65 - Fills V0 to VX (including) with values from memory starting at address index_count
-							// offset is increase per value but index_count is left unmodified same as 0XFX55
-				temp1 = index_reg;
-				if (X > 15) X = 15;
-				for (int i = 0; i <= X; i++)
-				{
-					v_reg[i] = memory[temp1+i];
-				}
+		end_tick();
+		system_ticks++;
+	}
 
-				if (ambig_FX55_FX65_mode == AMBIG_FX55_FX65_INC_I)
-				{
-					index_reg += X;
-				}
+	return count > 0 ? count : 0;
+}
 
-				break;
-			default:
-				log("Unknown or unimplemented opcode 0x%X\n", opcode);
-				break;
+void Chip8::write_trace_record(unsigned short pc, const uint8_t * before)
+{
+	chip8_trace_file_record * rec = trace_file->Next();
+	rec->tick = (uint32_t)system_ticks;
+	rec->pc = pc;
+	rec->opcode = opcode;
+	rec->index_reg = index_reg;
+
+	uint16_t changed = 0;
+	for (int i = 0; i < CHIP8_TOTAL_V_REGS; i++)
+	{
+		changed |= (uint16_t)(v_reg[i] != before[i]) << i;
+	}
+	rec->changed = changed;
+
+	// VF changes alongside most alu ops, it has its own field
+	rec->reg = CHIP8_TRACE_FILE_NO_REG;
+	rec->value = 0;
+	for (int i = 0; i < CHIP8_TOTAL_V_REGS - 1; i++)
+	{
+		if (changed & (1 << i))
+		{
+			rec->reg = (uint8_t)i;
+			rec->value = v_reg[i];
+			break;
 		}
-		break;
+	}
 
-	default:
-		log("Unknown or unimplemented opcode 0x%X\n", opcode);
-		break;
+	rec->vf = v_reg[0xF];
+	rec->sp = (uint8_t)stack_pointer;
+}
+
+void Chip8::invalidate_decode(int address, int length)
+{
+	// an instruction starting one byte before the write overlaps it too
+	int first = address - 1 - CHIP8_WORK_MEM_START;
+	int last = address + length - CHIP8_WORK_MEM_START;
+
+	if (first < 0) first = 0;
+	if (last > CHIP8_DECODE_CACHE_SIZE) last = CHIP8_DECODE_CACHE_SIZE;
+
+	for (int i = first; i < last; i++)
+	{
+		decode_cache[i].op = CHIP8_OP_UNDECODED;
 	}
 
-	// every instruction is 2 bytes
-	prog_count += 2;
+	if (jit)
+	{
+		jit->Invalidate(address, length);
+	}
+}
+
+void Chip8::invalidate_decode_all()
+{
+	for (int i = 0; i < CHIP8_DECODE_CACHE_SIZE; i++)
+	{
+		decode_cache[i].op = CHIP8_OP_UNDECODED;
+	}
+
+	if (jit)
+	{
+		jit->Flush();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// opcode handlers
+// prog_count still points at the current instruction here, execute_instr
+// moves it on by 2 afterwards
+///////////////////////////////////////////////////////////////////////////////
+
+template <uint8_t Q>
+void Chip8::op_UNKNOWN(const chip8_instr & ins)
+{
+	error_event(CHIP8_TRACE_EVENT_UNKNOWN_OPCODE);
+	log("Unknown or unimplemented opcode 0x%X\n", ins.opcode);
+}
+
+template <uint8_t Q>
+void Chip8::op_0NNN(const chip8_instr & ins)
+{
+	// 0x0NNN - call machine code routine, not needed for emulation
+}
+
+template <uint8_t Q>
+void Chip8::op_00E0(const chip8_instr & ins)
+{
+	// 0x00E0 - Clears the screen
+	// (0x0000 lands here too, which is almost always the pc running off into empty ram)
+	if (ins.opcode == 0x0)
+	{
+		error_event(CHIP8_TRACE_EVENT_NULL_OPCODE);
+		log("Unknown or unimplemented opcode 0x%X\n", ins.opcode);
+		log("Previous opcode was 0x%X\n", last_opcode);
+	}
+
+	clear_screen();
+}
+
+template <uint8_t Q>
+void Chip8::op_00EE(const chip8_instr & ins)
+{
+	// 0x00EE - returns from a subroutine
+	// pop the stack pointer? and move prog_counter back to it
+	if (stack_pointer == 0)
+	{
+		// nothing to return to, carry on with the next instruction
+		error_event(CHIP8_TRACE_EVENT_STACK_UNDERFLOW);
+		return;
+	}
+
+	stack_pointer--;
+	prog_count = stack[stack_pointer];
+}
+
+template <uint8_t Q>
+void Chip8::op_1NNN(const chip8_instr & ins)
+{
+	// 0x1NNN - GOTO NNN
+	prog_count = ins.NNN;
+	prog_count -= 2;
+}
+
+template <uint8_t Q>
+void Chip8::op_2NNN(const chip8_instr & ins)
+{
+	// 0x2NNN - Calls subroutine at NNN
+	if (stack_pointer >= CHIP8_STACK_SIZE)
+	{
+		// out of stack, the call still happens but it can never return
+		error_event(CHIP8_TRACE_EVENT_STACK_OVERFLOW);
+	}
+	else
+	{
+		stack[stack_pointer] = prog_count;
+		stack_pointer++;
+	}
+
+	prog_count = ins.NNN;
+	prog_count -= 2;
+}
+
+template <uint8_t Q>
+void Chip8::op_3XNN(const chip8_instr & ins)
+{
+	// 0x3XNN - Skip next instruction if VX equals NN
+	if (v_reg[ins.X] == ins.NN)
+	{
+		prog_count += 2;
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_4XNN(const chip8_instr & ins)
+{
+	// 0x4XNN - Skip next instruction is VX not equal to NN
+	if (v_reg[ins.X] != ins.NN)
+	{
+		prog_count += 2;
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_5XY0(const chip8_instr & ins)
+{
+	// 0x5XY0 - Skip next instruction if VX equal to VY
+	if (v_reg[ins.X] == v_reg[ins.Y])
+	{
+		prog_count += 2;
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_6XNN(const chip8_instr & ins)
+{
+	// 0x6XNN - Set VX to NN
+	v_reg[ins.X] = ins.NN;
+}
+
+template <uint8_t Q>
+void Chip8::op_7XNN(const chip8_instr & ins)
+{
+	// 0x7XNN - Adds NN to VX (does not set carry flag!)
+	v_reg[ins.X] += ins.NN;
+}
+
+template <uint8_t Q>
+void Chip8::op_8XY0(const chip8_instr & ins)
+{
+	// 0x8XY0 - Sets VX to value of VY
+	v_reg[ins.X] = v_reg[ins.Y];
+}
+
+template <uint8_t Q>
+void Chip8::op_8XY1(const chip8_instr & ins)
+{
+	// 0x8XY1 - Sets VX to VX bitwise OR'ed with VY
+	v_reg[ins.X] = v_reg[ins.X] | v_reg[ins.Y];
+}
+
+template <uint8_t Q>
+void Chip8::op_8XY2(const chip8_instr & ins)
+{
+	// 0x8XY2 - Sets VX to VX bitwise ANDed with VY
+	v_reg[ins.X] = v_reg[ins.X] & v_reg[ins.Y];
+}
+
+template <uint8_t Q>
+void Chip8::op_8XY3(const chip8_instr & ins)
+{
+	// 0x8XY3 - Sets VX to VX XORed with VY
+	v_reg[ins.X] = v_reg[ins.X] ^ v_reg[ins.Y];
+}
+
+template <uint8_t Q>
+void Chip8::op_8XY4(const chip8_instr & ins)
+{
+	// 0x8XY4 - Adds VY to VX, VF set to 1 when there's a carry
+	int temp1 = v_reg[ins.X];
+	v_reg[ins.X] += v_reg[ins.Y];
+	v_reg[15] = (v_reg[ins.X] < temp1) ? 1 : 0;
+}
+
+template <uint8_t Q>
+void Chip8::op_8XY5(const chip8_instr & ins)
+{
+	// 0x8XY5 - VY is subtracted from VX, VF is set 0 when borrow, 1 when not
+	v_reg[15] = (v_reg[ins.X] > v_reg[ins.Y]) ? 1 : 0;
+	v_reg[ins.X] -= v_reg[ins.Y];
+}
+
+template <uint8_t Q>
+void Chip8::op_8XY6(const chip8_instr & ins)
+{
+	// 0x8XY6 - Stores least significant bit of VX in VF then shifts VX right by 1
+	if constexpr (((Q & CHIP8_QUIRK_8XY6) != 0) == AMBIG_8XY6_SHIFTMODE_SET_VX_TO_VY)
+	{
+		v_reg[ins.X] = v_reg[ins.Y];
+	}
+
+	// temp1 == lsb
+	int temp1 = v_reg[ins.X] & 0x00000001;
+	v_reg[15] = temp1;
+	v_reg[ins.X] = v_reg[ins.X] >> 1;
+}
+
+template <uint8_t Q>
+void Chip8::op_8XY7(const chip8_instr & ins)
+{
+	// 0x8XY7 - Sets VX to VY minus VX, VF is set 0 when there's a borrow, 1 when not
+	v_reg[15] = (v_reg[ins.Y] < v_reg[ins.X]) ? 0 : 1;
+	v_reg[ins.X] = v_reg[ins.Y] - v_reg[ins.X];
+}
+
+template <uint8_t Q>
+void Chip8::op_8XYE(const chip8_instr & ins)
+{
+	// 0x8XYE - Stores the most significant bit of VX in VF and then shifts VX left by 1
+	if constexpr (((Q & CHIP8_QUIRK_8XY6) != 0) == AMBIG_8XY6_SHIFTMODE_SET_VX_TO_VY)
+	{
+		v_reg[ins.X] = v_reg[ins.Y];
+	}
+
+	// temp1 == msb
+	int temp1 = (v_reg[ins.X] >> 7);
+	v_reg[15] = temp1;
+	v_reg[ins.X] = v_reg[ins.X] << 1;
+}
+
+template <uint8_t Q>
+void Chip8::op_9XY0(const chip8_instr & ins)
+{
+	// 0x9XY0 - Skips the next instruction if VX does not equal VY
+	if (v_reg[ins.X] != v_reg[ins.Y])
+	{
+		prog_count += 2;
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_ANNN(const chip8_instr & ins)
+{
+	// 0xANNN - Sets index_counter to the address NNN
+	index_reg = ins.NNN;
+}
+
+template <uint8_t Q>
+void Chip8::op_BNNN(const chip8_instr & ins)
+{
+	// 0xBNNN - Jumps to address NNN + V0
+	if constexpr (((Q & CHIP8_QUIRK_BNNN) != 0) == AMBIG_BNNN_ADD_V0)
+	{
+		prog_count = ins.NNN + v_reg[0];
+	}
+	else
+	{
+		prog_count = ins.NNN + v_reg[ins.X];
+	}
+
+	prog_count -= 2;
+}
+
+template <uint8_t Q>
+void Chip8::op_CXNN(const chip8_instr & ins)
+{
+	// 0xCXNN - Sets VX to result of bitwise AND op on a random number (0-255) and NN (rand() & NN)
+	v_reg[ins.X] = next_random() & ins.NN;
+}
+
+template <uint8_t Q>
+void Chip8::op_DXYN(const chip8_instr & ins)
+{
+	// 0xDXYN - Draw a sprite at coordinate (VX, VY), width 8 pixels, height N pixels
+	// read as bit-coded starting from memory location index_counter, index_counter does not change
+	// VF is set to 1 if any screen pixels are flipped from SET to UNSET when draw, 0 if not
+	draw_sprite<8>(ins, ins.N);
+}
+
+template <uint8_t W>
+void Chip8::draw_sprite(const chip8_instr & ins, int height)
+{
+	// W pixels wide, W / 8 bytes a row. the start position wraps around the screen, the
+	// sprite itself is clipped at the edges
+	int x = v_reg[ins.X] % GetScreenWidth();
+	int y = v_reg[ins.Y] % GetScreenHeight();
+	int rows = GetScreenHeight();
+	int word = x >> 6;
+	int shift = x & 63;
+	// a sprite can only carry over into the next word in hires, lores is one word wide
+	bool carries = hires && shift != 0 && word + 1 < CHIP8_SCREEN_ROW_WORDS;
+	uint64_t collided = 0;
+
+	for (int py = 0; py < height && y + py < rows; py++)
+	{
+		int address = index_reg + py * (W / 8);
+		uint64_t bits = memory[address & (CHIP8_TOTAL_MEMSIZE - 1)];
+		if constexpr (W == 16)
+		{
+			bits = bits << 8 | memory[(address + 1) & (CHIP8_TOTAL_MEMSIZE - 1)];
+		}
+
+		// sprite row up to pixel 0 of the word, then across to x. what crosses into the next
+		// word carries over, anything past the right edge drops off
+		uint64_t * row = screen_rows[y + py];
+		uint64_t sprite = bits << (64 - W);
+		uint64_t first = sprite >> shift;
+		uint64_t second = carries ? sprite << (64 - shift) : 0;
+		collided |= (row[word] & first) | (carries ? row[word + 1] & second : 0);
+		row[word] ^= first;
+		if (carries)
+		{
+			row[word + 1] ^= second;
+		}
+		if (first | second)
+		{
+			screen_dirty |= 1ULL << (y + py);
+		}
+	}
+
+	v_reg[15] = collided ? 1 : 0;
+}
+
+template <uint8_t Q>
+void Chip8::op_EX9E(const chip8_instr & ins)
+{
+	// 0xEX9E - Skips next instruction if the key stored in VX is pressed
+	// temp 1 == key num
+	int temp1 = v_reg[ins.X];
+	if (temp1 <= 15 && keys[temp1])
+	{
+		prog_count += 2;
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_EXA1(const chip8_instr & ins)
+{
+	// 0xEXA1 - Skips next instruction if the key stored in VX is not pressed
+	int temp1 = v_reg[ins.X];
+	if (temp1 <= 15 && !keys[temp1])
+	{
+		prog_count += 2;
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_FX07(const chip8_instr & ins)
+{
+	// 0xFX07 - Sets VX to the value of the delay timer
+	v_reg[ins.X] = delay_timer;
+}
+
+template <uint8_t Q>
+void Chip8::op_FX0A(const chip8_instr & ins)
+{
+	// 0xFX0A - A key press is awaited and then stored in VX (Blocking operation!)
+	if (user_keypressed)
+	{
+		v_reg[ins.X] = last_keypressed;
+	}
+	else
+	{
+		prog_count -= 2;
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_FX15(const chip8_instr & ins)
+{
+	// 0xFX15 - Sets delay_timer to VX
+	delay_timer = v_reg[ins.X];
+}
+
+template <uint8_t Q>
+void Chip8::op_FX18(const chip8_instr & ins)
+{
+	// 0xFX18 - Sets sound timer to VX
+	sound_timer = v_reg[ins.X];
+}
+
+template <uint8_t Q>
+void Chip8::op_FX1E(const chip8_instr & ins)
+{
+	// 0xFX1E - Adds VX to index_counter, VF is not affected
+	index_reg += v_reg[ins.X];
+}
+
+template <uint8_t Q>
+void Chip8::op_FX29(const chip8_instr & ins)
+{
+	// 0xFX29 - Sets index_counter to location of the sprite for the character in VX
+	// sprite means font sprite for the CHAR 0-F
+	// temp1 == character num
+	int temp1 = v_reg[ins.X];
+	if (temp1 <= 15)
+	{
+		index_reg = CHIP8_FONTSET_MEM_START + (16 * temp1);
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_FX33(const chip8_instr & ins)
+{
+	// 0xFX33 - Stores the binary-coded decimel representation of VX, with the most significant
+	// three digits at the address in index_counter, the middle digit at index+1, and the least
+	// significant digit at index+2
+	// or: take the decimal representation of VX, place the hundreds digit in memory 
+	// at location in I, the tens digit at location I+1, and the ones digit at location I+2
+	int temp1 = v_reg[ins.X] / 100;
+	int temp2 = (v_reg[ins.X] - (temp1 * 100)) / 10;
+	int temp3 = (v_reg[ins.X]) % 10;
+	memory[(index_reg) & (CHIP8_TOTAL_MEMSIZE - 1)] = temp1;
+	memory[(index_reg + 1) & (CHIP8_TOTAL_MEMSIZE - 1)] = temp2;
+	memory[(index_reg + 2) & (CHIP8_TOTAL_MEMSIZE - 1)] = temp3;
+
+	invalidate_decode(index_reg & (CHIP8_TOTAL_MEMSIZE - 1), 3);
+}
+
+template <uint8_t Q>
+void Chip8::op_FX55(const chip8_instr & ins)
+{
+	// 0xFX55 - Stores V0 to VX (including VX) in memory starting at address index_counter.
+	// the offset from index_counter is increased by 1 for each value written. 
+	// But index_count itself is not modified
+	int temp1 = index_reg; //temp1 == address
+	for (int i = 0; i <= ins.X; i++)
+	{
+		memory[(temp1 + i) & (CHIP8_TOTAL_MEMSIZE - 1)] = v_reg[i];
+	}
+
+	// self-modifying roms: drop whatever was decoded from the bytes we just wrote
+	invalidate_decode(temp1 & (CHIP8_TOTAL_MEMSIZE - 1), ins.X + 1);
+
+	if constexpr (((Q & CHIP8_QUIRK_FX55) != 0) == AMBIG_FX55_FX65_INC_I)
+	{
+		index_reg += ins.X;
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_FX65(const chip8_instr & ins)
+{
+	// 0xFX65 - Fills V0 to VX (including) with values from memory starting at address index_count
+	// offset is increase per value but index_count is left unmodified same as 0XFX55
+	int temp1 = index_reg;
+	for (int i = 0; i <= ins.X; i++)
+	{
+		v_reg[i] = memory[(temp1 + i) & (CHIP8_TOTAL_MEMSIZE - 1)];
+	}
+
+	if constexpr (((Q & CHIP8_QUIRK_FX55) != 0) == AMBIG_FX55_FX65_INC_I)
+	{
+		index_reg += ins.X;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// super-chip
+// the 1.1 instructions, scroll distances are in pixels of the current
+// resolution and DXY0 is 16x16 in lores too, like most interpreters since
+///////////////////////////////////////////////////////////////////////////////
+
+template <uint8_t Q>
+void Chip8::op_00CN(const chip8_instr & ins)
+{
+	// 0x00CN - Scrolls the screen down N rows, the top N rows come in blank
+	// a memmove of whole packed rows, and only the rows that had or now have something lit are redrawn
+	int rows = GetScreenHeight();
+	int n = ins.N;
+	uint64_t lit = 0;
+	for (int y = 0; y < rows; y++)
+	{
+		uint64_t any = 0;
+		for (int w = 0; w < CHIP8_SCREEN_ROW_WORDS; w++)
+		{
+			any |= screen_rows[y][w];
+		}
+		if (any)
+		{
+			lit |= 1ULL << y;
+		}
+	}
+	if (n == 0 || lit == 0)
+	{
+		return;
+	}
+
+	memmove(screen_rows[n], screen_rows[0], (rows - n) * sizeof(screen_rows[0]));
+	memset(screen_rows[0], 0, n * sizeof(screen_rows[0]));
+
+	uint64_t visible = rows < 64 ? (1ULL << rows) - 1 : CHIP8_SCREEN_ALL_ROWS;
+	screen_dirty |= lit | ((lit << n) & visible);
+}
+
+template <uint8_t Q>
+void Chip8::op_00FB(const chip8_instr & ins)
+{
+	// 0x00FB - Scrolls the screen right 4 pixels, each row is a shift across its words
+	int rows = GetScreenHeight();
+	int words = hires ? CHIP8_SCREEN_ROW_WORDS : 1;
+	for (int y = 0; y < rows; y++)
+	{
+		uint64_t * row = screen_rows[y];
+		uint64_t any = 0;
+		for (int w = words - 1; w > 0; w--)
+		{
+			any |= row[w];
+			row[w] = (row[w] >> CHIP8_SCREEN_SCROLL_X) | (row[w - 1] << (64 - CHIP8_SCREEN_SCROLL_X));
+		}
+		any |= row[0];
+		row[0] >>= CHIP8_SCREEN_SCROLL_X;
+
+		// a lit row always changes, a blank one never does
+		if (any)
+		{
+			screen_dirty |= 1ULL << y;
+		}
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_00FC(const chip8_instr & ins)
+{
+	// 0x00FC - Scrolls the screen left 4 pixels
+	int rows = GetScreenHeight();
+	int words = hires ? CHIP8_SCREEN_ROW_WORDS : 1;
+	for (int y = 0; y < rows; y++)
+	{
+		uint64_t * row = screen_rows[y];
+		uint64_t any = 0;
+		for (int w = 0; w < words - 1; w++)
+		{
+			any |= row[w];
+			row[w] = (row[w] << CHIP8_SCREEN_SCROLL_X) | (row[w + 1] >> (64 - CHIP8_SCREEN_SCROLL_X));
+		}
+		any |= row[words - 1];
+		row[words - 1] <<= CHIP8_SCREEN_SCROLL_X;
+
+		if (any)
+		{
+			screen_dirty |= 1ULL << y;
+		}
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_00FD(const chip8_instr & ins)
+{
+	// 0x00FD - Exits the interpreter
+	// there's nothing to exit to, so it stays on this instruction like a 1NNN to itself
+	prog_count -= 2;
+}
+
+template <uint8_t Q>
+void Chip8::op_00FE(const chip8_instr & ins)
+{
+	// 0x00FE - Switches to lores (64x32), clears the screen
+	set_hires(false);
+}
+
+template <uint8_t Q>
+void Chip8::op_00FF(const chip8_instr & ins)
+{
+	// 0x00FF - Switches to hires (128x64), clears the screen
+	set_hires(true);
+}
+
+template <uint8_t Q>
+void Chip8::op_DXY0(const chip8_instr & ins)
+{
+	// 0xDXY0 - Draws a 16x16 sprite at (VX, VY), two bytes a row starting at index_counter
+	// VF works the same as DXYN
+	draw_sprite<16>(ins, 16);
+}
+
+template <uint8_t Q>
+void Chip8::op_FX30(const chip8_instr & ins)
+{
+	// 0xFX30 - Sets index_counter to the 8x10 big font sprite for the digit in VX
+	int temp1 = v_reg[ins.X];
+	if (temp1 <= 15)
+	{
+		index_reg = CHIP8_BIGFONT_MEM_START + (10 * temp1);
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_FX75(const chip8_instr & ins)
+{
+	// 0xFX75 - Stores V0 to VX (including VX) in the user flags, X is at most 7
+	int count = ins.X < CHIP8_RPL_FLAGS ? ins.X : CHIP8_RPL_FLAGS - 1;
+	for (int i = 0; i <= count; i++)
+	{
+		rpl_flags[i] = v_reg[i];
+	}
+}
+
+template <uint8_t Q>
+void Chip8::op_FX85(const chip8_instr & ins)
+{
+	// 0xFX85 - Fills V0 to VX (including VX) from the user flags, X is at most 7
+	int count = ins.X < CHIP8_RPL_FLAGS ? ins.X : CHIP8_RPL_FLAGS - 1;
+	for (int i = 0; i <= count; i++)
+	{
+		v_reg[i] = rpl_flags[i];
+	}
 }
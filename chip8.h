@@ -1,12 +1,31 @@
+#pragma once
 #include <stdint.h>
+#include "chip8trace.h"
+#include "chip8profile.h"
+#include "chip8tracefile.h"
+#include "chip8romimage.h"
+#include <memory>
 
+// chip8 (lores) resolution
 #define CHIP8_GRAPHICS_WIDTH 64
 #define CHIP8_GRAPHICS_HEIGHT 32
-#define CHIP8_GRAPHICSMEM_TOTAL (CHIP8_GRAPHICS_WIDTH * CHIP8_GRAPHICS_HEIGHT)
+// super-chip hires resolution, 00FF switches to it and 00FE back
+#define CHIP8_HIRES_WIDTH 128
+#define CHIP8_HIRES_HEIGHT 64
+#define CHIP8_GRAPHICSMEM_TOTAL (CHIP8_HIRES_WIDTH * CHIP8_HIRES_HEIGHT)
+
+// uint64_ts per packed screen row, enough for a hires row. lores only uses the first
+#define CHIP8_SCREEN_ROW_WORDS (CHIP8_HIRES_WIDTH / 64)
+// pixel x's bit in its word of a packed screen row, the word is x / 64
+#define CHIP8_SCREEN_ROW_BIT(x) (0x8000000000000000ULL >> ((x) & 63))
+// every row in a dirty row mask
+#define CHIP8_SCREEN_ALL_ROWS 0xFFFFFFFFFFFFFFFFULL
 
 #define CHIP8_TOTAL_MEMSIZE 4096
 
 #define CHIP8_FONTSET_MEM_START 0x050 
+// clear of everything FX29 can point I at (it steps 16 bytes a digit)
+#define CHIP8_BIGFONT_MEM_START 0x150
 #define CHIP8_WORK_MEM_START 0x200
 
 #define CHIP8_TOTAL_V_REGS 16
@@ -16,6 +35,23 @@
 #define CHIP8_STACK_SIZE 16
 
 #define CHIP8_FONTSET_SIZE 80
+// super-chip's 8x10 digits for FX30
+#define CHIP8_BIGFONT_SIZE 160
+
+// FX75/FX85 user flags (the hp48's rpl flags)
+#define CHIP8_RPL_FLAGS 8
+
+// cpu clock in instructions per second of emulated time. the delay and sound timers
+// always count down at CHIP8_TIMER_HZ of emulated time whatever the cpu is clocked at,
+// and a frame (RunFrame) is one timer period
+#define CHIP8_DEFAULT_CPU_HZ 400
+#define CHIP8_MAX_CPU_HZ 100000000
+#define CHIP8_TIMER_HZ 60
+#define CHIP8_MIN_CPU_HZ CHIP8_TIMER_HZ
+
+// CXNN draws from a PCG32 generator per Chip8, reseeded from its seed on every reset,
+// so a run only depends on the rom, the settings, the seed and the input
+#define CHIP8_DEFAULT_RANDOM_SEED 0x853C49E6748FEA9BULL
 
 #define check_bit(pos, var) ((var)&(1 << pos))
 
@@ -26,10 +62,142 @@
 #define get_nibbles123(var) ((var) & ((1 << 12)-1))
 #define get_nibbles23(var) ((var) & ((1 << 8)-1))
 
+#define CHIP8_DECODE_CACHE_SIZE (CHIP8_TOTAL_MEMSIZE - CHIP8_WORK_MEM_START)
+
+// interpreter cores
+#define CHIP8_CORE_SWITCH 0		// fetch + a nested switch on the opcode every instruction, the original interpreter
+#define CHIP8_CORE_PREDECODED 1	// decode once per address, run from the decode cache
+#define CHIP8_CORE_THREADED 2	// decode cache + direct threaded dispatch (computed goto where available)
+#define CHIP8_CORE_JIT 3		// x86-64 basic block jit, predecoded interpreter for everything else
+#define CHIP8_CORE_COUNT 4
+#define CHIP8_CORE_DEFAULT CHIP8_CORE_PREDECODED
+
+// quirk policies, the three ambiguous opcode modes packed into a template argument. every
+// handler (and the threaded loop) is compiled once per policy with the mode checks folded
+// away, changing a mode swaps which copy runs
+#define CHIP8_QUIRK_8XY6 0x1 // set when ambig_8XY6_8XYE_VY_mode is
+#define CHIP8_QUIRK_BNNN 0x2 // ambig_BNNN_mode
+#define CHIP8_QUIRK_FX55 0x4 // ambig_FX55_FX65_mode
+#define CHIP8_QUIRK_POLICIES 8
+
 typedef void(*chip8_log_func)(const char*, ...);
 
+// every instruction the core knows how to execute, one handler each.
+// the enum, the handler table and anything else that dispatches on the
+// decoded op are all generated from this list so they stay in sync.
+// the super-chip ones go at the end, the jit relies on the 8XY_ ops being a range
+#define CHIP8_OPCODE_LIST(OP) \
+	OP(UNKNOWN) \
+	OP(0NNN) \
+	OP(00E0) \
+	OP(00EE) \
+	OP(1NNN) \
+	OP(2NNN) \
+	OP(3XNN) \
+	OP(4XNN) \
+	OP(5XY0) \
+	OP(6XNN) \
+	OP(7XNN) \
+	OP(8XY0) \
+	OP(8XY1) \
+	OP(8XY2) \
+	OP(8XY3) \
+	OP(8XY4) \
+	OP(8XY5) \
+	OP(8XY6) \
+	OP(8XY7) \
+	OP(8XYE) \
+	OP(9XY0) \
+	OP(ANNN) \
+	OP(BNNN) \
+	OP(CXNN) \
+	OP(DXYN) \
+	OP(EX9E) \
+	OP(EXA1) \
+	OP(FX07) \
+	OP(FX0A) \
+	OP(FX15) \
+	OP(FX18) \
+	OP(FX1E) \
+	OP(FX29) \
+	OP(FX33) \
+	OP(FX55) \
+	OP(FX65) \
+	OP(00CN) \
+	OP(00FB) \
+	OP(00FC) \
+	OP(00FD) \
+	OP(00FE) \
+	OP(00FF) \
+	OP(DXY0) \
+	OP(FX30) \
+	OP(FX75) \
+	OP(FX85)
+
+enum chip8_op : uint8_t
+{
+	CHIP8_OP_UNDECODED = 0, // cache entry is empty (or was written over)
+#define CHIP8_OP_ENUM(name) CHIP8_OP_##name,
+	CHIP8_OPCODE_LIST(CHIP8_OP_ENUM)
+#undef CHIP8_OP_ENUM
+	CHIP8_OP_COUNT
+};
+
+// an opcode with all of its operands already split out
+struct chip8_instr
+{
+	uint16_t opcode;
+	uint16_t NNN;
+	uint8_t op; // chip8_op
+	uint8_t X;
+	uint8_t Y;
+	uint8_t NN;
+	uint8_t N;
+};
+
+// snapshot layout for SaveState()/LoadState(), fixed size and native endian
+#define CHIP8_SAVESTATE_MAGIC 0x38504843 // "CHP8"
+#define CHIP8_SAVESTATE_VERSION 4
+
+struct chip8_savestate
+{
+	uint32_t magic;
+	uint32_t version;
+	int64_t system_ticks;
+	int64_t time_phase;
+	uint64_t random_seed;
+	uint64_t random_state;
+	uint32_t cpu_hz;
+	uint32_t timer_phase;
+	uint32_t frame_phase;
+	uint32_t reserved;
+	uint64_t screen_rows[CHIP8_HIRES_HEIGHT][CHIP8_SCREEN_ROW_WORDS];
+	uint16_t stack[CHIP8_STACK_SIZE];
+	uint16_t stack_pointer;
+	uint16_t index_reg;
+	uint16_t prog_count;
+	uint16_t opcode;
+	uint16_t last_opcode;
+	uint8_t memory[CHIP8_TOTAL_MEMSIZE];
+	uint8_t v_reg[CHIP8_TOTAL_V_REGS];
+	uint8_t keys[CHIP8_INPUT_KEYS];
+	uint8_t rpl_flags[CHIP8_RPL_FLAGS];
+	uint8_t delay_timer;
+	uint8_t sound_timer;
+	uint8_t flags; // quirk modes, the key latch and hires
+	uint8_t last_keypressed;
+};
+
+#define CHIP8_SAVESTATE_SIZE ((long)sizeof(chip8_savestate))
+
+class Chip8Jit;
+class Chip8Lockstep;
+
 class Chip8
 {
+	friend class Chip8Jit;
+	friend class Chip8Lockstep;
+
 private:
 
 	// fontset
@@ -53,13 +221,36 @@ private:
 	  0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 	};
 
+	// super-chip big font, 8x10. the original only had 0-9, A-F are the ones most
+	// interpreters since have added
+	const uint8_t chip8_bigfont[CHIP8_BIGFONT_SIZE] =
+	{
+	  0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+	  0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+	  0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+	  0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+	  0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+	  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+	  0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+	  0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+	  0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+	  0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+	  0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+	  0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+	  0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+	  0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+	};
+
 	// opcodes are 2-bytes, short is 2 bytes
 	unsigned short last_opcode;
 	unsigned short opcode;
 
 	// 4k bytes of memory
 	uint8_t memory[CHIP8_TOTAL_MEMSIZE];
-	uint8_t romcopy[CHIP8_TOTAL_MEMSIZE];
+	// what reset() copies into work ram, shared with every other Chip8 on the same rom
+	std::shared_ptr<const Chip8ROMImage> rom_image;
 
 	// 15 8-bit general purpose CPU registers
 	// V0 - VE = registers
@@ -78,6 +269,7 @@ private:
 		Memory Map:
 		0x000 - 0x1FF : Chip 8 interpreter (contains font set when emulating)
 		0x050 - 0x0A0 : Used for the built-in 4x5 pixel font set (0-F)
+		0x150 - 0x1F0 : super-chip 8x10 font (0-F)
 		0x200 - 0xFFF : Program ROM and work RAM (in one chunk!)
 	*/
 
@@ -100,10 +292,22 @@ private:
 	// Chip 8 has one [1] sprite draw instruction that is done in XOR mode
 	//  if a pixel is turned OFF as a result of drawing, the VF register is set
 
-	// Chip 8 has 2k pixels that are black or white only.
-	// a whole uint8_t is kinda overkill here but, who cares, easier
+	// Chip 8 has 2k pixels that are black or white only, super-chip's hires mode 8k.
+	// one bit each, CHIP8_SCREEN_ROW_WORDS uint64_ts per row with pixel x at bit (63 - x % 64)
+	// of word x / 64, so a sprite row is a shift and an XOR instead of 8 pixel writes and
+	// a scroll is a memmove or a shift per word. lores uses the top left 64x32
+	uint64_t screen_rows[CHIP8_HIRES_HEIGHT][CHIP8_SCREEN_ROW_WORDS];
+	bool hires;
+
+	// bit y is set when row y has changed since the last ClearScreenDirty()
+	uint64_t screen_dirty;
+
+	// one byte per pixel copy of screen_rows, only filled in by GetScreenBuf()
 	uint8_t screen_buf[CHIP8_GRAPHICSMEM_TOTAL];
 
+	// FX75/FX85 storage, kept apart from memory like on the hp48
+	uint8_t rpl_flags[CHIP8_RPL_FLAGS];
+
 	//ambiguous function toggles
 #define AMBIG_8XY6_SHIFTMODE_SET_VX_TO_VY 0
 #define AMBIG_8XY6_SHIFTMODE_DONOTMODIFY_VX 1
@@ -120,25 +324,108 @@ private:
 #define AMBIG_FX55_FX65_DEFAULT 1
 	bool ambig_FX55_FX65_mode;
 
-	// external value used to generate a rand by using remainder of div by 256
+	// instructions run since the last reset, GetInstructionCount(). movies and traces key on it
 	long long system_ticks;
 
-	// optional log function
+	// instructions per second of emulated time
+	uint32_t cpu_hz;
+	// gains CHIP8_TIMER_HZ every instruction, the timers tick each time it passes cpu_hz
+	uint32_t timer_phase;
+	// the fractions of an instruction RunFrame() and RunFor() couldn't run yet,
+	// in 60ths and billionths of an instruction
+	uint32_t frame_phase;
+	long long time_phase;
+
+	// cxnn's generator, random_state restarts from random_seed on reset
+	uint64_t random_seed;
+	uint64_t random_state;
+
+	// optional log function, only used for errors
 	chip8_log_func log;
 
+	// binary trace ring, allocated the first time tracing is turned on
+	uint8_t trace_level;
+	Chip8TraceRing * trace;
+
+	// CHIP8_TRACE_ERROR events since the last reset, counted whatever the trace level
+	uint32_t error_counts[CHIP8_TRACE_EVENT_COUNT];
+
+	// execution profile, allocated the first time profiling is turned on
+	bool profiling;
+	Chip8Profile * profile;
+
+	// every executed instruction streamed to disk, only while a trace file is open
+	Chip8TraceFile * trace_file;
+
 	// true if waiting on user input for opcode 0xFX0A (a blocking operation)
 	// set false at the end of every tick, and true if a user input is detected
 	bool user_keypressed;
 	uint8_t last_keypressed;
 
+	// which interpreter core Tick() runs
+	uint8_t core_mode;
+
+	// predecoded instructions for 0x200 - 0xFFF, one entry per address since
+	// jumps can land on odd addresses. entries decode on first execution and
+	// any write into work ram throws away the entries overlapping it
+	chip8_instr decode_cache[CHIP8_DECODE_CACHE_SIZE];
+	// decode target for instructions outside of work ram
+	chip8_instr decode_scratch;
+
+	// block compiler for CHIP8_CORE_JIT, created the first time that core is selected
+	Chip8Jit * jit;
+
 private:
+	typedef void(Chip8::*chip8_op_handler)(const chip8_instr&);
+	typedef long long(Chip8::*chip8_run_func)(long long);
+	// a handler table and a threaded loop per quirk policy, op_handlers is the table for
+	// quirk_policy, picked by select_quirk_policy() whenever a mode changes
+	template <uint8_t Q> static const chip8_op_handler s_op_handlers[CHIP8_OP_COUNT];
+	static const chip8_op_handler * const s_op_tables[CHIP8_QUIRK_POLICIES];
+	static const chip8_run_func s_threaded_runs[CHIP8_QUIRK_POLICIES];
+	// the switch and predecoded cores' loops
+	static const chip8_run_func s_switch_runs[CHIP8_QUIRK_POLICIES];
+	static const chip8_run_func s_predecoded_runs[CHIP8_QUIRK_POLICIES];
+	// the threaded loop that hands back to run_jit() at the first pc that can have a block
+	static const chip8_run_func s_jit_fallbacks[CHIP8_QUIRK_POLICIES];
+	const chip8_op_handler * op_handlers;
+	uint8_t quirk_policy;
+
 	void reset();
 	void clear_memory();
 	void clear_screen();
+	void set_hires(bool enabled);
+	template <uint8_t W> void draw_sprite(const chip8_instr & ins, int height);
 	void clear_keys();
 
 	void fetch_opcode();
-	void execute_opcode();
+	template <uint8_t Q> void execute_opcode();
+
+	void step();
+	void end_tick();
+	void tick_timers(long long instructions);
+	void seed_random();
+	uint8_t next_random();
+	template <uint8_t Q> long long run_switch(long long count);
+	template <uint8_t Q> long long run_predecoded(long long count);
+	template <uint8_t Q, bool UntilBlock = false> long long run_threaded(long long count);
+	long long run_jit(long long count);
+	long long run_instrumented(long long count);
+	void write_trace_record(unsigned short pc, const uint8_t * before);
+
+	static void decode_opcode(unsigned short op, chip8_instr & ins);
+	const chip8_instr & fetch_decoded();
+	void execute_instr(const chip8_instr & ins);
+	void trace_event(uint8_t level, uint8_t event);
+	void error_event(uint8_t event);
+	void invalidate_decode(int address, int length);
+	void invalidate_decode_all();
+	void select_quirk_policy();
+
+	// opcode handlers
+#define CHIP8_OP_DECLARE(name) template <uint8_t Q> void op_##name(const chip8_instr & ins);
+	CHIP8_OPCODE_LIST(CHIP8_OP_DECLARE)
+#undef CHIP8_OP_DECLARE
 
 public:
 
@@ -148,18 +435,101 @@ public:
 	Chip8();
 	~Chip8();
 
+	// owns the jit's code buffer
+	Chip8(const Chip8 &) = delete;
+	Chip8 & operator=(const Chip8 &) = delete;
+
 	void Init();
-	void Tick(long long sys_ticks);
+	// one instruction, same as Run(1)
+	void Tick();
+	// runs count instructions back to back, system ticks advance once per instruction
+	long long Run(long long count);
+	// one 60th of a second of emulated time, cpu_hz / 60 instructions with the remainder
+	// carried over so every 60 frames run exactly cpu_hz instructions
+	long long RunFrame();
+	// moves on to the next 60th of a second and returns how many instructions it holds
+	// without running them. RunFrame() is Run(StartFrame()), this is for drivers that
+	// need to break a frame up (movie playback feeding keys mid frame)
+	long long StartFrame();
+	// as many instructions as fit in nanoseconds of emulated time at the cpu frequency
+	long long RunFor(long long nanoseconds);
+
+	// takes effect now and on every reset after, the generator state goes in snapshots
+	void SetRandomSeed(uint64_t seed);
+	uint64_t GetRandomSeed();
+
+	// CHIP8_MIN_CPU_HZ .. CHIP8_MAX_CPU_HZ
+	uint32_t GetCPUFrequency();
+	void SetCPUFrequency(uint32_t hz);
+	// the current resolution, 64x32 or 128x64 in super-chip hires mode
+	bool GetHiRes();
+	int GetScreenWidth();
+	int GetScreenHeight();
+	// unpacks the screen into one byte per pixel (0 or 1), GetScreenWidth() pixels a row
+	// for GetScreenHeight() rows, valid until the next call
 	uint8_t * GetScreenBuf();
+	// the packed screen, CHIP8_SCREEN_ROW_WORDS words per row (whatever the resolution)
+	// with pixel x at bit (63 - x % 64) of word x / 64
+	const uint64_t * GetScreenRows();
+	// rows changed by 00E0/DXYN/scrolls (or a reset/state load) since the last
+	// ClearScreenDirty(), bit y for row y. lets a renderer skip frames where nothing was drawn
+	uint64_t GetScreenDirtyRows();
+	void ClearScreenDirty();
+	// FNV-1a over the framebuffer at the current resolution, for comparing runs without
+	// keeping screens around. a lores screen hashes the same as it did before hires existed
+	uint64_t GetScreenHash();
+	// instructions run since the last reset (carried in snapshots), what movies key input on
+	long long GetInstructionCount();
 
 	void Reset();
 
-	// todo: load rom file
+	// snapshot everything a run depends on into buf (at least CHIP8_SAVESTATE_SIZE bytes),
+	// returns the bytes written or 0 if buf is too small. neither direction allocates.
+	// the loaded rom isn't part of it, Reset() still goes back to the last LoadROM()
+	long SaveState(uint8_t * buf, long size);
+	bool LoadState(const uint8_t * buf, long size);
+
+	// LoadROM() takes a copy of rom, LoadROMImage() shares image with whatever else has
+	// it loaded. neither resets, LoadROMFromFile() maps the file and does
 	bool LoadROM(uint8_t * rom, long size);
+	bool LoadROMImage(std::shared_ptr<const Chip8ROMImage> image);
 	bool LoadROMFromFile(const char * filename);
+	std::shared_ptr<const Chip8ROMImage> GetROMImage();
 
 	void SetLogFunc(chip8_log_func func);
 
+	// CHIP8_TRACE_NONE .. CHIP8_TRACE_INSTR, anything above CHIP8_TRACE_MAX_LEVEL is compiled out
+	uint8_t GetTraceLevel();
+	void SetTraceLevel(uint8_t level);
+	// null until tracing has been enabled once
+	Chip8TraceRing * GetTrace();
+	// how many times an error event (unknown opcode, stack overflow...) happened since the
+	// last reset, for telling how badly a rom is running without tracing it
+	uint32_t GetErrorCount(uint8_t event);
+
+	// while profiling, Run() goes through a counting interpreter loop whichever core is
+	// selected, the profile is cleared by LoadROM()
+	bool GetProfiling();
+	void SetProfiling(bool enabled);
+	// null until profiling has been enabled once
+	Chip8Profile * GetProfile();
+	// streams a record of every executed instruction into path (see chip8tracefile.h)
+	// until EndTraceFile(), through the same interpreter loop as profiling
+	bool BeginTraceFile(const char * path);
+	void EndTraceFile();
+	// null unless a trace file is being written
+	Chip8TraceFile * GetTraceFile();
+
+	// "8XY4" etc for a chip8_op
+	static const char * GetOpName(uint8_t op);
+
+	uint8_t GetCoreMode();
+	void SetCoreMode(uint8_t mode);
+	static const char * GetCoreName(uint8_t mode);
+
+	// call after modifying memory through GetMemory() so stale decodes are dropped
+	void InvalidateDecodeCache();
+
 	void SetKey(uint8_t key, bool pressed);
 
 	long GetMemorySize();
@@ -171,6 +541,8 @@ public:
 
 	short GetIndexRef();
 	short GetProgCount();
+	unsigned short GetStackPointer();
+	unsigned short * GetStack();
 
 	bool GetConfig_8XY6_8XYE_VY_mode();
 	void SetConfig_8XY6_8XYE_VY_mode(bool mode);
@@ -180,4 +552,8 @@ public:
 
 	bool GetConfig_FX55_FX65_VY_mode();
 	void SetConfig_FX55_FX65_VY_mode(bool mode);
+
+	// all three modes at once as CHIP8_QUIRK_* bits
+	uint8_t GetQuirkPolicy();
+	void SetQuirkPolicy(uint8_t policy);
 };
\ No newline at end of file
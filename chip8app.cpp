@@ -12,6 +12,52 @@
 
 #include <iostream>
 #include <string.h>
+#include <math.h>
+#include <mutex>
+#include <algorithm>
+
+#define CHIP8APP_DEFAULT_PERSISTENCE 0.5f
+#define CHIP8APP_MAX_PERSISTENCE 0.95f
+#define CHIP8APP_PROFILE_HOTTEST 24
+
+struct chip8_palette
+{
+	const char * name;
+	float background[3];
+	float foreground[3];
+};
+
+static const chip8_palette s_palettes[] =
+{
+	{ "Mono",	{ 0.0f, 0.0f, 0.0f },		{ 1.0f, 1.0f, 1.0f } },
+	{ "Amber",	{ 0.06f, 0.03f, 0.0f },		{ 1.0f, 0.69f, 0.0f } },
+	{ "Green",	{ 0.0f, 0.05f, 0.02f },		{ 0.2f, 1.0f, 0.4f } },
+	{ "LCD",	{ 0.61f, 0.74f, 0.06f },	{ 0.06f, 0.22f, 0.06f } },
+};
+#define CHIP8APP_PALETTE_COUNT ((int)(sizeof(s_palettes) / sizeof(s_palettes[0])))
+
+static const char * s_scale_mode_names[APPBASE_SCALE_COUNT] = { "Stretch", "Integer", "Sharp" };
+
+// one fragment per hires pixel: lit pixels go to full, the rest keep decay of what they had.
+// in lores LScale is 1 and each chip8 pixel covers 2x2 of them
+static const GLchar * s_phosphor_fragment_source =
+	"#version 150\nuniform usampler2D LScreenBits; uniform sampler2D LPrevious; uniform float LDecay; uniform int LScale; out vec4 LFragment;"
+	"void main() {"
+	"  ivec2 p = ivec2(gl_FragCoord.xy);"
+	"  ivec2 s = p >> LScale;"
+	"  uint bits = texelFetch(LScreenBits, ivec2(s.x >> 3, s.y), 0).r;"
+	"  float lit = float((bits >> uint(7 - (s.x & 7))) & 1u);"
+	"  LFragment = vec4(max(lit, texelFetch(LPrevious, p, 0).r * LDecay));"
+	"}";
+
+// phosphor brightness to colour, chip8 row 0 at the top of the render texture
+static const GLchar * s_palette_fragment_source =
+	"#version 150\nuniform sampler2D LPhosphor; uniform vec3 LBackground; uniform vec3 LForeground; out vec4 LFragment;"
+	"void main() {"
+	"  ivec2 p = ivec2(gl_FragCoord.xy);"
+	"  float i = texelFetch(LPhosphor, ivec2(p.x, textureSize(LPhosphor, 0).y - 1 - p.y), 0).r;"
+	"  LFragment = vec4(mix(LBackground, LForeground, i), 1.0);"
+	"}";
 
 
 struct DebugLog
@@ -145,6 +191,34 @@ struct DebugLog
 
 
 static DebugLog gDebugLog;
+// the chip8 logs from the emulation thread
+static std::mutex gDebugLogLock;
+
+// blocks on the windows open / save dialog, path is MAX_PATH chars
+static bool file_dialog(bool save, const char * filter, const char * title, const char * default_extension, char * path)
+{
+	OPENFILENAME ofn;
+	char szFileTitle[MAX_PATH]{ 0 };
+	path[0] = 0;
+
+	ofn.lStructSize = sizeof(OPENFILENAME);
+	ofn.hwndOwner = GetFocus();
+	ofn.lpstrFilter = filter;
+	ofn.lpstrCustomFilter = NULL;
+	ofn.nMaxCustFilter = 0;
+	ofn.nFilterIndex = 0;
+	ofn.lpstrFile = path;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.lpstrInitialDir = "."; // Initial directory.
+	ofn.lpstrFileTitle = szFileTitle;
+	ofn.nMaxFileTitle = MAX_PATH;
+	ofn.lpstrTitle = title;
+	ofn.lpstrDefExt = default_extension;
+
+	ofn.Flags = save ? OFN_OVERWRITEPROMPT : OFN_FILEMUSTEXIST;
+
+	return save ? GetSaveFileName((LPOPENFILENAME)&ofn) : GetOpenFileName((LPOPENFILENAME)&ofn);
+}
 
 const char * Chip8App::GetAppName()
 {
@@ -153,6 +227,7 @@ const char * Chip8App::GetAppName()
 
 void add_log(const char* fmt, ...)
 {
+	std::lock_guard<std::mutex> guard(gDebugLogLock);
 	va_list args;
 	va_start(args, fmt);
 	gDebugLog.VAddLog(fmt, args);
@@ -161,9 +236,9 @@ void add_log(const char* fmt, ...)
 
 bool Chip8App::Initialize()
 {
-	// set the internal render size to the Chip8 resolution
-	m_internal_render_width = 64;
-	m_internal_render_height = 32;
+	// set the internal render size to the Chip8 hires resolution, lores is drawn at 2x
+	m_internal_render_width = CHIP8_HIRES_WIDTH;
+	m_internal_render_height = CHIP8_HIRES_HEIGHT;
 
 	bool success = AppBase::Initialize();
 	if (!success)
@@ -171,17 +246,73 @@ bool Chip8App::Initialize()
 		return false;
 	}
 
-	// start paused
-	mUpdatePaused = true;
-	// start in edit mode
+	// start in edit mode, the runner starts paused
 	mEditorMode = true;
 
-	tickOnce = false;
+	rewinding = false;
+	rewind_frame = 0;
+
+	// a missing database is an empty one
+	if (!romdb.Load(CHIP8_ROMDB_DEFAULT_FILE))
+	{
+		add_log("could not read rom database %s\n", CHIP8_ROMDB_DEFAULT_FILE);
+	}
+	rom_profile_source = "no rom";
+
+	mScaleMode = APPBASE_SCALE_SHARP;
+	mPalette = 0;
+	mPersistence = CHIP8APP_DEFAULT_PERSISTENCE;
+	mDisplayChanged = true;
+	mFadeTime = 0.0f;
+	mLastRenderTime = std::chrono::steady_clock::now();
+
+	mPhosphorProgram = build_shader_program(s_phosphor_fragment_source);
+	mPaletteProgram = build_shader_program(s_palette_fragment_source);
+	if (mPhosphorProgram == 0 || mPaletteProgram == 0)
+	{
+		return false;
+	}
+	mPhosphorBitsLocation = glGetUniformLocation(mPhosphorProgram, "LScreenBits");
+	mPhosphorPreviousLocation = glGetUniformLocation(mPhosphorProgram, "LPrevious");
+	mPhosphorDecayLocation = glGetUniformLocation(mPhosphorProgram, "LDecay");
+	mPhosphorScaleLocation = glGetUniformLocation(mPhosphorProgram, "LScale");
+	mPalettePhosphorLocation = glGetUniformLocation(mPaletteProgram, "LPhosphor");
+	mPaletteBackgroundLocation = glGetUniformLocation(mPaletteProgram, "LBackground");
+	mPaletteForegroundLocation = glGetUniformLocation(mPaletteProgram, "LForeground");
+
+	// one byte per 8 pixels, leftmost pixel in the top bit. integer textures only fetch
+	glGenTextures(1, &mScreenBitsTex);
+	glBindTexture(GL_TEXTURE_2D, mScreenBitsTex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, CHIP8_SCREEN_ROW_WORDS * 8, CHIP8_HIRES_HEIGHT, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	// the feedback pair, each frame reads one and writes the other
+	glGenTextures(2, mPhosphorTex);
+	glGenFramebuffers(2, mPhosphorFramebuffer);
+	for (int i = 0; i < 2; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, mPhosphorTex[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, CHIP8_HIRES_WIDTH, CHIP8_HIRES_HEIGHT, 0, GL_RED, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, mPhosphorFramebuffer[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mPhosphorTex[i], 0);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	mPhosphorCurrent = 0;
 
 	// load test rom
 	//chip8.LoadROMFromFile("roms/games/Paddles.ch8");
 	chip8_log_func logfunc = &add_log;
 	chip8.SetLogFunc(logfunc);
+	// errors only, instruction tracing is turned on from the TRACE window (the jit core
+	// runs as the interpreter while it's on)
+	chip8.SetTraceLevel(CHIP8_TRACE_ERROR);
 	//chip8.LoadROMFromFile("C:/Projects/GLFW/Chip8/Chip8/x64/Debug/roms/demos/Maze [David Winter, 199x].ch8");
 	//Clock Program [Bill Fisher, 1981]chip8.LoadROMFromFile("C:/Projects/GLFW/Chip8/Chip8/x64/Debug/roms//programs/Fishie [Hap, 2005].ch8");
 	//chip8.LoadROMFromFile("C:/Projects/GLFW/Chip8/Chip8/x64/Debug/roms/c8_test.c8");
@@ -192,32 +323,58 @@ bool Chip8App::Initialize()
 	// todo: - file loader for roms ^
 	//		 - input latching
 	//		 - 
+
+	runner.Start();
+
+	return true;
 }
 
 void Chip8App::Shutdown()
 {
+	runner.Stop();
+	glDeleteProgram(mPhosphorProgram);
+	glDeleteProgram(mPaletteProgram);
+	glDeleteFramebuffers(2, mPhosphorFramebuffer);
+	glDeleteTextures(2, mPhosphorTex);
+	glDeleteTextures(1, &mScreenBitsTex);
 	AppBase::Shutdown();
 }
 
-void Chip8App::update()
+void Chip8App::start_frame()
 {
-	// appbase has been configured to tick at 60fps
-	// the chip8 wants to tick around 400hz to 800hz configurable
+	AppBase::start_frame();
+
+	// whatever the emulation thread finished last, once per presented frame
+	runner.AcquireFrame(&view);
+}
 
-	if (tickOnce)
+void Chip8App::resume(bool step)
+{
+	// running again after a seek, the frames after it are gone. so is any input a recording
+	// had after that point, a movie playing picks up from there
+	if (rewinding)
 	{
-		chip8.Tick(tick_count);
+		auto guard = runner.Lock();
+		rewind.Truncate(rewind_frame);
+		rewinding = false;
 
-		tickOnce = false;
-		mUpdatePaused = true;
+		if (movie.GetMode() == CHIP8_MOVIE_RECORDING)
+		{
+			movie.Truncate(chip8.GetInstructionCount());
+		}
+		else if (movie.GetMode() == CHIP8_MOVIE_PLAYING)
+		{
+			movie.Seek(chip8.GetInstructionCount());
+		}
+	}
+
+	if (step)
+	{
+		runner.Step();
 	}
 	else
 	{
-		int ticks = (400 / 60);
-		for (int i = 0; i < ticks; i++)
-		{
-			chip8.Tick(tick_count++);
-		}
+		runner.SetPaused(false);
 	}
 }
 
@@ -226,32 +383,82 @@ void Chip8App::editor_update()
 	AppBase::editor_update();
 }
 
+bool Chip8App::needs_render()
+{
+	// only clears, draws and scrolls (or a reset, rom load or rewind) touch the screen, after that
+	// it's only the phosphor fading out
+	return view.GetScreenDirtyRows() != 0 || mFadeTime > 0.0f || mDisplayChanged;
+}
+
 void Chip8App::render()
 {
 	// backbuffer rendered and ortho matrix setup for (mRENDER_WIDTH, mRENDER_HEIGHT)
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glDisable(GL_TEXTURE_2D);
-	glPointSize(1);
-	glBegin(GL_POINTS);
-	uint8_t * graphics = chip8.GetScreenBuf();
-	uint8_t x = 0;
-	uint8_t y = 0;
-
-	glClearColor(0.0f, 1.0f, 1.0f, 1.0f);
-
-	for(int y = 0; y < 32; y++)
+	auto now = std::chrono::steady_clock::now();
+	float elapsed = std::chrono::duration<float>(now - mLastRenderTime).count();
+	mLastRenderTime = now;
+
+	// the whole packed screen is 1k, sent big end first so byte 0 is pixels 0-7. lores only
+	// fills the top left, the phosphor pass scales it up
+	uint64_t dirty = view.GetScreenDirtyRows();
+	if (dirty)
 	{
-		for (int x = 0; x < 64; x++)
+		const uint64_t * rows = view.GetScreenRows();
+		for (int i = 0; i < CHIP8_HIRES_HEIGHT * CHIP8_SCREEN_ROW_WORDS; i++)
 		{
-			if (graphics[x + y * 64])
+			for (int b = 0; b < 8; b++)
 			{
-				glVertex2f(x, y + 1);
+				mScreenBytes[i * 8 + b] = (uint8_t)(rows[i] >> (56 - b * 8));
 			}
 		}
-	}
+		view.ClearScreenDirty();
+
+		glBindTexture(GL_TEXTURE_2D, mScreenBitsTex);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CHIP8_SCREEN_ROW_WORDS * 8, CHIP8_HIRES_HEIGHT, GL_RED_INTEGER, GL_UNSIGNED_BYTE, mScreenBytes);
+		glBindTexture(GL_TEXTURE_2D, 0);
 
-	glEnd();
+		// until whatever just went dark is under half a step of an 8 bit channel
+		mFadeTime = mPersistence > 0.0f ? logf(1.0f / 512.0f) / logf(mPersistence) / 60.0f : 0.0f;
+	}
+	else
+	{
+		mFadeTime -= elapsed;
+	}
+	mDisplayChanged = false;
+
+	// the decay is per 60th of a second, whatever rate frames get presented at
+	float decay = mPersistence > 0.0f ? powf(mPersistence, elapsed * 60.0f) : 0.0f;
+
+	int next = mPhosphorCurrent ^ 1;
+	glBindFramebuffer(GL_FRAMEBUFFER, mPhosphorFramebuffer[next]);
+	glViewport(0, 0, CHIP8_HIRES_WIDTH, CHIP8_HIRES_HEIGHT);
+	glUseProgram(mPhosphorProgram);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, mScreenBitsTex);
+	glUniform1i(mPhosphorBitsLocation, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, mPhosphorTex[mPhosphorCurrent]);
+	glUniform1i(mPhosphorPreviousLocation, 1);
+	glUniform1f(mPhosphorDecayLocation, decay);
+	glUniform1i(mPhosphorScaleLocation, view.GetHiRes() ? 0 : 1);
+	glBindVertexArray(mVAO);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	mPhosphorCurrent = next;
+
+	// back to the render texture render_begin() set up
+	const chip8_palette & palette = s_palettes[mPalette];
+	glBindFramebuffer(GL_FRAMEBUFFER, mGLRenderTexFramebuffer);
+	glViewport(0, 0, m_internal_render_width, m_internal_render_height);
+	glUseProgram(mPaletteProgram);
+	glBindTexture(GL_TEXTURE_2D, mPhosphorTex[mPhosphorCurrent]);
+	glUniform1i(mPalettePhosphorLocation, 0);
+	glUniform3fv(mPaletteBackgroundLocation, 1, palette.background);
+	glUniform3fv(mPaletteForegroundLocation, 1, palette.foreground);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
 }
 
 void Chip8App::render_gamemode()
@@ -299,100 +506,371 @@ void Chip8App::render_editmode()
 
 	if (ImGui::Button("Open ROM..."))
 	{
-		OPENFILENAME ofn;
-		const char* filter = "Chip8 ROMs(.ch8)\0*.ch8\0Chip8 ROMs(.c8)\0.c8\0All Files(.)\0*.*\0";
-		const char* title = "Open ROM...";
-		const char* default_extension = ".ch8";
 		char szFileName[MAX_PATH]{ 0 };
-		char szFileTitle[MAX_PATH]{ 0 };
-
-		ofn.lStructSize = sizeof(OPENFILENAME);
-		ofn.hwndOwner = GetFocus();
-		ofn.lpstrFilter = filter;
-		ofn.lpstrCustomFilter = NULL;
-		ofn.nMaxCustFilter = 0;
-		ofn.nFilterIndex = 0;
-		ofn.lpstrFile = szFileName;
-		ofn.nMaxFile = MAX_PATH;
-		ofn.lpstrInitialDir = "."; // Initial directory.
-		ofn.lpstrFileTitle = szFileTitle;
-		ofn.nMaxFileTitle = MAX_PATH;
-		ofn.lpstrTitle = title;
-		ofn.lpstrDefExt = default_extension;
-
-		ofn.Flags = OFN_FILEMUSTEXIST;
-
-		if (!GetOpenFileName((LPOPENFILENAME)&ofn))
-		{
-			// error
-		}
-		else
+		if (file_dialog(false, "Chip8 ROMs(.ch8)\0*.ch8\0Chip8 ROMs(.c8)\0.c8\0All Files(.)\0*.*\0", "Open ROM...", ".ch8", szFileName))
 		{
+			// the dialog blocked this thread, the emulation thread kept going
+			auto guard = runner.Lock();
 			chip8.LoadROMFromFile(szFileName);
+			if (romdb.Apply(&chip8))
+			{
+				rom_profile_source = "from rom database";
+			}
+			else if (quirks.Run(&chip8))
+			{
+				quirks.Apply(&chip8);
+				rom_profile_source = "detected";
+			}
+			rewind.Clear();
+			rewinding = false;
+			movie.EndRecording(&chip8);
+			movie.EndPlayback();
 		}
 	}
 
 	if (ImGui::Button("Reset Chip8"))
 	{
+		runner.SetPaused(true);
+		auto guard = runner.Lock();
 		chip8.Reset();
-		mUpdatePaused = true;
+		rewind.Clear();
+		rewinding = false;
+		movie.EndRecording(&chip8);
+		movie.EndPlayback();
 	}
+	bool paused = runner.IsPaused();
 	if (ImGui::Button("Gameplay Mode"))
 	{
 		mEditorMode = false;
-		if (mUpdatePaused)
+		if (paused)
 		{
-			mUpdatePaused = false;
+			resume(false);
 		}
 	}
 	ImGui::SameLine();
-	if (ImGui::Button(mUpdatePaused ? "RUN" : "PAUSE"))
+	if (ImGui::Button(paused ? "RUN" : "PAUSE"))
 	{
-		mUpdatePaused = !mUpdatePaused;
+		if (paused)
+		{
+			resume(false);
+		}
+		else
+		{
+			runner.SetPaused(true);
+		}
 	}
 	ImGui::SameLine();
 	if (ImGui::Button("> STEP >"))
 	{
-		mUpdatePaused = false;
-		tickOnce = true;
+		resume(true);
+	}
+
+	// only this thread changes the settings, so reading them without the lock is fine
+	ImGui::Text("--- CORE ---");
+	uint8_t core_mode = chip8.GetCoreMode();
+	ImGui::Text("Interpreter: %s", Chip8::GetCoreName(core_mode));
+	ImGui::SameLine();
+	if (ImGui::Button("Switch Core"))
+	{
+		auto guard = runner.Lock();
+		chip8.SetCoreMode((core_mode + 1) % CHIP8_CORE_COUNT);
+	}
+
+	int cpu_hz = (int)view.GetCPUFrequency();
+	if (ImGui::InputInt("CPU Hz", &cpu_hz, 100, 1000))
+	{
+		auto guard = runner.Lock();
+		chip8.SetCPUFrequency(cpu_hz < CHIP8_MIN_CPU_HZ ? CHIP8_MIN_CPU_HZ : (uint32_t)cpu_hz);
+	}
+	bool unthrottled = runner.IsUnthrottled();
+	if (ImGui::Checkbox("Unthrottled", &unthrottled))
+	{
+		runner.SetUnthrottled(unthrottled);
+	}
+	ImGui::Text("%.0f instructions/sec", paused ? 0.0 : runner.GetMeasuredIPS());
+
+	ImGui::Text("--- MOVIE ---");
+	const char * movie_filter = "Chip8 Movies(.c8m)\0*.c8m\0All Files(.)\0*.*\0";
+	bool save_movie = false;
+	bool load_movie = false;
+	// the emulation thread records into it and ends playback when it runs out, so what's shown
+	// comes with the frame. the buttons check the movie again under the lock, the frame can be
+	// one behind a click
+	const chip8_runner_info & info = runner.GetInfo();
+	if (info.movie_mode == CHIP8_MOVIE_IDLE)
+	{
+		if (ImGui::Button("Record"))
+		{
+			// starts from a reset
+			auto guard = runner.Lock();
+			if (movie.GetMode() == CHIP8_MOVIE_IDLE)
+			{
+				movie.BeginRecording(&chip8);
+				rewind.Clear();
+				rewinding = false;
+				runner.SetPaused(false);
+			}
+		}
+		if (info.movie_length > 0)
+		{
+			ImGui::SameLine();
+			if (ImGui::Button("Play"))
+			{
+				auto guard = runner.Lock();
+				if (movie.GetMode() != CHIP8_MOVIE_IDLE)
+				{
+					// already going
+				}
+				else if (movie.BeginPlayback(&chip8))
+				{
+					rewind.Clear();
+					rewinding = false;
+					runner.SetPaused(false);
+				}
+				else
+				{
+					add_log("movie was recorded on a different rom\n");
+				}
+			}
+			ImGui::SameLine();
+			save_movie = ImGui::Button("Save Movie...");
+		}
+		ImGui::SameLine();
+		load_movie = ImGui::Button("Load Movie...");
+	}
+	else
+	{
+		if (ImGui::Button("Stop"))
+		{
+			auto guard = runner.Lock();
+			movie.EndRecording(&chip8);
+			movie.EndPlayback();
+		}
+		ImGui::SameLine();
+		if (info.movie_mode == CHIP8_MOVIE_RECORDING)
+		{
+			ImGui::Text("recording, %d key changes", info.movie_input_count);
+		}
+		else
+		{
+			ImGui::Text("playing, %lld / %lld instructions", view.GetInstructionCount(), info.movie_length);
+		}
+	}
+
+	// not holding the lock while the dialogs block
+	char movie_path[MAX_PATH]{ 0 };
+	if (save_movie && file_dialog(true, movie_filter, "Save Movie...", ".c8m", movie_path))
+	{
+		auto guard = runner.Lock();
+		if (!movie.SaveToFile(movie_path))
+		{
+			add_log("could not save movie %s\n", movie_path);
+		}
+	}
+	if (load_movie && file_dialog(false, movie_filter, "Load Movie...", ".c8m", movie_path))
+	{
+		auto guard = runner.Lock();
+		if (!movie.LoadFromFile(movie_path))
+		{
+			add_log("could not load movie %s\n", movie_path);
+		}
+	}
+
+	ImGui::Text("--- DISPLAY ---");
+	if (ImGui::Combo("Palette", &mPalette, [](void *, int i, const char ** name) { *name = s_palettes[i].name; return true; }, nullptr, CHIP8APP_PALETTE_COUNT))
+	{
+		mDisplayChanged = true;
+	}
+	if (ImGui::SliderFloat("Persistence", &mPersistence, 0.0f, CHIP8APP_MAX_PERSISTENCE))
+	{
+		mDisplayChanged = true;
+	}
+	ImGui::Combo("Scaling", &mScaleMode, s_scale_mode_names, APPBASE_SCALE_COUNT);
+
+	ImGui::Text("--- REWIND ---");
+	// the emulation thread records into it, the range shown comes with the frame
+	if (info.rewind_frame_count > 0)
+	{
+		long long first_frame = info.rewind_first_frame;
+		long long last_frame = info.rewind_last_frame;
+		long long frame = rewinding ? rewind_frame : last_frame;
+		if (ImGui::SliderScalar("Frame", ImGuiDataType_S64, &frame, &first_frame, &last_frame))
+		{
+			runner.SetPaused(true);
+			auto guard = runner.Lock();
+			if (rewind.Seek(frame, &chip8))
+			{
+				rewinding = true;
+				rewind_frame = frame;
+			}
+		}
+		ImGui::Text("%.1fs held, %ldKB / %ldKB", info.rewind_frame_count / 60.0f, info.rewind_bytes_used / 1024, info.rewind_budget / 1024);
+	}
+	else
+	{
+		ImGui::Text("nothing recorded yet");
 	}
 
 	ImGui::Text("--- OPCODE CONFIG ---");
-	bool mode_8xy6 = chip8.GetConfig_8XY6_8XYE_VY_mode();
-	bool mode_bnnn = chip8.GetConfig_BNNN_ADD_mode();
-	bool mode_fx55 = chip8.GetConfig_FX55_FX65_VY_mode();
+	bool mode_8xy6 = view.GetConfig_8XY6_8XYE_VY_mode();
+	bool mode_bnnn = view.GetConfig_BNNN_ADD_mode();
+	bool mode_fx55 = view.GetConfig_FX55_FX65_VY_mode();
 	if (ImGui::Button(mode_8xy6 == 0 ? "8XY6/E Mode: 0" : "8XY6/E Mode: 1"))
 	{
+		auto guard = runner.Lock();
 		chip8.SetConfig_8XY6_8XYE_VY_mode(!mode_8xy6);
 	}
 
 	if (ImGui::Button(mode_bnnn == 0 ? "BNNN Mode: 0" : "BNNN Mode: 1"))
 	{
+		auto guard = runner.Lock();
 		chip8.SetConfig_BNNN_ADD_mode(!mode_bnnn);
 	}
 
 	if (ImGui::Button(mode_fx55 == 0 ? "FX55/65 Mode: 0" : "FX55/65 Mode: 1"))
 	{
+		auto guard = runner.Lock();
 		chip8.SetConfig_FX55_FX65_VY_mode(!mode_fx55);
 	}
 
+	// runs the rom under every combination of the modes above and keeps the best
+	if (ImGui::Button("Detect"))
+	{
+		auto guard = runner.Lock();
+		if (quirks.Run(&chip8))
+		{
+			quirks.Apply(&chip8);
+			rom_profile_source = "detected";
+		}
+	}
+	ImGui::SameLine();
+	// the modes above and the clock, kept for this rom and put back whenever it's opened
+	if (ImGui::Button("Save ROM Profile"))
+	{
+		auto guard = runner.Lock();
+		if (romdb.Store(&chip8))
+		{
+			rom_profile_source = "from rom database";
+			if (!romdb.Save(CHIP8_ROMDB_DEFAULT_FILE))
+			{
+				add_log("could not write rom database %s\n", CHIP8_ROMDB_DEFAULT_FILE);
+			}
+		}
+	}
+	ImGui::SameLine();
+	ImGui::Text("%s", rom_profile_source);
+
 	ImGui::End();
 
 	
-	gDebugLog.Draw("DEBUG LOG", 0);
+	{
+		std::lock_guard<std::mutex> guard(gDebugLogLock);
+		gDebugLog.Draw("DEBUG LOG", 0);
+	}
+
+	/////////////////////////////////////////////////////////////////
+	// TRACE WINDOW
+	////////////////////////////////////////////////////////////////
+	ImGui::Begin("TRACE");
+
+	// only this thread changes the level, the ring itself is the copy that came with the frame
+	uint8_t trace_level = chip8.GetTraceLevel();
+	for (uint8_t level = 0; level < CHIP8_TRACE_LEVEL_COUNT; level++)
+	{
+		if (level > 0)
+		{
+			ImGui::SameLine();
+		}
+		if (ImGui::RadioButton(Chip8TraceRing::GetLevelName(level), trace_level == level))
+		{
+			auto guard = runner.Lock();
+			chip8.SetTraceLevel(level);
+		}
+	}
+
+	// every instruction to disk, for chip8tracetool
+	bool start_trace_file = false;
+	if (info.trace_file_open)
+	{
+		if (ImGui::Button("Stop Trace File"))
+		{
+			auto guard = runner.Lock();
+			chip8.EndTraceFile();
+		}
+		else
+		{
+			ImGui::SameLine();
+			ImGui::Text("%llu records%s", (unsigned long long)info.trace_file_count, info.trace_file_failed ? ", out of space" : "");
+		}
+	}
+	else
+	{
+		start_trace_file = ImGui::Button("Trace To File...");
+	}
+
+	if (info.tracing)
+	{
+		Chip8TraceRing * trace = &runner.GetInfo().trace;
+		ImGui::SameLine();
+		if (ImGui::Button("Clear"))
+		{
+			auto guard = runner.Lock();
+			if (chip8.GetTrace())
+			{
+				chip8.GetTrace()->Clear();
+			}
+			trace->Clear();
+		}
+
+		ImGui::Separator();
+		ImGui::BeginChild("trace_scrolling", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
+
+		// records are only turned into text when they're on screen
+		char line[128];
+		ImGuiListClipper clipper;
+		clipper.Begin(trace->GetCount());
+		while (clipper.Step())
+		{
+			for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+			{
+				Chip8TraceRing::Format(trace->Get(i), line, sizeof(line));
+				ImGui::TextUnformatted(line);
+			}
+		}
+		clipper.End();
+
+		if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
+		{
+			ImGui::SetScrollHereY(1.0f);
+		}
+
+		ImGui::EndChild();
+	}
+
+	char trace_path[MAX_PATH]{ 0 };
+	if (start_trace_file && file_dialog(true, "Chip8 Traces(.c8t)\0*.c8t\0All Files(.)\0*.*\0", "Trace To File...", ".c8t", trace_path))
+	{
+		auto guard = runner.Lock();
+		if (!chip8.BeginTraceFile(trace_path))
+		{
+			add_log("could not create trace file %s\n", trace_path);
+		}
+	}
+
+	ImGui::End();
 
 	/////////////////////////////////////////////////////////////////
 	// DEBUG WINDOW
 	////////////////////////////////////////////////////////////////
-	uint8_t* v_regs = chip8.GetVRegs();
-	uint8_t* keys = chip8.GetKeys();
-	uint8_t sound_timer = chip8.GetSoundTimer();
-	uint8_t delay_timer = chip8.GetDelayTimer();
+	uint8_t* v_regs = view.GetVRegs();
+	uint8_t* keys = view.GetKeys();
+	uint8_t sound_timer = view.GetSoundTimer();
+	uint8_t delay_timer = view.GetDelayTimer();
 
-	short index_reg = chip8.GetIndexRef();
-	short prog_count = chip8.GetProgCount();
+	short index_reg = view.GetIndexRef();
+	short prog_count = view.GetProgCount();
 
-	uint8_t * memory = chip8.GetMemory();
+	uint8_t * memory = view.GetMemory();
 
 	ImGui::Begin("DEBUG");
 
@@ -429,23 +907,126 @@ void Chip8App::render_editmode()
 	
 	ImGui::End();
 
+	/////////////////////////////////////////////////////////////////
+	// PROFILE WINDOW
+	////////////////////////////////////////////////////////////////
+	ImGui::Begin("PROFILE");
+
+	// only this thread turns profiling on and off, the counts come with the frame
+	bool profiling = chip8.GetProfiling();
+	if (ImGui::Checkbox("Profile", &profiling))
+	{
+		auto guard = runner.Lock();
+		chip8.SetProfiling(profiling);
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Clear"))
+	{
+		auto guard = runner.Lock();
+		if (chip8.GetProfile())
+		{
+			chip8.GetProfile()->Clear();
+		}
+		mProfile.Clear();
+	}
+
+	if (profiling && info.profiling)
+	{
+		mProfile = info.profile;
+	}
+
+	uint64_t profile_total = mProfile.GetTotal();
+	ImGui::SameLine();
+	ImGui::Text("%llu instructions", (unsigned long long)profile_total);
+
+	if (profile_total > 0)
+	{
+		double profile_ns = 0.0;
+		uint8_t ops[CHIP8_OP_COUNT];
+		int op_count = 0;
+		for (uint8_t op = 0; op < CHIP8_OP_COUNT; op++)
+		{
+			profile_ns += mProfile.GetOpEstimatedNs(op);
+			if (mProfile.GetOpCount(op))
+			{
+				ops[op_count++] = op;
+			}
+		}
+		std::sort(ops, ops + op_count, [this](uint8_t a, uint8_t b) { return mProfile.GetOpCount(a) > mProfile.GetOpCount(b); });
+
+		ImGui::Separator();
+		ImGui::Text("%-5s %12s %7s %8s %7s", "OP", "COUNT", "%", "NS AVG", "TIME %");
+		for (int i = 0; i < op_count; i++)
+		{
+			uint64_t count = mProfile.GetOpCount(ops[i]);
+			double ns = mProfile.GetOpEstimatedNs(ops[i]);
+			ImGui::Text("%-5s %12llu %6.2f%% %8.1f %6.2f%%", Chip8::GetOpName(ops[i]), (unsigned long long)count,
+				100.0 * count / profile_total, mProfile.GetOpAverageNs(ops[i]), profile_ns > 0.0 ? 100.0 * ns / profile_ns : 0.0);
+		}
+
+		uint16_t hottest[CHIP8APP_PROFILE_HOTTEST];
+		int hottest_count = mProfile.GetHottest(hottest, CHIP8APP_PROFILE_HOTTEST);
+
+		ImGui::Separator();
+		ImGui::Text("%-4s %-4s %12s %7s", "ADDR", "OP", "COUNT", "%");
+		for (int i = 0; i < hottest_count; i++)
+		{
+			uint64_t count = mProfile.GetAddressCount(hottest[i]);
+			ImGui::Text("%03X  %02X%02X %12llu %6.2f%%", hottest[i], memory[hottest[i]], memory[(hottest[i] + 1) & (CHIP8_TOTAL_MEMSIZE - 1)],
+				(unsigned long long)count, 100.0 * count / profile_total);
+		}
+	}
+
+	ImGui::End();
+
+	/////////////////////////////////////////////////////////////////
+	// MEMORY WINDOW
+	////////////////////////////////////////////////////////////////
 	ImGui::Begin("MEMORY");
-	long memsize = chip8.GetMemorySize();
+	long memsize = view.GetMemorySize();
 	prog_count;
 
+	// with a profile, every word is tinted by how often it ran, on a log scale so the
+	// cold code in a hot loop's rom still shows
+	uint64_t heat_max = profile_total > 0 ? mProfile.GetMaxAddressCount() : 0;
+	double heat_scale = heat_max > 0 ? 1.0 / log(1.0 + (double)heat_max) : 0.0;
+
 	for (int i = 0x200; i < memsize; i += 8)
 	{
 		for(int j = 0; j < 8; j+=2)
 		{
+			// jumps can land on the odd byte too
+			uint64_t heat_count = heat_max > 0 ? mProfile.GetAddressCount(i + j) + mProfile.GetAddressCount(i + j + 1) : 0;
+
+			bool colored = true;
 			if (prog_count == (i + j))
 			{
 				ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.0f, 0.0f, 1.0f));
 			}
+			else if (heat_count > 0)
+			{
+				float heat = (float)(log(1.0 + (double)heat_count) * heat_scale);
+				if (heat > 1.0f) heat = 1.0f;
+				ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f - 0.65f * heat, 1.0f - heat, 1.0f));
+			}
+			else if (heat_max > 0)
+			{
+				ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.45f, 0.45f, 0.45f, 1.0f));
+			}
+			else
+			{
+				colored = false;
+			}
+
 			ImGui::Text("%02X%02X ", memory[i + j], memory[i + j + 1]);
-			if (prog_count == (i + j))
+			if (colored)
 			{
 				ImGui::PopStyleColor();
 			}
+			if (heat_count > 0 && ImGui::IsItemHovered())
+			{
+				ImGui::SetTooltip("%03X: %llu (%.2f%%)", i + j, (unsigned long long)heat_count, 100.0 * heat_count / profile_total);
+			}
 
 			if(j < 6) ImGui::SameLine();
 		}
@@ -489,7 +1070,7 @@ void Chip8App::sdl_input(SDL_Event event)
 
 			if (key != 255)
 			{
-				chip8.SetKey(key, (event.type == SDL_KEYDOWN));
+				runner.PushKey(key, (event.type == SDL_KEYDOWN));
 			}
 
 			break;
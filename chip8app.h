@@ -1,7 +1,12 @@
 #pragma once
 #include "appbase.h"
 #include "chip8.h"
+#include "chip8rewind.h"
+#include "chip8runner.h"
+#include "chip8romdb.h"
+#include "chip8quirks.h"
 #include "imgui/imgui.h"
+#include <chrono>
 
 
 extern struct Chip8DebugLog;
@@ -18,11 +23,66 @@ public:
 
 private:
 
+	// only touched by the emulation thread, or under runner.Lock()
 	Chip8 chip8;
+
+	// one snapshot per frame, seeking pauses and resuming carries on from there
+	Chip8Rewind rewind;
+	bool rewinding;
+	long long rewind_frame;
+
+	// input recording and replay, from a reset
+	Chip8Movie movie;
+
+	// per rom quirk profiles, applied when a rom is opened. a rom without one gets its modes
+	// detected instead
+	Chip8ROMDatabase romdb;
+	Chip8QuirkDetect quirks;
+	// where the current modes came from, for the OPCODE CONFIG section
+	const char * rom_profile_source;
+
+	// runs chip8 on its own thread and hands finished frames back
+	Chip8Runner runner{ &chip8, &rewind, &movie };
+
+	// the newest frame the runner published, everything drawn or shown in the debug
+	// windows comes from here so the render thread never waits on emulation
+	Chip8 view;
+
+	// copy of chip8's profile, refreshed every frame while profiling, for the PROFILE
+	// window and the MEMORY heat map
+	Chip8Profile mProfile;
+
+	// display pipeline, all of it on the gpu. the packed screen goes up as 16x64 bytes (1k a
+	// frame, hires sized whatever the mode), a phosphor pass blends it into a feedback texture
+	// that decays between frames so XOR flicker fades instead of blinking, then a palette pass
+	// maps that into the render texture. AppBase scales it to the window
+	GLuint mScreenBitsTex;
+	uint8_t mScreenBytes[CHIP8_HIRES_HEIGHT * CHIP8_SCREEN_ROW_WORDS * 8];
+	GLuint mPhosphorTex[2];
+	GLuint mPhosphorFramebuffer[2];
+	int mPhosphorCurrent;
+	GLuint mPhosphorProgram;
+	GLint mPhosphorBitsLocation;
+	GLint mPhosphorPreviousLocation;
+	GLint mPhosphorDecayLocation;
+	GLint mPhosphorScaleLocation;
+	GLuint mPaletteProgram;
+	GLint mPalettePhosphorLocation;
+	GLint mPaletteBackgroundLocation;
+	GLint mPaletteForegroundLocation;
+
+	int mPalette;
+	// brightness an unlit pixel keeps after 1/60s, 0 turns persistence off
+	float mPersistence;
+	bool mDisplayChanged;
+	// seconds until the phosphor has faded out and frames stop changing
+	float mFadeTime;
+	std::chrono::steady_clock::time_point mLastRenderTime;
 	
-	virtual void update();
+	virtual void start_frame();
 	virtual void editor_update();
 
+	virtual bool needs_render();
 	virtual void render();
 
 	virtual void render_gamemode();
@@ -31,5 +91,6 @@ private:
 	virtual void sdl_input(SDL_Event event);
 
 private:
-	bool tickOnce;
+	// truncates the rewind history after a seek, then runs (or steps) from there
+	void resume(bool step);
 };
\ No newline at end of file
@@ -0,0 +1,226 @@
+#include "chip8batch.h"
+#include <thread>
+#include <string.h>
+
+Chip8Batch::Chip8Batch(int threads)
+{
+	if (threads <= 0)
+	{
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	if (threads <= 0)
+	{
+		threads = 1;
+	}
+
+	thread_count = threads;
+	queues = new worker_queue[thread_count];
+	steals = 0;
+}
+
+Chip8Batch::~Chip8Batch()
+{
+	delete[] queues;
+}
+
+chip8_batch_job Chip8Batch::MakeJob(const uint8_t * rom, long rom_size, long long instructions)
+{
+	chip8_batch_job job;
+	job.rom = rom;
+	job.rom_size = rom_size;
+	job.state = nullptr;
+	job.instructions = instructions;
+	job.core = CHIP8_CORE_DEFAULT;
+	job.cpu_hz = 0;
+	job.quirk_8xy6 = -1;
+	job.quirk_bnnn = -1;
+	job.quirk_fx55 = -1;
+	job.seed = CHIP8_DEFAULT_RANDOM_SEED;
+	job.seeded = false;
+	job.inputs = nullptr;
+	job.input_count = 0;
+	return job;
+}
+
+int Chip8Batch::AddJob(const chip8_batch_job & job)
+{
+	jobs.push_back(job);
+	return (int)jobs.size() - 1;
+}
+
+void Chip8Batch::Clear()
+{
+	jobs.clear();
+	results.clear();
+}
+
+void Chip8Batch::Run()
+{
+	results.assign(jobs.size(), chip8_batch_result());
+	steals = 0;
+
+	// deal the jobs out round robin, stealing evens out whatever that gets wrong
+	for (int i = 0; i < (int)jobs.size(); i++)
+	{
+		queues[i % thread_count].jobs.push_back(i);
+	}
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < thread_count; i++)
+	{
+		threads.emplace_back(&Chip8Batch::worker_main, this, i);
+	}
+
+	// the calling thread is worker 0
+	worker_main(0);
+
+	for (std::thread & t : threads)
+	{
+		t.join();
+	}
+}
+
+int Chip8Batch::GetThreadCount()
+{
+	return thread_count;
+}
+
+int Chip8Batch::GetJobCount()
+{
+	return (int)jobs.size();
+}
+
+const chip8_batch_result & Chip8Batch::GetResult(int job)
+{
+	return results[job];
+}
+
+long long Chip8Batch::GetStealCount()
+{
+	return steals;
+}
+
+void Chip8Batch::worker_main(int worker)
+{
+	// one machine per worker, reloaded for every job it runs
+	Chip8 * chip8 = new Chip8();
+
+	const bool default_quirks[3] =
+	{
+		chip8->GetConfig_8XY6_8XYE_VY_mode(),
+		chip8->GetConfig_BNNN_ADD_mode(),
+		chip8->GetConfig_FX55_FX65_VY_mode()
+	};
+
+	int job = 0;
+	while (pop_job(worker, job) || steal_job(worker, job))
+	{
+		run_job(chip8, default_quirks, job, worker);
+	}
+
+	delete chip8;
+}
+
+bool Chip8Batch::pop_job(int worker, int & job)
+{
+	worker_queue & queue = queues[worker];
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if (queue.jobs.empty())
+	{
+		return false;
+	}
+
+	job = queue.jobs.front();
+	queue.jobs.pop_front();
+	return true;
+}
+
+bool Chip8Batch::steal_job(int worker, int & job)
+{
+	// jobs never spawn more jobs, so once every queue is empty we're done
+	for (int i = 1; i < thread_count; i++)
+	{
+		worker_queue & victim = queues[(worker + i) % thread_count];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.jobs.empty())
+		{
+			// take from the back, the owner works from the front
+			job = victim.jobs.back();
+			victim.jobs.pop_back();
+			steals++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Chip8Batch::run_job(Chip8 * chip8, const bool * default_quirks, int job, int worker)
+{
+	const chip8_batch_job & j = jobs[job];
+	chip8_batch_result & r = results[job];
+	memset(&r, 0, sizeof(r));
+	r.worker = worker;
+
+	chip8->SetCoreMode(j.core);
+
+	if (j.state != nullptr)
+	{
+		// forked off a snapshot, no boot to replay
+		r.loaded = chip8->LoadState(j.state, CHIP8_SAVESTATE_SIZE);
+		if (!r.loaded)
+		{
+			return;
+		}
+
+		if (j.cpu_hz) chip8->SetCPUFrequency(j.cpu_hz);
+		if (j.quirk_8xy6 >= 0) chip8->SetConfig_8XY6_8XYE_VY_mode(j.quirk_8xy6 != 0);
+		if (j.quirk_bnnn >= 0) chip8->SetConfig_BNNN_ADD_mode(j.quirk_bnnn != 0);
+		if (j.quirk_fx55 >= 0) chip8->SetConfig_FX55_FX65_VY_mode(j.quirk_fx55 != 0);
+		if (j.seeded) chip8->SetRandomSeed(j.seed);
+	}
+	else
+	{
+		chip8->SetCPUFrequency(j.cpu_hz ? j.cpu_hz : CHIP8_DEFAULT_CPU_HZ);
+		chip8->SetConfig_8XY6_8XYE_VY_mode(j.quirk_8xy6 >= 0 ? j.quirk_8xy6 != 0 : default_quirks[0]);
+		chip8->SetConfig_BNNN_ADD_mode(j.quirk_bnnn >= 0 ? j.quirk_bnnn != 0 : default_quirks[1]);
+		chip8->SetConfig_FX55_FX65_VY_mode(j.quirk_fx55 >= 0 ? j.quirk_fx55 != 0 : default_quirks[2]);
+		chip8->SetRandomSeed(j.seeded ? j.seed : CHIP8_DEFAULT_RANDOM_SEED);
+
+		r.loaded = j.image ? chip8->LoadROMImage(j.image) : chip8->LoadROM((uint8_t*)j.rom, j.rom_size);
+		if (!r.loaded)
+		{
+			return;
+		}
+		chip8->Reset();
+	}
+
+	// run up to each key change, apply it, carry on
+	long long done = 0;
+	int next_input = 0;
+	while (done < j.instructions)
+	{
+		while (next_input < j.input_count && j.inputs[next_input].at <= done)
+		{
+			chip8->SetKey(j.inputs[next_input].key, j.inputs[next_input].pressed);
+			next_input++;
+		}
+
+		long long count = j.instructions - done;
+		if (next_input < j.input_count && j.inputs[next_input].at - done < count)
+		{
+			count = j.inputs[next_input].at - done;
+		}
+
+		done += chip8->Run(count);
+	}
+
+	r.cycles = done;
+	r.screen_hash = chip8->GetScreenHash();
+	memcpy(r.v_reg, chip8->GetVRegs(), CHIP8_TOTAL_V_REGS);
+	r.index_reg = chip8->GetIndexRef();
+	r.prog_count = chip8->GetProgCount();
+	r.stack_pointer = chip8->GetStackPointer();
+	r.delay_timer = chip8->GetDelayTimer();
+	r.sound_timer = chip8->GetSoundTimer();
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "chip8.h"
+#include <vector>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+// batch emulation
+// runs a list of jobs (rom + settings + optional key script) to completion across a pool of
+// worker threads. every worker owns one Chip8 that gets reloaded per job, jobs are dealt out
+// round robin and a worker that runs dry steals from the back of another worker's queue
+
+// key change fed in once the machine has run `at` instructions
+struct chip8_batch_input
+{
+	long long at;
+	uint8_t key;
+	bool pressed;
+};
+
+struct chip8_batch_job
+{
+	// not owned, must stay alive until Run() returns. many jobs can share one rom
+	const uint8_t * rom;
+	long rom_size;
+	// used instead of rom when set, every worker shares it rather than taking a copy
+	std::shared_ptr<const Chip8ROMImage> image;
+
+	// optional SaveState() snapshot to start from instead of booting the rom, not owned.
+	// it brings its own quirks, only the ones set explicitly below override them
+	const uint8_t * state;
+
+	long long instructions;
+	uint8_t core;
+	// 0 leaves CHIP8_DEFAULT_CPU_HZ (or the snapshot's), sets how often the timers tick
+	uint32_t cpu_hz;
+
+	// -1 leaves the Chip8 default
+	int8_t quirk_8xy6;
+	int8_t quirk_bnnn;
+	int8_t quirk_fx55;
+
+	// cxnn seed, used when seeded is set. on a snapshot it restarts the generator from the
+	// seed, otherwise the snapshot carries on its own stream
+	uint64_t seed;
+	bool seeded;
+
+	// sorted by `at`, not owned
+	const chip8_batch_input * inputs;
+	int input_count;
+};
+
+struct chip8_batch_result
+{
+	bool loaded;
+	long long cycles;
+	uint64_t screen_hash;
+	uint8_t v_reg[CHIP8_TOTAL_V_REGS];
+	unsigned short index_reg;
+	unsigned short prog_count;
+	unsigned short stack_pointer;
+	uint8_t delay_timer;
+	uint8_t sound_timer;
+	int worker; // which thread ran it
+};
+
+class Chip8Batch
+{
+public:
+	// 0 threads = one per hardware thread
+	Chip8Batch(int threads = 0);
+	~Chip8Batch();
+
+	static chip8_batch_job MakeJob(const uint8_t * rom, long rom_size, long long instructions);
+
+	// returns the job's index into GetResults()
+	int AddJob(const chip8_batch_job & job);
+	void Clear();
+
+	// runs every queued job, blocks until they're all done
+	void Run();
+
+	int GetThreadCount();
+	int GetJobCount();
+	const chip8_batch_result & GetResult(int job);
+	// jobs one worker took from another worker's queue in the last Run()
+	long long GetStealCount();
+
+private:
+	struct worker_queue
+	{
+		std::mutex lock;
+		std::deque<int> jobs;
+	};
+
+	void worker_main(int worker);
+	bool pop_job(int worker, int & job);
+	bool steal_job(int worker, int & job);
+	void run_job(Chip8 * chip8, const bool * default_quirks, int job, int worker);
+
+private:
+	int thread_count;
+	worker_queue * queues;
+
+	std::vector<chip8_batch_job> jobs;
+	std::vector<chip8_batch_result> results;
+
+	std::atomic<long long> steals;
+};
@@ -0,0 +1,921 @@
+// Chip8 core benchmark
+// runs a suite of small synthetic roms, each a tight loop over one opcode family, plus any
+// rom files given, through every interpreter core for a fixed number of instructions and
+// reports instructions per second, ns per instruction and (on linux, where perf_event_open
+// is allowed) host cycles, cache misses and branch misses per emulated instruction. the
+// final machine state is hashed so a core that diverges shows up immediately
+//
+// -json prints one object per bench and core per line instead of the table, the keys and
+// units don't change between versions (BENCH_FORMAT says which), so the output can be
+// diffed and tracked over time
+//
+// -verify doesn't time anything, it runs the known-answer roms through each core and checks
+// the registers and screen at fixed points (the super-chip scrolls, DXY0, FX30, FX75/FX85)
+// and that a savestate taken mid run resumes to exactly where running straight on gets
+//
+// usage: chip8bench [rom...] [options]
+
+#include "chip8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define BENCH_FORMAT "chip8bench/1"
+#define BENCH_DEFAULT_INSTRUCTIONS 50000000LL
+#define BENCH_DEFAULT_REPEAT 3
+// run before every timed run, so the jit has compiled and the caches are warm
+#define BENCH_WARMUP_INSTRUCTIONS 100000LL
+
+#define BENCH_COUNTER_CYCLES 0
+#define BENCH_COUNTER_INSTRUCTIONS 1
+#define BENCH_COUNTER_CACHE_MISSES 2
+#define BENCH_COUNTER_L1D_MISSES 3
+#define BENCH_COUNTER_BRANCH_MISSES 4
+#define BENCH_COUNTER_COUNT 5
+
+static const char * counter_names[BENCH_COUNTER_COUNT] =
+{
+	"cycles", "host_instructions", "cache_misses", "l1d_read_misses", "branch_misses"
+};
+
+// synthetic roms, every one is an endless loop so any instruction count works
+
+// 8XYn, 10 of every 11 instructions are alu ops
+static const uint8_t rom_alu[] =
+{
+	0x60, 0x01, // 200 V0 = 1
+	0x61, 0x03, // 202 V1 = 3
+	0x80, 0x14, // 204 V0 += V1
+	0x81, 0x05, // 206 V1 -= V0
+	0x80, 0x11, // 208 V0 |= V1
+	0x80, 0x12, // 20A V0 &= V1
+	0x80, 0x13, // 20C V0 ^= V1
+	0x80, 0x16, // 20E V0 >>= 1
+	0x81, 0x0E, // 210 V1 <<= 1
+	0x80, 0x17, // 212 V0 = V1 - V0
+	0x82, 0x00, // 214 V2 = V0
+	0x70, 0x05, // 216 V0 += 5
+	0x12, 0x04, // 218 jump 204
+};
+
+// 3XNN 4XNN 5XY0 9XY0, taken and not taken, and one that follows CXNN so it can't be predicted
+static const uint8_t rom_branch[] =
+{
+	0x60, 0x05, // 200 V0 = 5
+	0x61, 0x05, // 202 V1 = 5
+	0x62, 0x07, // 204 V2 = 7
+	0x30, 0x05, // 206 skip if V0 == 5 (taken)
+	0x63, 0x00, // 208
+	0x40, 0x05, // 20A skip if V0 != 5 (not taken)
+	0x63, 0x01, // 20C
+	0x50, 0x10, // 20E skip if V0 == V1 (taken)
+	0x63, 0x02, // 210
+	0x90, 0x20, // 212 skip if V0 != V2 (taken)
+	0x63, 0x03, // 214
+	0xC4, 0x01, // 216 V4 = rand & 1
+	0x34, 0x00, // 218 skip if V4 == 0 (random)
+	0x63, 0x04, // 21A
+	0x12, 0x06, // 21C jump 206
+};
+
+// 2NNN / 00EE, two levels deep, 8 of every 9 instructions are calls or returns
+static const uint8_t rom_call[] =
+{
+	0x22, 0x06, // 200 call 206
+	0x22, 0x06, // 202 call 206
+	0x12, 0x00, // 204 jump 200
+	0x22, 0x0A, // 206 call 20A
+	0x00, 0xEE, // 208 return
+	0x00, 0xEE, // 20A return
+};
+
+// DXYN, font sprites walking across the screen so rows wrap and collide
+static const uint8_t rom_draw[] =
+{
+	0x62, 0x00, // 200 V2 = 0
+	0xF2, 0x29, // 202 I = font digit V2
+	0xD0, 0x15, // 204 draw 5 rows at V0, V1
+	0x70, 0x03, // 206 V0 += 3
+	0x71, 0x01, // 208 V1 += 1
+	0xD0, 0x1F, // 20A draw 15 rows at V0, V1
+	0x72, 0x01, // 20C V2 += 1
+	0x12, 0x02, // 20E jump 202
+};
+
+// FX33 FX55 FX65, I reset every pass so whichever FX55 quirk is on it never walks into code
+static const uint8_t rom_memory[] =
+{
+	0x60, 0x7B, // 200 V0 = 123
+	0xA3, 0x00, // 202 I = 300
+	0xF0, 0x33, // 204 bcd of V0 at I
+	0xF3, 0x55, // 206 store V0-V3 at I
+	0xA3, 0x04, // 208 I = 304
+	0xF3, 0x55, // 20A store V0-V3 at I
+	0xA3, 0x00, // 20C I = 300
+	0xF3, 0x65, // 20E load V0-V3 from I
+	0x70, 0xA7, // 210 V0 += A7
+	0x12, 0x02, // 212 jump 202
+};
+
+// shaped like a game's main loop: clear, random sprite positions, a key check, the delay
+// timer, a bit of arithmetic and a clear every 256 passes
+static const uint8_t rom_game[] =
+{
+	0x00, 0xE0, // 200 clear
+	0xC0, 0x3F, // 202 V0 = rand & 3F
+	0xC1, 0x1F, // 204 V1 = rand & 1F
+	0xC2, 0x0F, // 206 V2 = rand & F
+	0xF2, 0x29, // 208 I = font digit V2
+	0xD0, 0x15, // 20A draw 5 rows at V0, V1
+	0xE2, 0x9E, // 20C skip if key V2 down
+	0x63, 0x00, // 20E V3 = 0
+	0xF3, 0x15, // 210 delay = V3
+	0xF5, 0x07, // 212 V5 = delay
+	0x83, 0x54, // 214 V3 += V5
+	0x74, 0x01, // 216 V4 += 1
+	0x44, 0x00, // 218 skip if V4 != 0
+	0x00, 0xE0, // 21A clear
+	0x12, 0x02, // 21C jump 202
+};
+
+// known-answer roms for -verify, each one runs to a self jump. the expected registers and
+// screen hashes (GetScreenHash()) at each check were worked out from what the instructions
+// are specified to do, not recorded from a core, so a core that's wrong the same way as the
+// others still fails
+
+struct verify_check
+{
+	const char * name;
+	long long instructions; // since reset
+	uint8_t v_reg[CHIP8_TOTAL_V_REGS];
+	uint16_t index_reg;
+	uint16_t prog_count;
+	bool hires;
+	uint64_t screen;
+};
+
+// 00FF/00FE and DXY0 in lores, placed so the sprites clip at the right and bottom edges and
+// one start position wraps, then every scroll with something lit against each edge
+static const uint8_t rom_verify_lores[] =
+{
+	0x00, 0xFF, // 200 hires
+	0xA2, 0x30, // 202 I = sprite
+	0xD0, 0x10, // 204 draw at 0, 0
+	0x00, 0xFE, // 206 back to lores, the screen clears
+	0x60, 0x38, // 208 V0 = 56
+	0x61, 0x18, // 20A V1 = 24
+	0xD0, 0x10, // 20C draw at 56, 24, clipped right and bottom
+	0x82, 0xF0, // 20E V2 = VF
+	0x60, 0x00, // 210 V0 = 0
+	0x61, 0x00, // 212 V1 = 0
+	0xD0, 0x10, // 214 draw at 0, 0
+	0x83, 0xF0, // 216 V3 = VF
+	0x60, 0x70, // 218 V0 = 112
+	0x61, 0x30, // 21A V1 = 48
+	0xD0, 0x10, // 21C draw at 48, 16 (wrapped), over the first one
+	0x84, 0xF0, // 21E V4 = VF
+	0x00, 0xC3, // 220 scroll down 3
+	0x00, 0xFB, // 222 scroll right
+	0x00, 0xFC, // 224 scroll left
+	0x00, 0xFC, // 226 scroll left
+	0x12, 0x28, // 228 jump 228
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0xFF, 0xFF, // 230 16x16 sprite, a box with a diagonal and a notch top left
+	0xE0, 0x01,
+	0xA0, 0x01,
+	0x90, 0x01,
+	0x88, 0x01,
+	0x84, 0x01,
+	0x82, 0x01,
+	0x81, 0x01,
+	0x80, 0x81,
+	0x80, 0x41,
+	0x80, 0x21,
+	0x80, 0x11,
+	0x80, 0x09,
+	0x80, 0x05,
+	0x80, 0x03,
+	0xFF, 0xFF,
+};
+
+static const verify_check rom_verify_lores_checks[] =
+{
+	{ "00FE", 4, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, 0x230, 0x208, false, 0x0C8210784D8AF5A5ULL },
+	{ "DXY0 lores", 16, { 0x70, 0x30, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x230, 0x220, false, 0x1F99DD6C2155E639ULL },
+	{ "00CN lores", 17, { 0x70, 0x30, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x230, 0x222, false, 0x04C948CD523B7211ULL },
+	{ "00FB lores", 18, { 0x70, 0x30, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x230, 0x224, false, 0x3BA6E63A0FE83A7FULL },
+	{ "00FC lores", 20, { 0x70, 0x30, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x230, 0x228, false, 0xEE53070D1BB63DA5ULL },
+	{ "loop lores", 1000, { 0x70, 0x30, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x230, 0x228, false, 0xEE53070D1BB63DA5ULL },
+};
+
+// the same in hires, one sprite straddles the two words of a packed row. then an FX30
+// digit, and FX30 with no such digit leaves I alone
+static const uint8_t rom_verify_hires[] =
+{
+	0x00, 0xFF, // 200 hires
+	0xA2, 0x40, // 202 I = sprite
+	0x60, 0x38, // 204 V0 = 56
+	0x61, 0x18, // 206 V1 = 24
+	0xD0, 0x10, // 208 draw at 56, 24, across the middle word boundary
+	0x60, 0x78, // 20A V0 = 120
+	0x61, 0x38, // 20C V1 = 56
+	0xD0, 0x10, // 20E draw at 120, 56, clipped right and bottom
+	0x82, 0xF0, // 210 V2 = VF
+	0x60, 0x88, // 212 V0 = 136
+	0x61, 0x42, // 214 V1 = 66
+	0xD0, 0x10, // 216 draw at 8, 2 (wrapped)
+	0x83, 0xF0, // 218 V3 = VF
+	0x60, 0x00, // 21A V0 = 0
+	0x61, 0x00, // 21C V1 = 0
+	0xD0, 0x10, // 21E draw at 0, 0, over the last one
+	0x84, 0xF0, // 220 V4 = VF
+	0x00, 0xC3, // 222 scroll down 3
+	0x00, 0xFB, // 224 scroll right
+	0x00, 0xFC, // 226 scroll left
+	0x00, 0xFC, // 228 scroll left
+	0x65, 0x09, // 22A V5 = 9
+	0xF5, 0x30, // 22C I = big digit V5
+	0x66, 0x3C, // 22E V6 = 60
+	0x67, 0x1E, // 230 V7 = 30
+	0xD6, 0x7A, // 232 draw 10 rows at 60, 30
+	0x68, 0x10, // 234 V8 = 16
+	0xF8, 0x30, // 236 no big digit 16, I stays
+	0x12, 0x38, // 238 jump 238
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0xFF, 0xFF, // 240 16x16 sprite, a box with a diagonal and a notch top left
+	0xE0, 0x01,
+	0xA0, 0x01,
+	0x90, 0x01,
+	0x88, 0x01,
+	0x84, 0x01,
+	0x82, 0x01,
+	0x81, 0x01,
+	0x80, 0x81,
+	0x80, 0x41,
+	0x80, 0x21,
+	0x80, 0x11,
+	0x80, 0x09,
+	0x80, 0x05,
+	0x80, 0x03,
+	0xFF, 0xFF,
+};
+
+static const verify_check rom_verify_hires_checks[] =
+{
+	{ "DXY0 hires", 17, { 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x240, 0x222, true, 0x058B1BB5BBC33FD2ULL },
+	{ "00CN hires", 18, { 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x240, 0x224, true, 0xCAD6BC8338DE3EC3ULL },
+	{ "00FB hires", 19, { 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x240, 0x226, true, 0x2D5BD44AF1E5B8CEULL },
+	{ "00FC hires", 21, { 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x240, 0x22A, true, 0xBA8FD891BE29F082ULL },
+	{ "FX30", 28, { 0x00, 0x00, 0x00, 0x00, 0x01, 0x09, 0x3C, 0x1E, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x1AA, 0x238, true, 0x151C0BABE913C6AEULL },
+	{ "loop hires", 1000, { 0x00, 0x00, 0x00, 0x00, 0x01, 0x09, 0x3C, 0x1E, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 }, 0x1AA, 0x238, true, 0x151C0BABE913C6AEULL },
+};
+
+// FX75/FX85, partly and with X past the 8 flags. then a loop over the timers, rand, a call,
+// the flags and the scrolls that -verify also saves mid run and resumes
+static const uint8_t rom_verify_flags[] =
+{
+	0x60, 0x11, // 200 V0 = 11
+	0x61, 0x22, // 202 V1 = 22
+	0x62, 0x33, // 204 V2 = 33
+	0x63, 0x44, // 206 V3 = 44
+	0x64, 0x55, // 208 V4 = 55
+	0x65, 0x66, // 20A V5 = 66
+	0x66, 0x77, // 20C V6 = 77
+	0x67, 0x88, // 20E V7 = 88
+	0x68, 0x99, // 210 V8 = 99
+	0xFF, 0x75, // 212 flags = V0-V7, X past 7 stops at 7
+	0x60, 0x00, // 214 V0 = 0
+	0x61, 0x00, // 216 V1 = 0
+	0x62, 0x00, // 218 V2 = 0
+	0x63, 0x00, // 21A V3 = 0
+	0x64, 0x00, // 21C V4 = 0
+	0x65, 0x00, // 21E V5 = 0
+	0x66, 0x00, // 220 V6 = 0
+	0x67, 0x00, // 222 V7 = 0
+	0x68, 0x00, // 224 V8 = 0
+	0xF3, 0x85, // 226 V0-V3 = flags
+	0xFF, 0x85, // 228 V0-V7 = flags, V8 stays 0
+	0x00, 0xFF, // 22A hires
+	0x6A, 0x3C, // 22C VA = 60
+	0xFA, 0x15, // 22E delay = VA
+	0xC0, 0x7F, // 230 V0 = rand & 7F
+	0xC1, 0x3F, // 232 V1 = rand & 3F
+	0xA2, 0x60, // 234 I = sprite
+	0xD0, 0x10, // 236 draw at V0, V1
+	0x22, 0x48, // 238 call 248
+	0xF2, 0x07, // 23A V2 = delay
+	0x32, 0x00, // 23C skip if V2 == 0
+	0x12, 0x30, // 23E jump 230
+	0xFA, 0x15, // 240 delay = VA
+	0xF0, 0x18, // 242 sound = V0
+	0x00, 0xC1, // 244 scroll down 1
+	0x12, 0x30, // 246 jump 230
+	0x00, 0xFB, // 248 scroll right
+	0x79, 0x01, // 24A V9 += 1
+	0xF3, 0x85, // 24C V0-V3 = flags
+	0xF7, 0x75, // 24E flags = V0-V7
+	0x00, 0xEE, // 250 return
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0xFF, 0xFF, // 260 16x16 sprite, a box with a diagonal and a notch top left
+	0xE0, 0x01,
+	0xA0, 0x01,
+	0x90, 0x01,
+	0x88, 0x01,
+	0x84, 0x01,
+	0x82, 0x01,
+	0x81, 0x01,
+	0x80, 0x81,
+	0x80, 0x41,
+	0x80, 0x21,
+	0x80, 0x11,
+	0x80, 0x09,
+	0x80, 0x05,
+	0x80, 0x03,
+	0xFF, 0xFF,
+};
+
+static const verify_check rom_verify_flags_checks[] =
+{
+	{ "FX75", 10, { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, 0x000, 0x214, false, 0x0C8210784D8AF5A5ULL },
+	{ "FX85", 20, { 0x11, 0x22, 0x33, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, 0x000, 0x228, false, 0x0C8210784D8AF5A5ULL },
+	{ "FX85 clamped", 21, { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, 0x000, 0x22A, false, 0x0C8210784D8AF5A5ULL },
+};
+
+struct verify_rom
+{
+	const char * name;
+	const uint8_t * data;
+	long size;
+	const verify_check * checks;
+	int check_count;
+};
+
+#define VERIFY_ROM(name) { #name, rom_verify_##name, sizeof(rom_verify_##name), rom_verify_##name##_checks, sizeof(rom_verify_##name##_checks) / sizeof(verify_check) }
+
+static const verify_rom verify_roms[] =
+{
+	VERIFY_ROM(lores),
+	VERIFY_ROM(hires),
+	VERIFY_ROM(flags),
+};
+
+// every known-answer rom is also run this far, snapshotted part way and resumed from it
+#define VERIFY_RESUME_INSTRUCTIONS 200000LL
+#define VERIFY_RESUME_AT 77777LL
+
+struct bench_rom
+{
+	std::string name;
+	std::vector<uint8_t> data;
+};
+
+struct bench_counters
+{
+	int fds[BENCH_COUNTER_COUNT];
+	uint64_t values[BENCH_COUNTER_COUNT];
+	bool valid[BENCH_COUNTER_COUNT];
+};
+
+struct bench_result
+{
+	long long instructions;
+	double seconds;
+	bench_counters counters;
+	uint32_t state;
+};
+
+static uint32_t hash_bytes(uint32_t hash, const uint8_t * data, long size)
+{
+	// FNV-1a
+	for (long i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t hash_state(Chip8 * chip8)
+{
+	uint32_t hash = 2166136261u;
+	unsigned short index_reg = chip8->GetIndexRef();
+	unsigned short prog_count = chip8->GetProgCount();
+
+	hash = hash_bytes(hash, chip8->GetVRegs(), CHIP8_TOTAL_V_REGS);
+	hash = hash_bytes(hash, (uint8_t*)&index_reg, sizeof(index_reg));
+	hash = hash_bytes(hash, (uint8_t*)&prog_count, sizeof(prog_count));
+	hash = hash_bytes(hash, chip8->GetMemory(), chip8->GetMemorySize());
+	hash = hash_bytes(hash, (const uint8_t*)chip8->GetScreenRows(), CHIP8_HIRES_HEIGHT * CHIP8_SCREEN_ROW_WORDS * sizeof(uint64_t));
+	return hash;
+}
+
+static bool parse_core(const char * name, uint8_t & core)
+{
+	for (uint8_t i = 0; i < CHIP8_CORE_COUNT; i++)
+	{
+		if (strcmp(name, Chip8::GetCoreName(i)) == 0)
+		{
+			core = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool read_rom(const char * path, bench_rom & rom)
+{
+	FILE * fp = fopen(path, "rb");
+	if (!fp)
+	{
+		return false;
+	}
+
+	uint8_t buffer[CHIP8_TOTAL_MEMSIZE - CHIP8_WORK_MEM_START];
+	size_t size = fread(buffer, 1, sizeof(buffer), fp);
+	fclose(fp);
+
+	// named after the file, without the directory or extension
+	const char * name = path;
+	for (const char * c = path; *c; c++)
+	{
+		if (*c == '/' || *c == '\\') name = c + 1;
+	}
+	rom.name = name;
+	size_t dot = rom.name.rfind('.');
+	if (dot != std::string::npos && dot > 0)
+	{
+		rom.name.resize(dot);
+	}
+
+	rom.data.assign(buffer, buffer + size);
+	return size > 0;
+}
+
+// perf counters
+
+static void counters_open(bench_counters & counters)
+{
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		counters.fds[i] = -1;
+		counters.values[i] = 0;
+		counters.valid[i] = false;
+	}
+
+#ifdef __linux__
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// more counters than the pmu has get time sliced, these let the count be scaled back up
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		switch (i)
+		{
+		case BENCH_COUNTER_CYCLES: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+		case BENCH_COUNTER_INSTRUCTIONS: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+		case BENCH_COUNTER_CACHE_MISSES: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+		case BENCH_COUNTER_BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+		case BENCH_COUNTER_L1D_MISSES:
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			break;
+		}
+
+		// this thread, any cpu. fails in containers, vms without a pmu and with
+		// perf_event_paranoid set high, which just leaves the counter out
+		counters.fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+}
+
+static void counters_start(bench_counters & counters)
+{
+#ifdef __linux__
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		if (counters.fds[i] >= 0)
+		{
+			ioctl(counters.fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters.fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#else
+	(void)counters;
+#endif
+}
+
+static void counters_stop(bench_counters & counters)
+{
+#ifdef __linux__
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		if (counters.fds[i] >= 0)
+		{
+			ioctl(counters.fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		// value, time enabled, time running
+		uint64_t data[3];
+		counters.valid[i] = counters.fds[i] >= 0 && read(counters.fds[i], data, sizeof(data)) == sizeof(data) && data[2] > 0;
+		if (counters.valid[i])
+		{
+			counters.values[i] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+		}
+	}
+#else
+	(void)counters;
+#endif
+}
+
+static void counters_close(bench_counters & counters)
+{
+#ifdef __linux__
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		if (counters.fds[i] >= 0)
+		{
+			close(counters.fds[i]);
+			counters.fds[i] = -1;
+		}
+	}
+#else
+	(void)counters;
+#endif
+}
+
+// best of repeat runs, each from a fresh reset and a warmup
+static bench_result run_bench(Chip8 * chip8, bench_counters & counters, long long instructions, int repeat)
+{
+	bench_result best;
+	best.seconds = -1.0;
+
+	for (int r = 0; r < repeat; r++)
+	{
+		chip8->Reset();
+		chip8->Run(BENCH_WARMUP_INSTRUCTIONS);
+
+		counters_start(counters);
+		auto start = std::chrono::steady_clock::now();
+		long long ran = chip8->Run(instructions);
+		auto end = std::chrono::steady_clock::now();
+		counters_stop(counters);
+
+		double seconds = std::chrono::duration<double>(end - start).count();
+		if (best.seconds < 0.0 || seconds < best.seconds)
+		{
+			best.instructions = ran;
+			best.seconds = seconds;
+			best.counters = counters;
+		}
+		best.state = hash_state(chip8);
+	}
+
+	return best;
+}
+
+// known answers
+
+static void print_regs(const char * label, const uint8_t * v_reg, unsigned index_reg, unsigned prog_count, bool hires, uint64_t screen)
+{
+	printf("    %-8s V", label);
+	for (int i = 0; i < CHIP8_TOTAL_V_REGS; i++)
+	{
+		printf("%02X", v_reg[i]);
+	}
+	printf(" I %03X pc %03X %s screen %016llX\n", index_reg, prog_count, hires ? "hires" : "lores", (unsigned long long)screen);
+}
+
+static bool verify_checks(Chip8 * chip8, const verify_rom & rom)
+{
+	bool ok = true;
+	long long ran = 0;
+	chip8->Reset();
+	for (int i = 0; i < rom.check_count; i++)
+	{
+		const verify_check & check = rom.checks[i];
+		ran += chip8->Run(check.instructions - ran);
+
+		unsigned short index_reg = chip8->GetIndexRef();
+		unsigned short prog_count = chip8->GetProgCount();
+		uint64_t screen = chip8->GetScreenHash();
+		if (ran != check.instructions || memcmp(chip8->GetVRegs(), check.v_reg, CHIP8_TOTAL_V_REGS) != 0 ||
+			index_reg != check.index_reg || prog_count != check.prog_count ||
+			chip8->GetHiRes() != check.hires || screen != check.screen)
+		{
+			printf("  %s after %lld instructions\n", check.name, ran);
+			print_regs("expected", check.v_reg, check.index_reg, check.prog_count, check.hires, check.screen);
+			print_regs("got", chip8->GetVRegs(), index_reg, prog_count, chip8->GetHiRes(), screen);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// runs straight through, then again up to VERIFY_RESUME_AT and on from a snapshot loaded
+// into a new Chip8 on resume_core. both have to end in the same snapshot
+static bool verify_resume(Chip8 * chip8, std::vector<uint8_t> & data, uint8_t resume_core)
+{
+	std::vector<uint8_t> expected(CHIP8_SAVESTATE_SIZE);
+	std::vector<uint8_t> actual(CHIP8_SAVESTATE_SIZE);
+
+	chip8->Reset();
+	chip8->Run(VERIFY_RESUME_INSTRUCTIONS);
+	chip8->SaveState(expected.data(), CHIP8_SAVESTATE_SIZE);
+
+	chip8->Reset();
+	chip8->Run(VERIFY_RESUME_AT);
+	chip8->SaveState(actual.data(), CHIP8_SAVESTATE_SIZE);
+
+	Chip8 * resumed = new Chip8();
+	resumed->LoadROM(data.data(), (long)data.size());
+	resumed->SetCoreMode(resume_core);
+	bool ok = resumed->LoadState(actual.data(), CHIP8_SAVESTATE_SIZE);
+	if (ok)
+	{
+		resumed->Run(VERIFY_RESUME_INSTRUCTIONS - VERIFY_RESUME_AT);
+		resumed->SaveState(actual.data(), CHIP8_SAVESTATE_SIZE);
+		ok = memcmp(expected.data(), actual.data(), CHIP8_SAVESTATE_SIZE) == 0;
+	}
+	delete resumed;
+
+	if (!ok)
+	{
+		printf("  resumed on %s from a snapshot at %lld doesn't match running straight to %lld\n",
+			Chip8::GetCoreName(resume_core), VERIFY_RESUME_AT, VERIFY_RESUME_INSTRUCTIONS);
+	}
+	return ok;
+}
+
+static int run_verify(const std::vector<uint8_t> & cores)
+{
+	Chip8 * chip8 = new Chip8();
+	int failures = 0;
+
+	for (const verify_rom & rom : verify_roms)
+	{
+		std::vector<uint8_t> data(rom.data, rom.data + rom.size);
+		if (!chip8->LoadROM(data.data(), (long)data.size()))
+		{
+			printf("could not load rom: %s\n", rom.name);
+			failures++;
+			continue;
+		}
+
+		for (size_t c = 0; c < cores.size(); c++)
+		{
+			chip8->SetCoreMode(cores[c]);
+			// resumed on the next core, a snapshot shouldn't care which core wrote it
+			bool ok = verify_checks(chip8, rom);
+			ok &= verify_resume(chip8, data, cores[(c + 1) % cores.size()]);
+			printf("%-12s %-12s %s\n", rom.name, Chip8::GetCoreName(cores[c]), ok ? "ok" : "FAIL");
+			if (!ok)
+			{
+				failures++;
+			}
+		}
+	}
+
+	delete chip8;
+	return failures;
+}
+
+static void print_table_header()
+{
+	printf("\n%-12s %-12s %14s %9s %9s %9s %9s %9s   %-8s\n",
+		"bench", "core", "instr/sec", "ns/instr", "cyc/instr", "cmiss/ki", "l1d/ki", "bmiss/ki", "state");
+}
+
+static void print_table_row(const char * bench, uint8_t core, const bench_result & r, bool state_ok, double baseline_ips)
+{
+	double ips = r.seconds > 0.0 ? r.instructions / r.seconds : 0.0;
+	printf("%-12s %-12s %14.0f %9.2f", bench, Chip8::GetCoreName(core), ips, (r.seconds * 1e9) / r.instructions);
+
+	// cycles per emulated instruction, the rest per thousand emulated instructions
+	static const int columns[4] = { BENCH_COUNTER_CYCLES, BENCH_COUNTER_CACHE_MISSES, BENCH_COUNTER_L1D_MISSES, BENCH_COUNTER_BRANCH_MISSES };
+	for (int c = 0; c < 4; c++)
+	{
+		int i = columns[c];
+		if (r.counters.valid[i])
+		{
+			printf(" %9.2f", (double)r.counters.values[i] * (i == BENCH_COUNTER_CYCLES ? 1.0 : 1000.0) / r.instructions);
+		}
+		else
+		{
+			printf(" %9s", "-");
+		}
+	}
+
+	printf("   %08X", r.state);
+	if (!state_ok)
+	{
+		printf("  MISMATCH");
+	}
+	else if (core != CHIP8_CORE_SWITCH && baseline_ips > 0.0)
+	{
+		printf("  (%.2fx)", ips / baseline_ips);
+	}
+	printf("\n");
+}
+
+static void print_json_row(const char * bench, uint8_t core, const bench_result & r, bool state_ok)
+{
+	printf("{\"format\":\"%s\",\"bench\":\"%s\",\"core\":\"%s\",\"instructions\":%lld,\"seconds\":%.9f,\"ns_per_instr\":%.4f,\"instr_per_sec\":%.0f",
+		BENCH_FORMAT, bench, Chip8::GetCoreName(core), r.instructions, r.seconds,
+		(r.seconds * 1e9) / r.instructions, r.seconds > 0.0 ? r.instructions / r.seconds : 0.0);
+
+	// counters that couldn't be opened are null rather than missing
+	for (int i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		if (r.counters.valid[i])
+		{
+			printf(",\"%s\":%llu", counter_names[i], (unsigned long long)r.counters.values[i]);
+		}
+		else
+		{
+			printf(",\"%s\":null", counter_names[i]);
+		}
+	}
+
+	printf(",\"state\":\"%08X\",\"state_ok\":%s}\n", r.state, state_ok ? "true" : "false");
+}
+
+static void print_usage(const char * exe)
+{
+	printf("usage: %s [rom...] [options]\n", exe);
+	printf("  -i <n>         instructions per run (default %lld)\n", BENCH_DEFAULT_INSTRUCTIONS);
+	printf("  -repeat <n>    runs per bench and core, the fastest is kept (default %d)\n", BENCH_DEFAULT_REPEAT);
+	printf("  -core <name>   only this core (switch, predecoded, threaded or jit), can be repeated\n");
+	printf("  -bench <name>  only this bench (alu, branch, call, draw, memory, game or a rom's file name), can be repeated\n");
+	printf("  -json          one json object per line instead of the table\n");
+	printf("  -verify        check every core against the known-answer roms instead, exits 2 on a failure\n");
+}
+
+int main(int argc, char *argv[])
+{
+	long long instructions = BENCH_DEFAULT_INSTRUCTIONS;
+	int repeat = BENCH_DEFAULT_REPEAT;
+	bool json = false;
+	bool verify = false;
+	std::vector<uint8_t> cores;
+	std::vector<std::string> only;
+
+	std::vector<bench_rom> roms =
+	{
+		{ "alu", std::vector<uint8_t>(rom_alu, rom_alu + sizeof(rom_alu)) },
+		{ "branch", std::vector<uint8_t>(rom_branch, rom_branch + sizeof(rom_branch)) },
+		{ "call", std::vector<uint8_t>(rom_call, rom_call + sizeof(rom_call)) },
+		{ "draw", std::vector<uint8_t>(rom_draw, rom_draw + sizeof(rom_draw)) },
+		{ "memory", std::vector<uint8_t>(rom_memory, rom_memory + sizeof(rom_memory)) },
+		{ "game", std::vector<uint8_t>(rom_game, rom_game + sizeof(rom_game)) },
+	};
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char * arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (strcmp(arg, "-i") == 0 && has_value) { instructions = atoll(argv[++i]); }
+		else if (strcmp(arg, "-repeat") == 0 && has_value) { repeat = atoi(argv[++i]); }
+		else if (strcmp(arg, "-bench") == 0 && has_value) { only.push_back(argv[++i]); }
+		else if (strcmp(arg, "-json") == 0) { json = true; }
+		else if (strcmp(arg, "-verify") == 0) { verify = true; }
+		else if (strcmp(arg, "-core") == 0 && has_value)
+		{
+			uint8_t core;
+			if (!parse_core(argv[++i], core))
+			{
+				printf("unknown core: %s\n", argv[i]);
+				return 1;
+			}
+			cores.push_back(core);
+		}
+		else if (arg[0] != '-')
+		{
+			bench_rom rom;
+			if (!read_rom(arg, rom))
+			{
+				printf("could not load rom: %s\n", arg);
+				return 1;
+			}
+			roms.push_back(rom);
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (instructions <= 0 || repeat < 1)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	if (cores.empty())
+	{
+		for (uint8_t core = 0; core < CHIP8_CORE_COUNT; core++)
+		{
+			cores.push_back(core);
+		}
+	}
+
+	if (verify)
+	{
+		return run_verify(cores) ? 2 : 0;
+	}
+
+	bench_counters counters;
+	counters_open(counters);
+
+	// big enough that it shouldn't live on the stack
+	Chip8 * chip8 = new Chip8();
+
+	if (!json)
+	{
+		print_table_header();
+	}
+
+	int mismatches = 0;
+	for (size_t b = 0; b < roms.size(); b++)
+	{
+		bool wanted = only.empty();
+		for (size_t o = 0; o < only.size(); o++)
+		{
+			wanted |= only[o] == roms[b].name;
+		}
+		if (!wanted)
+		{
+			continue;
+		}
+
+		if (!chip8->LoadROM(roms[b].data.data(), (long)roms[b].data.size()))
+		{
+			printf("could not load rom: %s\n", roms[b].name.c_str());
+			continue;
+		}
+
+		// every core has to finish in the state the first one did
+		bool have_baseline = false;
+		uint32_t baseline_state = 0;
+		double baseline_ips = 0.0;
+		for (size_t c = 0; c < cores.size(); c++)
+		{
+			chip8->SetCoreMode(cores[c]);
+			bench_result r = run_bench(chip8, counters, instructions, repeat);
+
+			bool state_ok = !have_baseline || r.state == baseline_state;
+			if (!have_baseline)
+			{
+				have_baseline = true;
+				baseline_state = r.state;
+			}
+			if (!state_ok)
+			{
+				mismatches++;
+			}
+			if (cores[c] == CHIP8_CORE_SWITCH && r.seconds > 0.0)
+			{
+				baseline_ips = r.instructions / r.seconds;
+			}
+
+			if (json)
+			{
+				print_json_row(roms[b].name.c_str(), cores[c], r, state_ok);
+			}
+			else
+			{
+				print_table_row(roms[b].name.c_str(), cores[c], r, state_ok, baseline_ips);
+			}
+			fflush(stdout);
+		}
+	}
+
+	if (!json && !counters.valid[BENCH_COUNTER_CYCLES])
+	{
+		printf("\nno hardware counters (perf_event_open unavailable or not permitted)\n");
+	}
+
+	counters_close(counters);
+	delete chip8;
+	return mismatches ? 2 : 0;
+}
@@ -0,0 +1,651 @@
+// Chip8 headless runner
+// runs a rom with no window, no gl and no imgui, as fast as the host allows,
+// then dumps the final machine state. only links against the emulator core.
+// given more than one rom (or -j) it runs them all as a batch across every core,
+// -lockstep runs the roms as lanes of the vector engine and checks every lane
+// against a plain Chip8 run. -movie replays recorded input, in either mode.
+// -romdb looks each rom up in a rom database and runs it with its saved profile, -scan
+// indexes a rom folder into the database first, -detect works out each rom's modes by
+// running every combination and keeps them in the database
+//
+// usage: chip8headless <rom> [rom...] [options]
+
+#include "chip8.h"
+#include "chip8batch.h"
+#include "chip8lockstep.h"
+#include "chip8movie.h"
+#include "chip8romdb.h"
+#include "chip8quirks.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#define HEADLESS_DEFAULT_FRAMES 600
+#define HEADLESS_PROFILE_ADDRESSES 16
+
+static void print_usage(const char * exe)
+{
+	printf("usage: %s <rom> [rom...] [options]\n", exe);
+	printf("  -i <n>        run n instructions\n");
+	printf("  -f <n>        run n 60hz frames (default %d)\n", HEADLESS_DEFAULT_FRAMES);
+	printf("  -hz <n>       cpu clock, instructions per second (default %d)\n", CHIP8_DEFAULT_CPU_HZ);
+	printf("  -core <name>  switch, predecoded, threaded or jit\n");
+	printf("  -q8xy6 <0|1>  8XY6/8XYE mode\n");
+	printf("  -qbnnn <0|1>  BNNN mode\n");
+	printf("  -qfx55 <0|1>  FX55/FX65 mode\n");
+	printf("  -seed <n>     cxnn random seed (default 0x%llX)\n", CHIP8_DEFAULT_RANDOM_SEED);
+	printf("  -screen       print the framebuffer\n");
+	printf("  -profile      count instructions per opcode and address and print the hottest\n");
+	printf("  -tracefile <file> write every executed instruction to a trace file (see chip8tracetool)\n");
+	printf("  -j <n>        batch mode with n threads (0 = all hardware threads)\n");
+	printf("  -repeat <n>   batch mode, queue every rom n times\n");
+	printf("  -lockstep <n> run n lanes in lockstep (roms dealt round robin) and verify each lane\n");
+	printf("  -movie <file> replay recorded input, with the movie's settings and length unless -i\n");
+	printf("  -romdb <file> rom database, roms use their saved profile for anything not given above\n");
+	printf("  -detect       run every 8XY6/BNNN/FX55 combination for -f frames, pick the best and save it to the rom database\n");
+	printf("  -scan <dir>   index the roms under dir into the rom database (default %s) and save it\n", CHIP8_ROMDB_DEFAULT_FILE);
+}
+
+static std::shared_ptr<const Chip8ROMImage> load_rom(const char * filename)
+{
+	std::shared_ptr<const Chip8ROMImage> image = Chip8ROMImage::Load(filename);
+	if (!image)
+	{
+		printf("could not open %s\n", filename);
+	}
+	return image;
+}
+
+// fills in whatever the command line (or movie) left unset from the rom's saved profile.
+// frames is how long a frame counted run is, -1 if it was counted in instructions
+static bool apply_profile(Chip8ROMDatabase * romdb, uint64_t hash, chip8_batch_job & job, bool hz_set, long long frames)
+{
+	chip8_rom_profile profile;
+	if (romdb == nullptr || !romdb->FindProfile(hash, profile))
+	{
+		return false;
+	}
+
+	if (job.quirk_8xy6 < 0) job.quirk_8xy6 = profile.quirk_8xy6;
+	if (job.quirk_bnnn < 0) job.quirk_bnnn = profile.quirk_bnnn;
+	if (job.quirk_fx55 < 0) job.quirk_fx55 = profile.quirk_fx55;
+	if (!hz_set && profile.cpu_hz >= CHIP8_MIN_CPU_HZ && profile.cpu_hz <= CHIP8_MAX_CPU_HZ)
+	{
+		job.cpu_hz = profile.cpu_hz;
+		// the same frames are more instructions at a faster clock
+		if (frames >= 0)
+		{
+			job.instructions = frames * job.cpu_hz / CHIP8_TIMER_HZ;
+		}
+	}
+	return true;
+}
+
+static int run_batch(const std::vector<const char *> & rom_paths, const chip8_batch_job & settings, int threads, int repeat,
+	Chip8ROMDatabase * romdb, bool hz_set, long long frames)
+{
+	// every job (or lane) on a rom shares its one image
+	std::vector<std::shared_ptr<const Chip8ROMImage>> roms(rom_paths.size());
+	for (size_t i = 0; i < rom_paths.size(); i++)
+	{
+		roms[i] = load_rom(rom_paths[i]);
+		if (!roms[i])
+		{
+			return 1;
+		}
+	}
+
+	Chip8Batch batch(threads);
+	for (int r = 0; r < repeat; r++)
+	{
+		for (size_t i = 0; i < roms.size(); i++)
+		{
+			chip8_batch_job job = settings;
+			job.image = roms[i];
+			apply_profile(romdb, roms[i]->GetHash(), job, hz_set, frames);
+			batch.AddJob(job);
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	batch.Run();
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	long long total = 0;
+	printf("%-6s %-40s %10s %5s %5s %16s  %s\n", "job", "rom", "cycles", "PC", "I", "screen", "V0-VF");
+	for (int i = 0; i < batch.GetJobCount(); i++)
+	{
+		const chip8_batch_result & r = batch.GetResult(i);
+		const char * path = rom_paths[i % rom_paths.size()];
+		if (!r.loaded)
+		{
+			printf("%-6d %-40s failed to load\n", i, path);
+			continue;
+		}
+
+		total += r.cycles;
+		printf("%-6d %-40s %10lld %5X %5X %016llX  ", i, path, r.cycles, r.prog_count, r.index_reg, (unsigned long long)r.screen_hash);
+		for (int v = 0; v < CHIP8_TOTAL_V_REGS; v++)
+		{
+			printf("%02X", r.v_reg[v]);
+		}
+		printf("\n");
+	}
+
+	printf("\njobs: %d  threads: %d  steals: %lld\n", batch.GetJobCount(), batch.GetThreadCount(), batch.GetStealCount());
+	printf("instructions: %lld\n", total);
+	printf("time: %.6f s\n", seconds);
+	printf("instructions/sec: %.0f\n", seconds > 0.0 ? total / seconds : 0.0);
+	return 0;
+}
+
+static void apply_settings(Chip8 * chip8, const chip8_batch_job & settings)
+{
+	chip8->SetCPUFrequency(settings.cpu_hz);
+	if (settings.quirk_8xy6 >= 0) chip8->SetConfig_8XY6_8XYE_VY_mode(settings.quirk_8xy6 != 0);
+	if (settings.quirk_bnnn >= 0) chip8->SetConfig_BNNN_ADD_mode(settings.quirk_bnnn != 0);
+	if (settings.quirk_fx55 >= 0) chip8->SetConfig_FX55_FX65_VY_mode(settings.quirk_fx55 != 0);
+	chip8->SetRandomSeed(settings.seeded ? settings.seed : CHIP8_DEFAULT_RANDOM_SEED);
+}
+
+static bool same_state(Chip8 * a, Chip8 * b)
+{
+	return memcmp(a->GetVRegs(), b->GetVRegs(), CHIP8_TOTAL_V_REGS) == 0 &&
+		a->GetIndexRef() == b->GetIndexRef() &&
+		a->GetProgCount() == b->GetProgCount() &&
+		a->GetStackPointer() == b->GetStackPointer() &&
+		a->GetDelayTimer() == b->GetDelayTimer() &&
+		a->GetSoundTimer() == b->GetSoundTimer() &&
+		a->GetScreenHash() == b->GetScreenHash() &&
+		memcmp(a->GetMemory(), b->GetMemory(), a->GetMemorySize()) == 0;
+}
+
+static int run_detect(const std::vector<const char *> & rom_paths, const chip8_batch_job & settings, long long frames,
+	Chip8ROMDatabase * romdb, const char * romdb_path)
+{
+	Chip8QuirkDetect detect;
+	Chip8 * chip8 = new Chip8();
+	apply_settings(chip8, settings);
+
+	for (const char * path : rom_paths)
+	{
+		std::shared_ptr<const Chip8ROMImage> rom = load_rom(path);
+		if (!rom)
+		{
+			delete chip8;
+			return 1;
+		}
+		chip8->LoadROMImage(rom);
+
+		auto start = std::chrono::steady_clock::now();
+		detect.Run(chip8, frames);
+		auto end = std::chrono::steady_clock::now();
+
+		printf("\n%s, %lld frames, %.3f s\n", path, frames, std::chrono::duration<double>(end - start).count());
+		printf("%-5s %-5s %-5s %8s %8s %8s %8s %8s %8s\n", "8xy6", "bnnn", "fx55", "unknown", "stack", "stray", "changes", "entropy", "score");
+		for (int i = 0; i < CHIP8_QUIRK_POLICIES; i++)
+		{
+			const chip8_quirk_candidate & c = detect.GetCandidate(i);
+			printf("%-5d %-5d %-5d %8u %8u %8u %8u %8.3f %8.3f%s\n", (i & CHIP8_QUIRK_8XY6) != 0, (i & CHIP8_QUIRK_BNNN) != 0, (i & CHIP8_QUIRK_FX55) != 0,
+				c.unknown_opcodes, c.stack_faults, c.stray_frames, c.distinct_frames, c.entropy, c.score, i == detect.GetBest() ? "  <- best" : "");
+		}
+
+		// - for a mode that made no difference
+		chip8_rom_profile detected = detect.GetProfile();
+		printf("profile: 8xy6 %c  bnnn %c  fx55 %c\n", detected.quirk_8xy6 < 0 ? '-' : '0' + detected.quirk_8xy6,
+			detected.quirk_bnnn < 0 ? '-' : '0' + detected.quirk_bnnn, detected.quirk_fx55 < 0 ? '-' : '0' + detected.quirk_fx55);
+
+		if (romdb)
+		{
+			// a clock saved by hand stays
+			chip8_rom_profile profile;
+			if (romdb->FindProfile(rom->GetHash(), profile))
+			{
+				detected.cpu_hz = profile.cpu_hz;
+			}
+			romdb->SetProfile(rom->GetHash(), detected);
+		}
+	}
+	delete chip8;
+
+	if (romdb && !romdb->Save(romdb_path))
+	{
+		printf("could not write rom database %s\n", romdb_path);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_lockstep(const std::vector<const char *> & rom_paths, const chip8_batch_job & settings, int lane_count)
+{
+	// every job (or lane) on a rom shares its one image
+	std::vector<std::shared_ptr<const Chip8ROMImage>> roms(rom_paths.size());
+	for (size_t i = 0; i < rom_paths.size(); i++)
+	{
+		roms[i] = load_rom(rom_paths[i]);
+		if (!roms[i])
+		{
+			return 1;
+		}
+	}
+
+	Chip8Lockstep lockstep(lane_count);
+	lane_count = lockstep.GetLaneCount();
+	for (int l = 0; l < lane_count; l++)
+	{
+		Chip8 * lane = lockstep.GetLane(l);
+		apply_settings(lane, settings);
+		if (!lane->LoadROMImage(roms[l % roms.size()]))
+		{
+			return 1;
+		}
+		lane->Reset();
+	}
+	lockstep.SyncFromLanes();
+
+	auto start = std::chrono::steady_clock::now();
+	lockstep.Run(settings.instructions);
+	auto end = std::chrono::steady_clock::now();
+	double lockstep_seconds = std::chrono::duration<double>(end - start).count();
+	lockstep.SyncToLanes();
+
+	// the same lanes one after another on the normal core
+	double scalar_seconds = 0.0;
+	int mismatches = 0;
+	Chip8 * chip8 = new Chip8();
+	chip8->SetCoreMode(settings.core);
+	apply_settings(chip8, settings);
+	for (int l = 0; l < lane_count; l++)
+	{
+		chip8->LoadROMImage(roms[l % roms.size()]);
+		chip8->Reset();
+
+		start = std::chrono::steady_clock::now();
+		chip8->Run(settings.instructions);
+		end = std::chrono::steady_clock::now();
+		scalar_seconds += std::chrono::duration<double>(end - start).count();
+
+		bool ok = same_state(lockstep.GetLane(l), chip8);
+		if (!ok)
+		{
+			mismatches++;
+		}
+		printf("lane %-3d %-40s %s\n", l, rom_paths[l % rom_paths.size()], ok ? "ok" : "MISMATCH");
+	}
+	delete chip8;
+
+	long long total = settings.instructions * lane_count;
+	long long vector_ops = lockstep.GetVectorLaneOps();
+	printf("\nlanes: %d  instructions/lane: %lld\n", lane_count, settings.instructions);
+	printf("vectorized: %.1f%%\n", total > 0 ? 100.0 * vector_ops / total : 0.0);
+	printf("lockstep instructions/sec: %.0f\n", lockstep_seconds > 0.0 ? total / lockstep_seconds : 0.0);
+	printf("%s core instructions/sec: %.0f\n", Chip8::GetCoreName(settings.core), scalar_seconds > 0.0 ? total / scalar_seconds : 0.0);
+	printf("mismatches: %d\n", mismatches);
+	return mismatches == 0 ? 0 : 1;
+}
+
+static bool parse_core(const char * name, uint8_t & core)
+{
+	for (uint8_t i = 0; i < CHIP8_CORE_COUNT; i++)
+	{
+		if (strcmp(name, Chip8::GetCoreName(i)) == 0)
+		{
+			core = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void print_state(Chip8 * chip8)
+{
+	uint8_t * v_regs = chip8->GetVRegs();
+	unsigned short * stack = chip8->GetStack();
+
+	printf("PC: %03X  I: %03X  SP: %X  DT: %02X  ST: %02X\n",
+		(unsigned short)chip8->GetProgCount(), (unsigned short)chip8->GetIndexRef(),
+		chip8->GetStackPointer(), chip8->GetDelayTimer(), chip8->GetSoundTimer());
+
+	for (int i = 0; i < CHIP8_TOTAL_V_REGS; i++)
+	{
+		printf("V%X: %02X%s", i, v_regs[i], (i % 8 == 7) ? "\n" : "  ");
+	}
+
+	printf("stack:");
+	for (int i = 0; i < chip8->GetStackPointer() && i < CHIP8_STACK_SIZE; i++)
+	{
+		printf(" %03X", stack[i]);
+	}
+	printf("\n");
+
+	printf("screen hash: %016llX\n", (unsigned long long)chip8->GetScreenHash());
+}
+
+static void print_screen(Chip8 * chip8)
+{
+	uint8_t * screen = chip8->GetScreenBuf();
+	int width = chip8->GetScreenWidth();
+	int height = chip8->GetScreenHeight();
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			putchar(screen[x + y * width] ? '#' : '.');
+		}
+		putchar('\n');
+	}
+}
+
+static void print_profile(Chip8 * chip8)
+{
+	Chip8Profile * profile = chip8->GetProfile();
+	uint64_t total = profile->GetTotal();
+	if (total == 0)
+	{
+		return;
+	}
+
+	printf("\n%-8s %14s %7s %10s %7s\n", "op", "count", "%", "ns (est)", "time %");
+
+	double total_ns = 0.0;
+	for (uint8_t op = 0; op < CHIP8_OP_COUNT; op++)
+	{
+		total_ns += profile->GetOpEstimatedNs(op);
+	}
+
+	for (uint8_t op = 0; op < CHIP8_OP_COUNT; op++)
+	{
+		uint64_t count = profile->GetOpCount(op);
+		if (count)
+		{
+			double ns = profile->GetOpEstimatedNs(op);
+			printf("%-8s %14llu %6.2f%% %10.0f %6.2f%%\n", Chip8::GetOpName(op), (unsigned long long)count,
+				100.0 * count / total, ns, total_ns > 0.0 ? 100.0 * ns / total_ns : 0.0);
+		}
+	}
+
+	uint16_t hottest[HEADLESS_PROFILE_ADDRESSES];
+	int found = profile->GetHottest(hottest, HEADLESS_PROFILE_ADDRESSES);
+	const uint8_t * memory = chip8->GetMemory();
+
+	printf("\n%-8s %6s %14s %7s\n", "address", "opcode", "count", "%");
+	for (int i = 0; i < found; i++)
+	{
+		uint64_t count = profile->GetAddressCount(hottest[i]);
+		printf("%03X      %02X%02X   %14llu %6.2f%%\n", hottest[i], memory[hottest[i]], memory[(hottest[i] + 1) & (CHIP8_TOTAL_MEMSIZE - 1)],
+			(unsigned long long)count, 100.0 * count / total);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<const char *> rom_paths;
+	long long instructions = -1;
+	long long frames = HEADLESS_DEFAULT_FRAMES;
+	long long cpu_hz = CHIP8_DEFAULT_CPU_HZ;
+	bool hz_set = false;
+	uint8_t core = CHIP8_CORE_DEFAULT;
+	int quirk_8xy6 = -1;
+	int quirk_bnnn = -1;
+	int quirk_fx55 = -1;
+	uint64_t seed = CHIP8_DEFAULT_RANDOM_SEED;
+	bool seeded = false;
+	bool show_screen = false;
+	bool show_profile = false;
+	const char * trace_path = nullptr;
+	int threads = -1;
+	int repeat = 1;
+	int lockstep_lanes = 0;
+	const char * movie_path = nullptr;
+	const char * romdb_path = nullptr;
+	const char * scan_dir = nullptr;
+	bool detect = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char * arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (strcmp(arg, "-i") == 0 && has_value) { instructions = atoll(argv[++i]); }
+		else if (strcmp(arg, "-f") == 0 && has_value) { frames = atoll(argv[++i]); }
+		else if (strcmp(arg, "-hz") == 0 && has_value) { cpu_hz = atoll(argv[++i]); hz_set = true; }
+		else if (strcmp(arg, "-q8xy6") == 0 && has_value) { quirk_8xy6 = atoi(argv[++i]); }
+		else if (strcmp(arg, "-qbnnn") == 0 && has_value) { quirk_bnnn = atoi(argv[++i]); }
+		else if (strcmp(arg, "-qfx55") == 0 && has_value) { quirk_fx55 = atoi(argv[++i]); }
+		else if (strcmp(arg, "-seed") == 0 && has_value) { seed = strtoull(argv[++i], nullptr, 0); seeded = true; }
+		else if (strcmp(arg, "-screen") == 0) { show_screen = true; }
+		else if (strcmp(arg, "-profile") == 0) { show_profile = true; }
+		else if (strcmp(arg, "-tracefile") == 0 && has_value) { trace_path = argv[++i]; }
+		else if (strcmp(arg, "-j") == 0 && has_value) { threads = atoi(argv[++i]); }
+		else if (strcmp(arg, "-repeat") == 0 && has_value) { repeat = atoi(argv[++i]); }
+		else if (strcmp(arg, "-lockstep") == 0 && has_value) { lockstep_lanes = atoi(argv[++i]); }
+		else if (strcmp(arg, "-movie") == 0 && has_value) { movie_path = argv[++i]; }
+		else if (strcmp(arg, "-romdb") == 0 && has_value) { romdb_path = argv[++i]; }
+		else if (strcmp(arg, "-scan") == 0 && has_value) { scan_dir = argv[++i]; }
+		else if (strcmp(arg, "-detect") == 0) { detect = true; }
+		else if (strcmp(arg, "-core") == 0 && has_value)
+		{
+			if (!parse_core(argv[++i], core))
+			{
+				printf("unknown core: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg[0] != '-') { rom_paths.push_back(arg); }
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (rom_paths.empty() && scan_dir == nullptr)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	Chip8ROMDatabase romdb;
+	bool use_romdb = romdb_path != nullptr || scan_dir != nullptr || detect;
+	if (use_romdb)
+	{
+		if (romdb_path == nullptr)
+		{
+			romdb_path = CHIP8_ROMDB_DEFAULT_FILE;
+		}
+		if (!romdb.Load(romdb_path))
+		{
+			printf("could not read rom database %s\n", romdb_path);
+			return 1;
+		}
+	}
+
+	if (scan_dir)
+	{
+		auto start = std::chrono::steady_clock::now();
+		int hashed = romdb.Scan(scan_dir, threads < 0 ? 0 : threads);
+		auto end = std::chrono::steady_clock::now();
+		if (hashed < 0)
+		{
+			printf("could not read %s\n", scan_dir);
+			return 1;
+		}
+		if (!romdb.Save(romdb_path))
+		{
+			printf("could not write rom database %s\n", romdb_path);
+			return 1;
+		}
+
+		printf("scanned %s: %d roms hashed, %d indexed, %d profiles, %.3f s\n", scan_dir, hashed,
+			(int)romdb.GetFiles().size(), romdb.GetProfileCount(), std::chrono::duration<double>(end - start).count());
+		if (rom_paths.empty())
+		{
+			return 0;
+		}
+	}
+
+	// the movie only reproduces with the settings it was recorded with
+	Chip8Movie movie;
+	if (movie_path)
+	{
+		if (!movie.LoadFromFile(movie_path))
+		{
+			printf("could not load movie %s\n", movie_path);
+			return 1;
+		}
+		if (lockstep_lanes > 0)
+		{
+			printf("-movie doesn't work with -lockstep\n");
+			return 1;
+		}
+
+		cpu_hz = movie.GetCPUFrequency();
+		quirk_8xy6 = (movie.GetQuirkFlags() & CHIP8_MOVIE_FLAG_8XY6) != 0;
+		quirk_bnnn = (movie.GetQuirkFlags() & CHIP8_MOVIE_FLAG_BNNN) != 0;
+		quirk_fx55 = (movie.GetQuirkFlags() & CHIP8_MOVIE_FLAG_FX55) != 0;
+		seed = movie.GetRandomSeed();
+		seeded = true;
+		hz_set = true;
+		if (instructions < 0)
+		{
+			instructions = movie.GetLength();
+		}
+	}
+
+	if (cpu_hz < CHIP8_MIN_CPU_HZ || cpu_hz > CHIP8_MAX_CPU_HZ)
+	{
+		printf("-hz has to be %d - %d\n", CHIP8_MIN_CPU_HZ, CHIP8_MAX_CPU_HZ);
+		return 1;
+	}
+
+	// batches count instructions, frames * hz / 60 is what RunFrame() would add up to
+	chip8_batch_job settings = Chip8Batch::MakeJob(nullptr, 0, instructions >= 0 ? instructions : frames * cpu_hz / CHIP8_TIMER_HZ);
+	settings.core = core;
+	settings.cpu_hz = (uint32_t)cpu_hz;
+	settings.quirk_8xy6 = (int8_t)quirk_8xy6;
+	settings.quirk_bnnn = (int8_t)quirk_bnnn;
+	settings.quirk_fx55 = (int8_t)quirk_fx55;
+	settings.seed = seed;
+	settings.seeded = seeded;
+	if (movie_path)
+	{
+		settings.inputs = movie.GetInputs();
+		settings.input_count = movie.GetInputCount();
+	}
+
+	if (detect)
+	{
+		return run_detect(rom_paths, settings, frames, &romdb, romdb_path);
+	}
+
+	if (lockstep_lanes > 0)
+	{
+		return run_lockstep(rom_paths, settings, lockstep_lanes);
+	}
+
+	if (rom_paths.size() > 1 || threads >= 0 || repeat > 1)
+	{
+		return run_batch(rom_paths, settings, threads < 0 ? 0 : threads, repeat < 1 ? 1 : repeat,
+			use_romdb ? &romdb : nullptr, hz_set, instructions >= 0 ? -1 : frames);
+	}
+
+	const char * rom_path = rom_paths[0];
+	std::shared_ptr<const Chip8ROMImage> rom = load_rom(rom_path);
+	if (!rom)
+	{
+		return 1;
+	}
+	bool profiled = use_romdb && apply_profile(&romdb, rom->GetHash(), settings, hz_set, -1);
+
+	// big enough that it shouldn't live on the stack
+	Chip8 * chip8 = new Chip8();
+	chip8->SetCoreMode(core);
+	apply_settings(chip8, settings);
+	chip8->SetProfiling(show_profile);
+	chip8->LoadROMImage(rom);
+	chip8->Reset();
+
+	if (movie_path && !movie.BeginPlayback(chip8))
+	{
+		printf("%s was recorded on a different rom\n", movie_path);
+		delete chip8;
+		return 1;
+	}
+
+	if (trace_path && !chip8->BeginTraceFile(trace_path))
+	{
+		delete chip8;
+		return 1;
+	}
+
+	long long executed = 0;
+	auto start = std::chrono::steady_clock::now();
+	if (movie_path)
+	{
+		executed = movie.Play(chip8, instructions);
+	}
+	else if (instructions >= 0)
+	{
+		executed = chip8->Run(instructions);
+	}
+	else
+	{
+		for (long long f = 0; f < frames; f++)
+		{
+			executed += chip8->RunFrame();
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	uint64_t traced = 0;
+	bool trace_failed = false;
+	if (trace_path)
+	{
+		traced = chip8->GetTraceFile()->GetCount();
+		trace_failed = chip8->GetTraceFile()->Failed();
+		chip8->EndTraceFile();
+	}
+
+	printf("\nrom: %s\n", rom_path);
+	printf("core: %s\n", Chip8::GetCoreName(chip8->GetCoreMode()));
+	printf("cpu: %u hz\n", chip8->GetCPUFrequency());
+	printf("quirks: 8xy6 %d  bnnn %d  fx55 %d%s\n", chip8->GetConfig_8XY6_8XYE_VY_mode(), chip8->GetConfig_BNNN_ADD_mode(),
+		chip8->GetConfig_FX55_FX65_VY_mode(), profiled ? " (rom database profile)" : "");
+	printf("seed: 0x%llX\n", (unsigned long long)chip8->GetRandomSeed());
+	if (movie_path)
+	{
+		printf("movie: %s, %d key changes over %lld instructions\n", movie_path, movie.GetInputCount(), movie.GetLength());
+	}
+	if (trace_path)
+	{
+		printf("trace: %s, %llu records%s\n", trace_path, (unsigned long long)traced, trace_failed ? " (ran out of space, the rest were dropped)" : "");
+	}
+	printf("instructions: %lld\n", executed);
+	printf("time: %.6f s\n", seconds);
+	printf("instructions/sec: %.0f\n", seconds > 0.0 ? executed / seconds : 0.0);
+	print_state(chip8);
+
+	if (show_profile)
+	{
+		print_profile(chip8);
+	}
+
+	if (show_screen)
+	{
+		print_screen(chip8);
+	}
+
+	delete chip8;
+	return 0;
+}
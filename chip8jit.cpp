@@ -0,0 +1,762 @@
+#include "chip8jit.h"
+#include <string.h>
+#include <stdio.h>
+
+#if CHIP8_JIT_AVAILABLE
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+// host registers, numbered the way x86 encodes them
+#define HOST_RAX 0
+#define HOST_RCX 1
+#define HOST_RDX 2
+#define HOST_RSI 6
+#define HOST_RDI 7
+#define HOST_R8 8
+#define HOST_R9 9
+#define HOST_R10 10
+#define HOST_R11 11
+
+#define HOST_RBX 3
+#define HOST_RBP 5
+#define HOST_R12 12
+
+// r11 holds the v_reg pointer, r10 holds index_reg, al is scratch (and the next pc
+// between blocks). the callee-saved ones are set up by the enter stub and stay put
+// for as long as blocks chain: rbx is the chip8_jit_context, rbp the instruction
+// budget and r12 the entry table
+#define HOST_VREG_BASE HOST_R11
+#define HOST_INDEX HOST_R10
+#define HOST_SCRATCH HOST_RAX
+#define HOST_CTX HOST_RBX
+#define HOST_BUDGET HOST_RBP
+#define HOST_ENTRIES HOST_R12
+
+// chip8_jit_context fields as [rbx + disp8]
+#define CTX(field) ((uint8_t)offsetof(chip8_jit_context, field))
+static_assert(offsetof(chip8_jit_context, last_opcode) < 128, "chip8_jit_context has to fit a disp8");
+static_assert(offsetof(chip8_jit_context, last_opcode) == offsetof(chip8_jit_context, opcode) + 2, "last_opcode has to follow opcode");
+
+// the rest of the caller-saved registers pin chip8 V registers for the length of a block,
+// the first V registers a block touches get them and anything after that is addressed in memory
+#ifdef _WIN32
+#define HOST_ARG1 HOST_RCX
+#define HOST_ARG2 HOST_RDX
+static const uint8_t s_pin_pool[] = { HOST_RCX, HOST_RDX, HOST_R8, HOST_R9 };
+#else
+#define HOST_ARG1 HOST_RDI
+#define HOST_ARG2 HOST_RSI
+static const uint8_t s_pin_pool[] = { HOST_RCX, HOST_RDX, HOST_RSI, HOST_RDI, HOST_R8, HOST_R9 };
+#endif
+#define PIN_POOL_SIZE (sizeof(s_pin_pool) / sizeof(s_pin_pool[0]))
+
+#define NO_PIN 0xFF
+
+// x86 condition codes for setcc and jcc
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+#define CC_L 0xC
+
+// an 8 bit operand, either a pinned host register or [r11 + disp8]
+struct jit_operand
+{
+	bool mem;
+	uint8_t reg;
+	uint8_t disp;
+};
+
+// tiny x86-64 emitter, only knows the handful of encodings the block compiler needs
+struct jit_emitter
+{
+	uint8_t * buf;
+	size_t pos;
+
+	void byte(uint8_t b) { buf[pos++] = b; }
+
+	// always emit a rex prefix for byte ops, that makes sil/dil/r8b.. addressable
+	// and keeps register numbering uniform (no ah/ch/dh/bh)
+	void rex(bool w, uint8_t reg, uint8_t rm)
+	{
+		byte(0x40 | (w ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0));
+	}
+
+	void modrm(uint8_t reg, const jit_operand & rm)
+	{
+		if (rm.mem)
+		{
+			// mod 01, [base + disp8]
+			byte(0x40 | ((reg & 7) << 3) | (HOST_VREG_BASE & 7));
+			byte(rm.disp);
+		}
+		else
+		{
+			byte(0xC0 | ((reg & 7) << 3) | (rm.reg & 7));
+		}
+	}
+
+	// <op> r/m8 with a reg (or /digit) field
+	void op_rm8(uint8_t opcode, uint8_t reg, const jit_operand & rm)
+	{
+		rex(false, reg, rm.mem ? HOST_VREG_BASE : rm.reg);
+		byte(opcode);
+		modrm(reg, rm);
+	}
+
+	void op2_rm8(uint8_t opcode, uint8_t reg, const jit_operand & rm)
+	{
+		rex(false, reg, rm.mem ? HOST_VREG_BASE : rm.reg);
+		byte(0x0F);
+		byte(opcode);
+		modrm(reg, rm);
+	}
+
+	void mov_rm8_imm8(const jit_operand & dst, uint8_t imm) { op_rm8(0xC6, 0, dst); byte(imm); }
+	void add_rm8_imm8(const jit_operand & dst, uint8_t imm) { op_rm8(0x80, 0, dst); byte(imm); }
+	void mov_r8_rm8(uint8_t dst, const jit_operand & src) { op_rm8(0x8A, dst, src); }
+	void mov_rm8_r8(const jit_operand & dst, uint8_t src) { op_rm8(0x88, src, dst); }
+	void or_rm8_r8(const jit_operand & dst, uint8_t src) { op_rm8(0x08, src, dst); }
+	void and_rm8_r8(const jit_operand & dst, uint8_t src) { op_rm8(0x20, src, dst); }
+	void xor_rm8_r8(const jit_operand & dst, uint8_t src) { op_rm8(0x30, src, dst); }
+	void add_rm8_r8(const jit_operand & dst, uint8_t src) { op_rm8(0x00, src, dst); }
+	void sub_rm8_r8(const jit_operand & dst, uint8_t src) { op_rm8(0x28, src, dst); }
+	void sub_r8_rm8(uint8_t dst, const jit_operand & src) { op_rm8(0x2A, dst, src); }
+	void cmp_r8_rm8(uint8_t lhs, const jit_operand & rhs) { op_rm8(0x3A, lhs, rhs); }
+	void shr1_rm8(const jit_operand & dst) { op_rm8(0xD0, 5, dst); }
+	void shl1_rm8(const jit_operand & dst) { op_rm8(0xD0, 4, dst); }
+	void setcc_rm8(uint8_t cc, const jit_operand & dst) { op2_rm8(0x90 | cc, 0, dst); }
+	void movzx_eax_rm8(const jit_operand & src) { op2_rm8(0xB6, HOST_RAX, src); }
+
+	void and_al_imm8(uint8_t imm) { byte(0x24); byte(imm); }
+	void shr_al_imm8(uint8_t imm) { byte(0xC0); byte(0xE8); byte(imm); }
+
+	// index_reg lives in r10, only the low 16 bits are ever written back
+	void mov_index_imm(uint16_t imm)
+	{
+		// mov r10d, imm32
+		byte(0x41); byte(0xB8 | (HOST_INDEX & 7));
+		byte(imm & 0xFF); byte(imm >> 8); byte(0); byte(0);
+	}
+
+	// FX29/FX30, index_reg = start + VX * stride when VX is a digit, left alone otherwise
+	void font_index(const jit_operand & vx, uint16_t start, uint8_t stride)
+	{
+		movzx_eax_rm8(vx);
+		// cmp al, 15; ja past the rest
+		byte(0x3C); byte(15);
+		size_t not_digit = jcc_forward(CC_A);
+		// imul eax, eax, stride; add eax, start; mov r10d, eax
+		byte(0x6B); byte(0xC0); byte(stride);
+		byte(0x05); imm32(start);
+		byte(0x41); byte(0x89); byte(0xC0 | (HOST_RAX << 3) | (HOST_INDEX & 7));
+		bind(not_digit);
+	}
+
+	void add_index_ax()
+	{
+		// add r10w, ax
+		byte(0x66); byte(0x41); byte(0x01); byte(0xC0 | (HOST_RAX << 3) | (HOST_INDEX & 7));
+	}
+
+	void imm16(uint16_t imm) { byte(imm & 0xFF); byte(imm >> 8); }
+	void imm32(uint32_t imm) { imm16(imm & 0xFFFF); imm16(imm >> 16); }
+
+	// jcc rel8 to a label already emitted
+	void jcc_back(uint8_t cc, size_t label)
+	{
+		byte(0x70 | cc);
+		byte((uint8_t)(int8_t)((long)label - (long)(pos + 1)));
+	}
+
+	// jcc rel8 to a label further on, patched by bind()
+	size_t jcc_forward(uint8_t cc)
+	{
+		byte(0x70 | cc);
+		byte(0);
+		return pos - 1;
+	}
+
+	void bind(size_t at) { buf[at] = (uint8_t)(pos - (at + 1)); }
+
+	// jmp/jcc rel32 to somewhere else in the code buffer
+	void jmp_to(const uint8_t * target)
+	{
+		byte(0xE9);
+		imm32((uint32_t)(target - (buf + pos + 4)));
+	}
+
+	void jcc_to(uint8_t cc, const uint8_t * target)
+	{
+		byte(0x0F); byte(0x80 | cc);
+		imm32((uint32_t)(target - (buf + pos + 4)));
+	}
+
+	void mov_eax_imm(uint32_t imm) { byte(0xB8); imm32(imm); }
+
+	// the budget in rbp
+	void cmp_budget_imm8(uint8_t imm) { byte(0x48); byte(0x83); byte(0xFD); byte(imm); }
+	void sub_budget_imm8(uint8_t imm) { byte(0x48); byte(0x83); byte(0xED); byte(imm); }
+
+	// 16 bit context fields, [rbx + disp8]
+	void cmp_ctx16_imm8(uint8_t disp, uint8_t imm) { byte(0x66); byte(0x83); byte(0x7B); byte(disp); byte(imm); }
+	void movzx_eax_ctx16(uint8_t disp) { byte(0x0F); byte(0xB7); byte(0x43); byte(disp); }
+	void mov_ctx16_ax(uint8_t disp) { byte(0x66); byte(0x89); byte(0x43); byte(disp); }
+	void mov_ctx16_imm(uint8_t disp, uint16_t imm) { byte(0x66); byte(0xC7); byte(0x43); byte(disp); imm16(imm); }
+	void mov_ctx32_imm(uint8_t disp, uint32_t imm) { byte(0xC7); byte(0x43); byte(disp); imm32(imm); }
+	void inc_ctx16(uint8_t disp) { byte(0x66); byte(0xFF); byte(0x43); byte(disp); }
+	void mov_rcx_ctx64(uint8_t disp) { byte(0x48); byte(0x8B); byte(0x4B); byte(disp); }
+
+	// stack[eax] through rcx
+	void mov_stack_imm16(uint16_t imm) { byte(0x66); byte(0xC7); byte(0x04); byte(0x41); imm16(imm); }
+	void movzx_eax_stack() { byte(0x0F); byte(0xB7); byte(0x04); byte(0x41); }
+
+	void dec_eax() { byte(0xFF); byte(0xC8); }
+	void add_ax_2_zx() { byte(0x83); byte(0xC0); byte(0x02); byte(0x0F); byte(0xB7); byte(0xC0); }
+	void cmp_eax_imm(uint32_t imm) { byte(0x3D); imm32(imm); }
+
+	// jmp [r12 + rax * 8], the block (or exit stub) for the pc in eax
+	void jmp_entry_eax() { byte(0x41); byte(0xFF); byte(0x24); byte(0xC4); }
+
+	// leave the block for pc, straight through the entry table when pc has a slot in it
+	void dispatch(uint32_t pc, const uint8_t * exit_stub)
+	{
+		mov_eax_imm(pc);
+		if (pc < CHIP8_TOTAL_MEMSIZE)
+		{
+			jmp_entry_eax();
+		}
+		else
+		{
+			jmp_to(exit_stub);
+		}
+	}
+
+	// Enter()'s way in, enter(ctx, target)
+	void enter_stub()
+	{
+		// push rbx; push rbp; push r12
+		byte(0x53); byte(0x55); byte(0x41); byte(0x54);
+		// mov rbx, arg1; mov rax, arg2
+		byte(0x48); byte(0x89); byte(0xC0 | ((HOST_ARG1 & 7) << 3) | HOST_CTX);
+		byte(0x48); byte(0x89); byte(0xC0 | ((HOST_ARG2 & 7) << 3) | HOST_RAX);
+		// mov r11, [rbx + v_reg]; mov r12, [rbx + entries]; mov rbp, [rbx + remaining]
+		byte(0x4C); byte(0x8B); byte(0x5B); byte(CTX(v_reg));
+		byte(0x4C); byte(0x8B); byte(0x63); byte(CTX(entries));
+		byte(0x48); byte(0x8B); byte(0x6B); byte(CTX(remaining));
+		// movzx r10d, word [rbx + index_reg]
+		byte(0x44); byte(0x0F); byte(0xB7); byte(0x53); byte(CTX(index_reg));
+		// jmp rax
+		byte(0xFF); byte(0xE0);
+	}
+
+	// and the way out, with the next pc in eax
+	void exit_stub()
+	{
+		mov_ctx16_ax(CTX(prog_count));
+		// mov [rbx + index_reg], r10w; mov [rbx + remaining], rbp
+		byte(0x66); byte(0x44); byte(0x89); byte(0x53); byte(CTX(index_reg));
+		byte(0x48); byte(0x89); byte(0x6B); byte(CTX(remaining));
+		// pop r12; pop rbp; pop rbx; ret
+		byte(0x41); byte(0x5C); byte(0x5D); byte(0x5B);
+		byte(0xC3);
+	}
+};
+
+Chip8Jit::Chip8Jit()
+{
+	code = nullptr;
+	code_used = 0;
+	stubs_size = 0;
+	enter = nullptr;
+	exit_stub = nullptr;
+	memset(entries, 0, sizeof(entries));
+	memset(blocks, 0, sizeof(blocks));
+}
+
+Chip8Jit::~Chip8Jit()
+{
+	release();
+}
+
+void Chip8Jit::release()
+{
+#if CHIP8_JIT_AVAILABLE
+	if (code)
+	{
+#ifdef _WIN32
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, CHIP8_JIT_CODE_SIZE);
+#endif
+		code = nullptr;
+	}
+#endif
+}
+
+bool Chip8Jit::protect(bool writable)
+{
+	// W^X, the buffer is only ever one or the other
+#if CHIP8_JIT_AVAILABLE
+#ifdef _WIN32
+	DWORD old_protect;
+	if (!VirtualProtect(code, CHIP8_JIT_CODE_SIZE, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old_protect))
+	{
+		return false;
+	}
+	if (!writable)
+	{
+		FlushInstructionCache(GetCurrentProcess(), code, CHIP8_JIT_CODE_SIZE);
+	}
+	return true;
+#else
+	return mprotect(code, CHIP8_JIT_CODE_SIZE, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC)) == 0;
+#endif
+#else
+	return false;
+#endif
+}
+
+bool Chip8Jit::Init()
+{
+#if CHIP8_JIT_AVAILABLE
+#ifdef _WIN32
+	code = (uint8_t*)VirtualAlloc(nullptr, CHIP8_JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void * mem = mmap(nullptr, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code = (mem == MAP_FAILED) ? nullptr : (uint8_t*)mem;
+#endif
+	if (code == nullptr)
+	{
+		printf("Chip8 JIT could not allocate executable memory, falling back to the interpreter\n");
+		return false;
+	}
+
+	emit_stubs();
+	Flush();
+
+	if (!protect(false))
+	{
+		printf("Chip8 JIT could not make its code executable, falling back to the interpreter\n");
+		release();
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Chip8Jit::emit_stubs()
+{
+	jit_emitter e;
+	e.buf = code;
+	e.pos = 0;
+
+	enter = (chip8_jit_enter_func)(void*)code;
+	e.enter_stub();
+	e.pos = (e.pos + 15) & ~(size_t)15;
+
+	exit_stub = code + e.pos;
+	e.exit_stub();
+	e.pos = (e.pos + 15) & ~(size_t)15;
+
+	stubs_size = e.pos;
+}
+
+const chip8_jit_block * Chip8Jit::compile_block(const uint8_t * memory, unsigned short address, bool shift_vy_mode)
+{
+	if (code == nullptr)
+	{
+		return nullptr;
+	}
+
+	chip8_jit_block & block = blocks[address - CHIP8_WORK_MEM_START];
+	if (!compile(block, memory, address, shift_vy_mode))
+	{
+		block.state = CHIP8_JIT_BLOCK_UNCOMPILABLE;
+		return nullptr;
+	}
+
+	block.state = CHIP8_JIT_BLOCK_COMPILED;
+	entries[address] = block.code;
+	return &block;
+}
+
+void Chip8Jit::Invalidate(int address, int length)
+{
+	// a block can start up to a whole block's worth of bytes before the write
+	int first = address - (CHIP8_JIT_MAX_BLOCK_INSTRS * 2) + 1 - CHIP8_WORK_MEM_START;
+	int last = address + length - CHIP8_WORK_MEM_START;
+
+	if (first < 0) first = 0;
+	if (last > CHIP8_DECODE_CACHE_SIZE) last = CHIP8_DECODE_CACHE_SIZE;
+
+	for (int i = first; i < last; i++)
+	{
+		chip8_jit_block & block = blocks[i];
+		int block_bytes = (block.state == CHIP8_JIT_BLOCK_COMPILED) ? block.length * 2 : 2;
+		if (block.state != CHIP8_JIT_BLOCK_EMPTY && i + CHIP8_WORK_MEM_START + block_bytes > address)
+		{
+			// the code stays in the buffer until the next flush, it's just unreachable.
+			// blocks that chain here go through the entry table, so they see it too
+			block.state = CHIP8_JIT_BLOCK_EMPTY;
+			entries[i + CHIP8_WORK_MEM_START] = exit_stub;
+		}
+	}
+}
+
+void Chip8Jit::Flush()
+{
+	memset(blocks, 0, sizeof(blocks));
+	for (int i = 0; i < CHIP8_TOTAL_MEMSIZE; i++)
+	{
+		entries[i] = exit_stub;
+	}
+	code_used = stubs_size;
+}
+
+bool Chip8Jit::is_compilable(uint8_t op)
+{
+	switch (op)
+	{
+		case CHIP8_OP_6XNN:
+		case CHIP8_OP_7XNN:
+		case CHIP8_OP_8XY0:
+		case CHIP8_OP_8XY1:
+		case CHIP8_OP_8XY2:
+		case CHIP8_OP_8XY3:
+		case CHIP8_OP_8XY4:
+		case CHIP8_OP_8XY5:
+		case CHIP8_OP_8XY6:
+		case CHIP8_OP_8XY7:
+		case CHIP8_OP_8XYE:
+		case CHIP8_OP_ANNN:
+		case CHIP8_OP_FX1E:
+		case CHIP8_OP_FX29:
+		case CHIP8_OP_FX30:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool Chip8Jit::is_block_end(uint8_t op)
+{
+	switch (op)
+	{
+		case CHIP8_OP_00EE:
+		case CHIP8_OP_1NNN:
+		case CHIP8_OP_2NNN:
+		case CHIP8_OP_3XNN:
+		case CHIP8_OP_4XNN:
+		case CHIP8_OP_5XY0:
+		case CHIP8_OP_9XY0:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool Chip8Jit::compile(chip8_jit_block & block, const uint8_t * memory, unsigned short address, bool shift_vy_mode)
+{
+	// decode the run of compilable instructions first, and the jump/skip it ends with if there is one
+	chip8_instr instrs[CHIP8_JIT_MAX_BLOCK_INSTRS];
+	int length = 0;
+	bool ends_with_branch = false;
+	for (unsigned int pc = address; length < CHIP8_JIT_MAX_BLOCK_INSTRS && pc + 1 < CHIP8_TOTAL_MEMSIZE; pc += 2)
+	{
+		Chip8::decode_opcode(memory[pc] << 8 | memory[pc + 1], instrs[length]);
+		if (is_block_end(instrs[length].op))
+		{
+			ends_with_branch = true;
+			length++;
+			break;
+		}
+		if (!is_compilable(instrs[length].op))
+		{
+			break;
+		}
+		length++;
+	}
+
+	if (length == 0)
+	{
+		return false;
+	}
+
+	// the straight-line part, the branch is handled on its own after it
+	int body = ends_with_branch ? length - 1 : length;
+	const chip8_instr & last = instrs[length - 1];
+	unsigned int last_pc = address + (length - 1) * 2;
+
+	if (!protect(true))
+	{
+		return false;
+	}
+
+	if (code_used + CHIP8_JIT_MAX_BLOCK_BYTES > CHIP8_JIT_CODE_SIZE)
+	{
+		// out of space, start over. the caller's block survives the flush
+		// because it's written after this
+		Flush();
+	}
+
+	// pin the V registers this block uses, in order of first use
+	uint8_t pins[CHIP8_TOTAL_V_REGS];
+	memset(pins, NO_PIN, sizeof(pins));
+	unsigned int pinned = 0;
+	for (int i = 0; i < body; i++)
+	{
+		uint8_t used[3] = { instrs[i].X, instrs[i].Y, CHIP8_V_REG_CARRYFLAG };
+		int used_count = (instrs[i].op >= CHIP8_OP_8XY0 && instrs[i].op <= CHIP8_OP_8XYE) ? 3 : 1;
+		for (int u = 0; u < used_count; u++)
+		{
+			if (pins[used[u]] == NO_PIN && pinned < PIN_POOL_SIZE)
+			{
+				pins[used[u]] = s_pin_pool[pinned++];
+			}
+		}
+	}
+
+	jit_operand vreg[CHIP8_TOTAL_V_REGS];
+	for (int v = 0; v < CHIP8_TOTAL_V_REGS; v++)
+	{
+		vreg[v].mem = pins[v] == NO_PIN;
+		vreg[v].reg = pins[v];
+		vreg[v].disp = (uint8_t)v;
+	}
+
+	jit_emitter e;
+	e.buf = code + code_used;
+	e.pos = 0;
+
+	// the way back to the interpreter when the block can't run, with nothing done yet
+	size_t bail = e.pos;
+	e.mov_eax_imm(address);
+	e.jmp_to(exit_stub);
+
+	// the block proper starts here, it only runs if the whole of it fits in the budget
+	size_t entry = e.pos;
+	e.cmp_budget_imm8((uint8_t)length);
+	e.jcc_back(CC_L, bail);
+	if (last.op == CHIP8_OP_2NNN)
+	{
+		// the interpreter reports the overflow
+		e.cmp_ctx16_imm8(CTX(stack_pointer), CHIP8_STACK_SIZE);
+		e.jcc_back(CC_AE, bail);
+	}
+	else if (last.op == CHIP8_OP_00EE)
+	{
+		e.cmp_ctx16_imm8(CTX(stack_pointer), 0);
+		e.jcc_back(CC_E, bail);
+	}
+	e.sub_budget_imm8((uint8_t)length);
+
+	for (int v = 0; v < CHIP8_TOTAL_V_REGS; v++)
+	{
+		if (!vreg[v].mem)
+		{
+			jit_operand home = { true, 0, (uint8_t)v };
+			e.mov_r8_rm8(vreg[v].reg, home);
+		}
+	}
+
+	// every sequence below keeps the interpreter's order of reads and writes,
+	// so X or Y being VF behaves exactly like chip8.cpp
+	const jit_operand & vf = vreg[CHIP8_V_REG_CARRYFLAG];
+	for (int i = 0; i < body; i++)
+	{
+		const chip8_instr & ins = instrs[i];
+		const jit_operand & vx = vreg[ins.X];
+		const jit_operand & vy = vreg[ins.Y];
+
+		switch (ins.op)
+		{
+			case CHIP8_OP_6XNN:
+				e.mov_rm8_imm8(vx, ins.NN);
+				break;
+			case CHIP8_OP_7XNN:
+				e.add_rm8_imm8(vx, ins.NN);
+				break;
+			case CHIP8_OP_8XY0:
+				e.mov_r8_rm8(HOST_SCRATCH, vy);
+				e.mov_rm8_r8(vx, HOST_SCRATCH);
+				break;
+			case CHIP8_OP_8XY1:
+				e.mov_r8_rm8(HOST_SCRATCH, vy);
+				e.or_rm8_r8(vx, HOST_SCRATCH);
+				break;
+			case CHIP8_OP_8XY2:
+				e.mov_r8_rm8(HOST_SCRATCH, vy);
+				e.and_rm8_r8(vx, HOST_SCRATCH);
+				break;
+			case CHIP8_OP_8XY3:
+				e.mov_r8_rm8(HOST_SCRATCH, vy);
+				e.xor_rm8_r8(vx, HOST_SCRATCH);
+				break;
+			case CHIP8_OP_8XY4:
+				// VX += VY, VF = carry
+				e.mov_r8_rm8(HOST_SCRATCH, vy);
+				e.add_rm8_r8(vx, HOST_SCRATCH);
+				e.setcc_rm8(CC_B, vf);
+				break;
+			case CHIP8_OP_8XY5:
+				// VF = VX > VY, then VX -= VY
+				e.mov_r8_rm8(HOST_SCRATCH, vx);
+				e.cmp_r8_rm8(HOST_SCRATCH, vy);
+				e.setcc_rm8(CC_A, vf);
+				e.mov_r8_rm8(HOST_SCRATCH, vy);
+				e.sub_rm8_r8(vx, HOST_SCRATCH);
+				break;
+			case CHIP8_OP_8XY6:
+				if (shift_vy_mode == AMBIG_8XY6_SHIFTMODE_SET_VX_TO_VY)
+				{
+					e.mov_r8_rm8(HOST_SCRATCH, vy);
+					e.mov_rm8_r8(vx, HOST_SCRATCH);
+				}
+				// VF = VX & 1, then VX >>= 1
+				e.mov_r8_rm8(HOST_SCRATCH, vx);
+				e.and_al_imm8(1);
+				e.mov_rm8_r8(vf, HOST_SCRATCH);
+				e.shr1_rm8(vx);
+				break;
+			case CHIP8_OP_8XY7:
+				// VF = VY >= VX, then VX = VY - VX
+				e.mov_r8_rm8(HOST_SCRATCH, vy);
+				e.cmp_r8_rm8(HOST_SCRATCH, vx);
+				e.setcc_rm8(CC_AE, vf);
+				e.mov_r8_rm8(HOST_SCRATCH, vy);
+				e.sub_r8_rm8(HOST_SCRATCH, vx);
+				e.mov_rm8_r8(vx, HOST_SCRATCH);
+				break;
+			case CHIP8_OP_8XYE:
+				if (shift_vy_mode == AMBIG_8XY6_SHIFTMODE_SET_VX_TO_VY)
+				{
+					e.mov_r8_rm8(HOST_SCRATCH, vy);
+					e.mov_rm8_r8(vx, HOST_SCRATCH);
+				}
+				// VF = VX >> 7, then VX <<= 1
+				e.mov_r8_rm8(HOST_SCRATCH, vx);
+				e.shr_al_imm8(7);
+				e.mov_rm8_r8(vf, HOST_SCRATCH);
+				e.shl1_rm8(vx);
+				break;
+			case CHIP8_OP_ANNN:
+				e.mov_index_imm(ins.NNN);
+				break;
+			case CHIP8_OP_FX1E:
+				e.movzx_eax_rm8(vx);
+				e.add_index_ax();
+				break;
+			case CHIP8_OP_FX29:
+				e.font_index(vx, CHIP8_FONTSET_MEM_START, 16);
+				break;
+			case CHIP8_OP_FX30:
+				e.font_index(vx, CHIP8_BIGFONT_MEM_START, 10);
+				break;
+			default:
+				break;
+		}
+	}
+
+	for (int v = 0; v < CHIP8_TOTAL_V_REGS; v++)
+	{
+		if (!vreg[v].mem)
+		{
+			jit_operand home = { true, 0, (uint8_t)v };
+			e.mov_rm8_r8(home, vreg[v].reg);
+		}
+	}
+
+	// opcode and last_opcode as the interpreter would leave them
+	if (length > 1)
+	{
+		e.mov_ctx32_imm(CTX(opcode), last.opcode | (uint32_t)instrs[length - 2].opcode << 16);
+	}
+	else
+	{
+		e.movzx_eax_ctx16(CTX(opcode));
+		e.mov_ctx16_ax(CTX(last_opcode));
+		e.mov_ctx16_imm(CTX(opcode), last.opcode);
+	}
+
+	// everything is back in v_reg now, so the branch works on memory and has
+	// the pinned registers to itself
+	jit_operand home_x = { true, 0, last.X };
+	jit_operand home_y = { true, 0, last.Y };
+	size_t taken;
+	switch (ends_with_branch ? last.op : CHIP8_OP_UNDECODED)
+	{
+		case CHIP8_OP_1NNN:
+			e.dispatch(last.NNN, exit_stub);
+			break;
+		case CHIP8_OP_2NNN:
+			// stack[stack_pointer++] = pc of the call
+			e.movzx_eax_ctx16(CTX(stack_pointer));
+			e.mov_rcx_ctx64(CTX(stack));
+			e.mov_stack_imm16((uint16_t)last_pc);
+			e.inc_ctx16(CTX(stack_pointer));
+			e.dispatch(last.NNN, exit_stub);
+			break;
+		case CHIP8_OP_00EE:
+			// pc = stack[--stack_pointer] + 2, which can be anywhere
+			e.movzx_eax_ctx16(CTX(stack_pointer));
+			e.dec_eax();
+			e.mov_ctx16_ax(CTX(stack_pointer));
+			e.mov_rcx_ctx64(CTX(stack));
+			e.movzx_eax_stack();
+			e.add_ax_2_zx();
+			e.cmp_eax_imm(CHIP8_TOTAL_MEMSIZE);
+			e.jcc_to(CC_AE, exit_stub);
+			e.jmp_entry_eax();
+			break;
+		case CHIP8_OP_3XNN:
+		case CHIP8_OP_4XNN:
+			e.op_rm8(0x80, 7, home_x); // cmp VX, NN
+			e.byte(last.NN);
+			taken = e.jcc_forward(last.op == CHIP8_OP_3XNN ? CC_E : CC_NE);
+			e.dispatch(last_pc + 2, exit_stub);
+			e.bind(taken);
+			e.dispatch(last_pc + 4, exit_stub);
+			break;
+		case CHIP8_OP_5XY0:
+		case CHIP8_OP_9XY0:
+			e.mov_r8_rm8(HOST_SCRATCH, home_x);
+			e.cmp_r8_rm8(HOST_SCRATCH, home_y);
+			taken = e.jcc_forward(last.op == CHIP8_OP_5XY0 ? CC_E : CC_NE);
+			e.dispatch(last_pc + 2, exit_stub);
+			e.bind(taken);
+			e.dispatch(last_pc + 4, exit_stub);
+			break;
+		default:
+			// ran into something the interpreter has to do, or the block got too long
+			e.dispatch(address + length * 2, exit_stub);
+			break;
+	}
+
+	block.code = code + code_used + entry;
+	block.length = (uint16_t)length;
+
+	code_used += e.pos;
+	// keep blocks 16 byte aligned
+	code_used = (code_used + 15) & ~(size_t)15;
+
+	if (!protect(false))
+	{
+		// nothing can run from the buffer now, give it up and leave everything to the interpreter
+		printf("Chip8 JIT could not make its code executable, falling back to the interpreter\n");
+		Flush();
+		release();
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "chip8.h"
+
+// basic block JIT for x86-64
+// straight-line runs of register-only instructions (6XNN, 7XNN, 8XYN, ANNN, FX1E, FX29, FX30) are
+// translated to native code, and a block ends with the jump, call, return or skip that
+// follows them (1NNN, 2NNN, 00EE, 3XNN, 4XNN, 5XY0, 9XY0). blocks go straight on to the
+// next one through an entry table indexed by pc, so a loop stays in native code until the
+// instruction budget runs out or it reaches something that isn't compiled. anything that
+// touches memory, timers, keys or the screen is left to the interpreter, which keeps FX0A
+// and DXYN (and every quirk that lives in them) on the exact same code path. a call that
+// would overflow the stack or a return on an empty one isn't run by the block either, the
+// interpreter does it so the error event fires
+//
+// the code buffer is never writable and executable at the same time, it's only made
+// writable while a block is being compiled
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_AVAILABLE 1
+#else
+#define CHIP8_JIT_AVAILABLE 0
+#endif
+
+#define CHIP8_JIT_MAX_BLOCK_INSTRS 64
+#define CHIP8_JIT_CODE_SIZE (256 * 1024)
+
+// worst case bytes emitted for one instruction, plus the entry checks and the block exit
+#define CHIP8_JIT_MAX_INSTR_BYTES 32
+#define CHIP8_JIT_MAX_BLOCK_BYTES (CHIP8_JIT_MAX_BLOCK_INSTRS * CHIP8_JIT_MAX_INSTR_BYTES + 256)
+
+#define CHIP8_JIT_BLOCK_EMPTY 0			// not looked at yet (or invalidated)
+#define CHIP8_JIT_BLOCK_COMPILED 1
+#define CHIP8_JIT_BLOCK_UNCOMPILABLE 2	// first instruction here can't be compiled
+
+// what the compiled code can see of the Chip8, filled in before Enter() and read back after
+// the code addresses it directly, so keep it small (every field within 127 bytes of the start)
+struct chip8_jit_context
+{
+	uint8_t * v_reg;
+	uint16_t * stack;
+	const uint8_t * const * entries; // set by Enter()
+	long long remaining; // instructions left to run, blocks only start if they fit
+	uint16_t index_reg;
+	uint16_t prog_count;
+	uint16_t stack_pointer;
+	uint16_t opcode; // last two opcodes run, so opcode/last_opcode match the interpreter
+	uint16_t last_opcode; // has to follow opcode, blocks write both in one go
+};
+
+struct chip8_jit_block
+{
+	const uint8_t * code;
+	uint16_t length; // instructions in the block, including the one it ends with
+	uint8_t state;
+};
+
+typedef void(*chip8_jit_enter_func)(chip8_jit_context * ctx, const uint8_t * target);
+
+class Chip8Jit
+{
+public:
+	Chip8Jit();
+	~Chip8Jit();
+
+	// false when this isn't an x86-64 build or executable memory isn't available
+	bool Init();
+
+	// returns the block starting at address, compiling it on first use
+	// nullptr if the instruction at address has to go through the interpreter
+	const chip8_jit_block * GetBlock(const uint8_t * memory, unsigned short address, bool shift_vy_mode)
+	{
+		// run_jit() asks on every way in and out of compiled code, so the lookup stays inline
+		unsigned int offset = (unsigned int)address - CHIP8_WORK_MEM_START;
+		if (offset >= CHIP8_DECODE_CACHE_SIZE - 1)
+		{
+			return nullptr;
+		}
+		if (blocks[offset].state == CHIP8_JIT_BLOCK_EMPTY)
+		{
+			return compile_block(memory, address, shift_vy_mode);
+		}
+		return blocks[offset].state == CHIP8_JIT_BLOCK_COMPILED ? &blocks[offset] : nullptr;
+	}
+
+	// cheap check for the interpreter between blocks, false when there's no block at address
+	// and there can't be one (it's been looked at and the first instruction isn't compilable)
+	bool MayHaveBlock(unsigned short address)
+	{
+		unsigned int offset = (unsigned int)address - CHIP8_WORK_MEM_START;
+		return offset < CHIP8_DECODE_CACHE_SIZE - 1 && blocks[offset].state != CHIP8_JIT_BLOCK_UNCOMPILABLE;
+	}
+
+	// runs compiled code from the block at address (GetBlock() has to have returned it) until
+	// the budget in ctx.remaining doesn't cover the next block, or the next pc isn't compiled
+	void Enter(chip8_jit_context & ctx, unsigned short address)
+	{
+		ctx.entries = entries;
+		enter(&ctx, entries[address]);
+	}
+
+	// drop every block that overlaps [address, address + length)
+	void Invalidate(int address, int length);
+	void Flush();
+
+private:
+	const chip8_jit_block * compile_block(const uint8_t * memory, unsigned short address, bool shift_vy_mode);
+	bool compile(chip8_jit_block & block, const uint8_t * memory, unsigned short address, bool shift_vy_mode);
+	bool protect(bool writable);
+	void emit_stubs();
+	void release();
+	static bool is_compilable(uint8_t op);
+	static bool is_block_end(uint8_t op);
+
+private:
+	uint8_t * code;
+	size_t code_used;
+	size_t stubs_size; // the enter/exit stubs at the start of the buffer survive a flush
+
+	chip8_jit_enter_func enter;
+	const uint8_t * exit_stub; // takes the pc in eax and goes back to Enter()'s caller
+
+	// where to go for each pc, exit_stub for anything that isn't compiled
+	const uint8_t * entries[CHIP8_TOTAL_MEMSIZE];
+	chip8_jit_block blocks[CHIP8_DECODE_CACHE_SIZE];
+};
@@ -0,0 +1,825 @@
+#include "chip8lockstep.h"
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CHIP8_LOCKSTEP_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHIP8_LOCKSTEP_SSE2 1
+#endif
+
+// a thin layer over whichever vector width the build has, every op works on
+// LANE_VEC_WIDTH lanes of bytes at once. the plain c++ version keeps it building
+// everywhere else and the compiler can still auto-vectorize most of it
+#if defined(CHIP8_LOCKSTEP_AVX2)
+#define LANE_VEC_WIDTH 32
+typedef __m256i lane_vec;
+static inline lane_vec vec_load(const uint8_t * p) { return _mm256_load_si256((const __m256i*)p); }
+static inline void vec_store(uint8_t * p, lane_vec v) { _mm256_store_si256((__m256i*)p, v); }
+static inline lane_vec vec_set1(uint8_t b) { return _mm256_set1_epi8((char)b); }
+static inline lane_vec vec_add(lane_vec a, lane_vec b) { return _mm256_add_epi8(a, b); }
+static inline lane_vec vec_sub(lane_vec a, lane_vec b) { return _mm256_sub_epi8(a, b); }
+static inline lane_vec vec_subs(lane_vec a, lane_vec b) { return _mm256_subs_epu8(a, b); }
+static inline lane_vec vec_or(lane_vec a, lane_vec b) { return _mm256_or_si256(a, b); }
+static inline lane_vec vec_and(lane_vec a, lane_vec b) { return _mm256_and_si256(a, b); }
+static inline lane_vec vec_xor(lane_vec a, lane_vec b) { return _mm256_xor_si256(a, b); }
+static inline lane_vec vec_max(lane_vec a, lane_vec b) { return _mm256_max_epu8(a, b); }
+static inline lane_vec vec_cmpeq(lane_vec a, lane_vec b) { return _mm256_cmpeq_epi8(a, b); }
+// bit i set for every byte i with its top bit set
+static inline uint32_t vec_movemask(lane_vec a) { return (uint32_t)_mm256_movemask_epi8(a); }
+static inline lane_vec vec_shr1(lane_vec a) { return _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F)); }
+static inline lane_vec vec_shr7(lane_vec a) { return _mm256_and_si256(_mm256_srli_epi16(a, 7), _mm256_set1_epi8(0x01)); }
+// mask ? a : b
+static inline lane_vec vec_select(lane_vec mask, lane_vec a, lane_vec b) { return _mm256_blendv_epi8(b, a, mask); }
+// pcs, opcodes and I are 16 bits a lane, timer phases 32
+static inline lane_vec vec_set1_16(uint16_t w) { return _mm256_set1_epi16((short)w); }
+static inline lane_vec vec_add16(lane_vec a, lane_vec b) { return _mm256_add_epi16(a, b); }
+static inline lane_vec vec_cmpeq16(lane_vec a, lane_vec b) { return _mm256_cmpeq_epi16(a, b); }
+// bit i set for every 16 bit lane i with its top bit set
+static inline uint32_t vec_movemask16(lane_vec a)
+{
+	// packs works on each 128 bit half, so the halves land in bytes 0-7 and 16-23
+	uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_packs_epi16(a, _mm256_setzero_si256()));
+	return (m & 0xFF) | ((m >> 8) & 0xFF00);
+}
+// LANE_VEC16_WIDTH bytes zero extended to 16 bits each
+static inline lane_vec vec_load_widen(const uint8_t * p) { return _mm256_cvtepu8_epi16(_mm_load_si128((const __m128i*)p)); }
+static inline lane_vec vec_set1_32(uint32_t d) { return _mm256_set1_epi32((int)d); }
+static inline lane_vec vec_add32(lane_vec a, lane_vec b) { return _mm256_add_epi32(a, b); }
+static inline lane_vec vec_sub32(lane_vec a, lane_vec b) { return _mm256_sub_epi32(a, b); }
+// signed, clocks and phases stay well under 2^31
+static inline lane_vec vec_cmpgt32(lane_vec a, lane_vec b) { return _mm256_cmpgt_epi32(a, b); }
+static inline uint32_t vec_movemask32(lane_vec a) { return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(a)); }
+#elif defined(CHIP8_LOCKSTEP_SSE2)
+#define LANE_VEC_WIDTH 16
+typedef __m128i lane_vec;
+static inline lane_vec vec_load(const uint8_t * p) { return _mm_load_si128((const __m128i*)p); }
+static inline void vec_store(uint8_t * p, lane_vec v) { _mm_store_si128((__m128i*)p, v); }
+static inline lane_vec vec_set1(uint8_t b) { return _mm_set1_epi8((char)b); }
+static inline lane_vec vec_add(lane_vec a, lane_vec b) { return _mm_add_epi8(a, b); }
+static inline lane_vec vec_sub(lane_vec a, lane_vec b) { return _mm_sub_epi8(a, b); }
+static inline lane_vec vec_subs(lane_vec a, lane_vec b) { return _mm_subs_epu8(a, b); }
+static inline lane_vec vec_or(lane_vec a, lane_vec b) { return _mm_or_si128(a, b); }
+static inline lane_vec vec_and(lane_vec a, lane_vec b) { return _mm_and_si128(a, b); }
+static inline lane_vec vec_xor(lane_vec a, lane_vec b) { return _mm_xor_si128(a, b); }
+static inline lane_vec vec_max(lane_vec a, lane_vec b) { return _mm_max_epu8(a, b); }
+static inline lane_vec vec_cmpeq(lane_vec a, lane_vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline uint32_t vec_movemask(lane_vec a) { return (uint32_t)_mm_movemask_epi8(a); }
+static inline lane_vec vec_shr1(lane_vec a) { return _mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(0x7F)); }
+static inline lane_vec vec_shr7(lane_vec a) { return _mm_and_si128(_mm_srli_epi16(a, 7), _mm_set1_epi8(0x01)); }
+static inline lane_vec vec_select(lane_vec mask, lane_vec a, lane_vec b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+static inline lane_vec vec_set1_16(uint16_t w) { return _mm_set1_epi16((short)w); }
+static inline lane_vec vec_add16(lane_vec a, lane_vec b) { return _mm_add_epi16(a, b); }
+static inline lane_vec vec_cmpeq16(lane_vec a, lane_vec b) { return _mm_cmpeq_epi16(a, b); }
+static inline uint32_t vec_movemask16(lane_vec a) { return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(a, _mm_setzero_si128())) & 0xFF; }
+static inline lane_vec vec_load_widen(const uint8_t * p) { return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()); }
+static inline lane_vec vec_set1_32(uint32_t d) { return _mm_set1_epi32((int)d); }
+static inline lane_vec vec_add32(lane_vec a, lane_vec b) { return _mm_add_epi32(a, b); }
+static inline lane_vec vec_sub32(lane_vec a, lane_vec b) { return _mm_sub_epi32(a, b); }
+static inline lane_vec vec_cmpgt32(lane_vec a, lane_vec b) { return _mm_cmpgt_epi32(a, b); }
+static inline uint32_t vec_movemask32(lane_vec a) { return (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(a)); }
+#else
+#define LANE_VEC_WIDTH 16
+struct lane_vec { uint8_t b[LANE_VEC_WIDTH]; };
+#define LANE_VEC_OP(expr) lane_vec r; for (int i = 0; i < LANE_VEC_WIDTH; i++) { r.b[i] = (uint8_t)(expr); } return r;
+static inline lane_vec vec_load(const uint8_t * p) { lane_vec r; memcpy(r.b, p, LANE_VEC_WIDTH); return r; }
+static inline void vec_store(uint8_t * p, lane_vec v) { memcpy(p, v.b, LANE_VEC_WIDTH); }
+static inline lane_vec vec_set1(uint8_t v) { LANE_VEC_OP(v) }
+static inline lane_vec vec_add(lane_vec a, lane_vec b) { LANE_VEC_OP(a.b[i] + b.b[i]) }
+static inline lane_vec vec_sub(lane_vec a, lane_vec b) { LANE_VEC_OP(a.b[i] - b.b[i]) }
+static inline lane_vec vec_subs(lane_vec a, lane_vec b) { LANE_VEC_OP(a.b[i] > b.b[i] ? a.b[i] - b.b[i] : 0) }
+static inline lane_vec vec_or(lane_vec a, lane_vec b) { LANE_VEC_OP(a.b[i] | b.b[i]) }
+static inline lane_vec vec_and(lane_vec a, lane_vec b) { LANE_VEC_OP(a.b[i] & b.b[i]) }
+static inline lane_vec vec_xor(lane_vec a, lane_vec b) { LANE_VEC_OP(a.b[i] ^ b.b[i]) }
+static inline lane_vec vec_max(lane_vec a, lane_vec b) { LANE_VEC_OP(a.b[i] > b.b[i] ? a.b[i] : b.b[i]) }
+static inline lane_vec vec_cmpeq(lane_vec a, lane_vec b) { LANE_VEC_OP(a.b[i] == b.b[i] ? 0xFF : 0x00) }
+static inline uint32_t vec_movemask(lane_vec a) { uint32_t r = 0; for (int i = 0; i < LANE_VEC_WIDTH; i++) { r |= (uint32_t)(a.b[i] >> 7) << i; } return r; }
+static inline lane_vec vec_shr1(lane_vec a) { LANE_VEC_OP(a.b[i] >> 1) }
+static inline lane_vec vec_shr7(lane_vec a) { LANE_VEC_OP(a.b[i] >> 7) }
+static inline lane_vec vec_select(lane_vec mask, lane_vec a, lane_vec b) { LANE_VEC_OP(mask.b[i] ? a.b[i] : b.b[i]) }
+#undef LANE_VEC_OP
+// the wider lanes go through memcpy so they don't care about alignment or aliasing
+#define LANE_VEC_OP_N(T, expr) lane_vec r; for (int i = 0; i < (int)(LANE_VEC_WIDTH / sizeof(T)); i++) { T x, y, v; memcpy(&x, a.b + i * sizeof(T), sizeof(T)); memcpy(&y, b.b + i * sizeof(T), sizeof(T)); v = (T)(expr); memcpy(r.b + i * sizeof(T), &v, sizeof(T)); } return r;
+#define LANE_VEC_SET1_N(T, value) lane_vec r; for (int i = 0; i < (int)(LANE_VEC_WIDTH / sizeof(T)); i++) { T v = value; memcpy(r.b + i * sizeof(T), &v, sizeof(T)); } return r;
+#define LANE_VEC_MOVEMASK_N(T) uint32_t r = 0; for (int i = 0; i < (int)(LANE_VEC_WIDTH / sizeof(T)); i++) { r |= (uint32_t)(a.b[i * sizeof(T) + sizeof(T) - 1] >> 7) << i; } return r;
+static inline lane_vec vec_set1_16(uint16_t w) { LANE_VEC_SET1_N(uint16_t, w) }
+static inline lane_vec vec_add16(lane_vec a, lane_vec b) { LANE_VEC_OP_N(uint16_t, x + y) }
+static inline lane_vec vec_cmpeq16(lane_vec a, lane_vec b) { LANE_VEC_OP_N(uint16_t, x == y ? 0xFFFF : 0) }
+static inline uint32_t vec_movemask16(lane_vec a) { LANE_VEC_MOVEMASK_N(uint16_t) }
+static inline lane_vec vec_load_widen(const uint8_t * p) { LANE_VEC_SET1_N(uint16_t, p[i]) }
+static inline lane_vec vec_set1_32(uint32_t d) { LANE_VEC_SET1_N(uint32_t, d) }
+static inline lane_vec vec_add32(lane_vec a, lane_vec b) { LANE_VEC_OP_N(uint32_t, x + y) }
+static inline lane_vec vec_sub32(lane_vec a, lane_vec b) { LANE_VEC_OP_N(uint32_t, x - y) }
+static inline lane_vec vec_cmpgt32(lane_vec a, lane_vec b) { LANE_VEC_OP_N(uint32_t, (int32_t)x > (int32_t)y ? 0xFFFFFFFFu : 0) }
+static inline uint32_t vec_movemask32(lane_vec a) { LANE_VEC_MOVEMASK_N(uint32_t) }
+#undef LANE_VEC_OP_N
+#undef LANE_VEC_SET1_N
+#undef LANE_VEC_MOVEMASK_N
+#endif
+
+#define LANE_VEC_CHUNKS (CHIP8_LOCKSTEP_MAX_LANES / LANE_VEC_WIDTH)
+#define LANE_VEC16_WIDTH (LANE_VEC_WIDTH / 2)
+#define LANE_VEC16_CHUNKS (CHIP8_LOCKSTEP_MAX_LANES / LANE_VEC16_WIDTH)
+#define LANE_VEC32_WIDTH (LANE_VEC_WIDTH / 4)
+#define LANE_VEC32_CHUNKS (CHIP8_LOCKSTEP_MAX_LANES / LANE_VEC32_WIDTH)
+
+static inline int lowest_lane(uint32_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctz(mask);
+#else
+	int lane = 0;
+	while (!(mask & 1)) { mask >>= 1; lane++; }
+	return lane;
+#endif
+}
+
+static inline int count_lanes(uint32_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcount(mask);
+#else
+	int lanes = 0;
+	for (; mask; mask &= mask - 1) lanes++;
+	return lanes;
+#endif
+}
+
+// 0xFF for every lane in mask, 0x00 for the rest, eight lanes per table lookup (and
+// 0xFFFF a lane, four at a time, for the 16 bit columns). built at compile time, so every
+// engine (on whatever thread) only ever reads it
+struct lane_mask_table
+{
+	uint64_t bytes[256];
+	uint64_t words[16];
+
+	constexpr lane_mask_table() : bytes(), words()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			for (int b = 0; b < 8; b++)
+			{
+				if (i & (1 << b)) bytes[i] |= 0xFFull << (b * 8);
+			}
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			for (int w = 0; w < 4; w++)
+			{
+				if (i & (1 << w)) words[i] |= 0xFFFFull << (w * 16);
+			}
+		}
+	}
+};
+static constexpr lane_mask_table s_mask_bytes;
+
+static void expand_mask(uint32_t mask, uint8_t * bytes)
+{
+	for (int i = 0; i < CHIP8_LOCKSTEP_MAX_LANES / 8; i++)
+	{
+		memcpy(bytes + i * 8, &s_mask_bytes.bytes[(mask >> (i * 8)) & 0xFF], 8);
+	}
+}
+
+static void expand_mask16(uint32_t mask, unsigned short * words)
+{
+	for (int i = 0; i < CHIP8_LOCKSTEP_MAX_LANES / 4; i++)
+	{
+		memcpy(words + i * 4, &s_mask_bytes.words[(mask >> (i * 4)) & 0xF], 8);
+	}
+}
+
+// how many bytes of memory an instruction writes, at I. the lanes that run it can
+// stop matching the lanes they share code with
+static int memory_write_length(const chip8_instr & ins)
+{
+	switch (ins.op)
+	{
+	case CHIP8_OP_FX33:
+		return 3;
+	case CHIP8_OP_FX55:
+		return ins.X + 1;
+	default:
+		return 0;
+	}
+}
+
+// the V registers an instruction the lanes can't run themselves reads or writes, only
+// these go across to the lane's Chip8 and back
+static uint16_t scalar_regs(const chip8_instr & ins)
+{
+	const uint16_t vx = (uint16_t)(1 << ins.X);
+	const uint16_t vy = (uint16_t)(1 << ins.Y);
+	const uint16_t vf = (uint16_t)(1 << CHIP8_V_REG_CARRYFLAG);
+
+	switch (ins.op)
+	{
+	case CHIP8_OP_3XNN:
+	case CHIP8_OP_4XNN:
+	case CHIP8_OP_6XNN:
+	case CHIP8_OP_7XNN:
+	case CHIP8_OP_CXNN:
+	case CHIP8_OP_EX9E:
+	case CHIP8_OP_EXA1:
+	case CHIP8_OP_FX07:
+	case CHIP8_OP_FX0A:
+	case CHIP8_OP_FX15:
+	case CHIP8_OP_FX18:
+	case CHIP8_OP_FX1E:
+	case CHIP8_OP_FX29:
+	case CHIP8_OP_FX30:
+	case CHIP8_OP_FX33:
+		return vx;
+	case CHIP8_OP_5XY0:
+	case CHIP8_OP_9XY0:
+		return vx | vy;
+	case CHIP8_OP_8XY0:
+	case CHIP8_OP_8XY1:
+	case CHIP8_OP_8XY2:
+	case CHIP8_OP_8XY3:
+	case CHIP8_OP_8XY4:
+	case CHIP8_OP_8XY5:
+	case CHIP8_OP_8XY6:
+	case CHIP8_OP_8XY7:
+	case CHIP8_OP_8XYE:
+	case CHIP8_OP_DXYN:
+	case CHIP8_OP_DXY0:
+		return vx | vy | vf;
+	case CHIP8_OP_BNNN:
+		return vx | 1;
+	case CHIP8_OP_FX55:
+	case CHIP8_OP_FX65:
+	case CHIP8_OP_FX75:
+	case CHIP8_OP_FX85:
+		return (uint16_t)((vx << 1) - 1); // V0 - VX
+	default:
+		// jumps, calls, returns, clears and scrolls
+		return 0;
+	}
+}
+
+Chip8Lockstep::Chip8Lockstep(int lanes)
+{
+	if (lanes < 1) lanes = 1;
+	if (lanes > CHIP8_LOCKSTEP_MAX_LANES) lanes = CHIP8_LOCKSTEP_MAX_LANES;
+
+	lane_count = lanes;
+	lane_mask = lane_count == 32 ? 0xFFFFFFFFu : ((1u << lane_count) - 1);
+
+	for (int i = 0; i < CHIP8_LOCKSTEP_MAX_LANES; i++)
+	{
+		this->lanes[i] = i < lane_count ? new Chip8() : nullptr;
+	}
+
+	vector_lane_ops = 0;
+	scalar_lane_ops = 0;
+	SyncFromLanes();
+}
+
+Chip8Lockstep::~Chip8Lockstep()
+{
+	for (int i = 0; i < lane_count; i++)
+	{
+		delete lanes[i];
+	}
+}
+
+int Chip8Lockstep::GetLaneCount()
+{
+	return lane_count;
+}
+
+Chip8 * Chip8Lockstep::GetLane(int lane)
+{
+	return (lane >= 0 && lane < lane_count) ? lanes[lane] : nullptr;
+}
+
+void Chip8Lockstep::SyncFromLanes()
+{
+	// unused lanes stay zero, the vector ops run over them but nothing reads them
+	memset(v_reg, 0, sizeof(v_reg));
+	memset(delay_timer, 0, sizeof(delay_timer));
+	memset(sound_timer, 0, sizeof(sound_timer));
+	memset(index_reg, 0, sizeof(index_reg));
+	memset(prog_count, 0, sizeof(prog_count));
+	memset(opcode, 0, sizeof(opcode));
+	memset(last_opcode, 0, sizeof(last_opcode));
+	memset(timer_phase, 0, sizeof(timer_phase));
+	memset(lane_words, 0, sizeof(lane_words));
+	for (int l = lane_count; l < CHIP8_LOCKSTEP_MAX_LANES; l++)
+	{
+		cpu_hz[l] = CHIP8_MAX_CPU_HZ;
+	}
+
+	for (int l = 0; l < lane_count; l++)
+	{
+		Chip8 * c = lanes[l];
+		for (int r = 0; r < CHIP8_TOTAL_V_REGS; r++)
+		{
+			v_reg[r][l] = c->v_reg[r];
+		}
+		index_reg[l] = c->index_reg;
+		prog_count[l] = c->prog_count;
+		delay_timer[l] = c->delay_timer;
+		sound_timer[l] = c->sound_timer;
+		cpu_hz[l] = c->cpu_hz;
+		timer_phase[l] = c->timer_phase;
+		opcode[l] = c->opcode;
+		last_opcode[l] = c->last_opcode;
+		lane_words[l] = 0xFFFFFFFFu;
+
+		// lanes running the same rom start out sharing their code, only the lowest lane of
+		// each group so far needs comparing
+		code_group[l] = 1u << l;
+		for (int k = 0; k < l; k++)
+		{
+			if (lowest_lane(code_group[k]) == k && memcmp(lanes[k]->memory, c->memory, CHIP8_TOTAL_MEMSIZE) == 0)
+			{
+				uint32_t group = code_group[k] | 1u << l;
+				for (uint32_t p = group; p; p &= p - 1)
+				{
+					code_group[lowest_lane(p)] = group;
+				}
+				break;
+			}
+		}
+	}
+
+	system_ticks = lanes[0]->system_ticks;
+
+	shift_mode = lanes[0]->ambig_8XY6_8XYE_VY_mode;
+	uniform_shift_mode = true;
+	for (int l = 1; l < lane_count; l++)
+	{
+		if (lanes[l]->ambig_8XY6_8XYE_VY_mode != shift_mode)
+		{
+			uniform_shift_mode = false;
+		}
+	}
+}
+
+void Chip8Lockstep::SyncToLanes()
+{
+	for (int l = 0; l < lane_count; l++)
+	{
+		Chip8 * c = lanes[l];
+		for (int r = 0; r < CHIP8_TOTAL_V_REGS; r++)
+		{
+			c->v_reg[r] = v_reg[r][l];
+		}
+		c->index_reg = index_reg[l];
+		c->prog_count = prog_count[l];
+		c->delay_timer = delay_timer[l];
+		c->sound_timer = sound_timer[l];
+		c->timer_phase = timer_phase[l];
+		c->opcode = opcode[l];
+		c->last_opcode = last_opcode[l];
+		c->system_ticks = system_ticks;
+	}
+}
+
+long long Chip8Lockstep::GetVectorLaneOps()
+{
+	return vector_lane_ops;
+}
+
+long long Chip8Lockstep::GetScalarLaneOps()
+{
+	return scalar_lane_ops;
+}
+
+long long Chip8Lockstep::Run(long long count)
+{
+	// lanes tracing every instruction have to go through their own core to get traced
+	uint32_t scalar_only = 0;
+	for (int l = 0; l < lane_count; l++)
+	{
+		if (CHIP8_TRACE_INSTR <= CHIP8_TRACE_MAX_LEVEL && lanes[l]->trace_level >= CHIP8_TRACE_INSTR)
+		{
+			scalar_only |= 1u << l;
+		}
+	}
+
+	// the timers only need looking at when some lane's period runs out
+	uint32_t timer_due = steps_until_tick();
+	uint32_t timer_steps = 0;
+
+	for (long long n = 0; n < count; n++)
+	{
+		// take the lowest lane left and every lane on the same pc with the same code, decode
+		// the instruction there once and run them together, until every lane has gone once
+		uint32_t pending = lane_mask;
+		while (pending)
+		{
+			int l = lowest_lane(pending);
+			unsigned short pc = prog_count[l];
+			uint32_t group = lanes_at(pc) & code_group[l] & pending;
+			pending &= ~group;
+
+			// a copy, running it can write over the lane's own decode
+			Chip8 * c = lanes[l];
+			c->prog_count = pc;
+			const chip8_instr lead = c->fetch_decoded();
+
+			uint32_t scalar = group;
+			if (is_vectorizable(lead.op) && (group & ~scalar_only))
+			{
+				exec_vector(lead, pc, group & ~scalar_only);
+				scalar = group & scalar_only;
+			}
+
+			int write_length = memory_write_length(lead);
+			unsigned short write_address[CHIP8_LOCKSTEP_MAX_LANES];
+			for (uint32_t p = scalar; p; p &= p - 1)
+			{
+				int k = lowest_lane(p);
+				write_address[k] = index_reg[k];
+				exec_scalar(k, lead);
+			}
+			if (write_length > 0 && scalar)
+			{
+				split_code_groups(scalar, write_address, write_length);
+			}
+		}
+
+		// what end_tick() does, for every lane whose timer period just ran out
+		if (++timer_steps == timer_due)
+		{
+			uint32_t tick_mask = advance_timers(timer_steps);
+			timer_steps = 0;
+			timer_due = steps_until_tick();
+
+			CHIP8_ALIGN(32) uint8_t tick_bytes[CHIP8_LOCKSTEP_MAX_LANES];
+			expand_mask(tick_mask, tick_bytes);
+
+			const lane_vec one = vec_set1(1);
+			for (int c = 0; c < LANE_VEC_CHUNKS; c++)
+			{
+				uint8_t * dt = delay_timer + c * LANE_VEC_WIDTH;
+				uint8_t * st = sound_timer + c * LANE_VEC_WIDTH;
+				const lane_vec m = vec_load(tick_bytes + c * LANE_VEC_WIDTH);
+				lane_vec d = vec_load(dt);
+				lane_vec t = vec_load(st);
+				vec_store(dt, vec_select(m, vec_subs(d, one), d));
+				vec_store(st, vec_select(m, vec_subs(t, one), t));
+			}
+		}
+		// only SetKey() raises the key latch, so after the first instruction it stays down
+		if (n == 0)
+		{
+			for (int l = 0; l < lane_count; l++)
+			{
+				lanes[l]->user_keypressed = false;
+			}
+		}
+
+		system_ticks++;
+	}
+
+	// bring the phases up to date for SyncToLanes(), no lane is due yet
+	if (timer_steps > 0)
+	{
+		advance_timers(timer_steps);
+	}
+
+	return count > 0 ? count : 0;
+}
+
+uint32_t Chip8Lockstep::lanes_at(unsigned short pc)
+{
+	// a 16 bit compare of every lane's pc against this one
+	const lane_vec target = vec_set1_16(pc);
+	uint32_t mask = 0;
+	for (int c = 0; c < LANE_VEC16_CHUNKS; c++)
+	{
+		const int o = c * LANE_VEC16_WIDTH;
+		mask |= vec_movemask16(vec_cmpeq16(vec_load((const uint8_t *)(prog_count + o)), target)) << o;
+	}
+	return mask;
+}
+
+void Chip8Lockstep::split_code_groups(uint32_t writers, const unsigned short * address, int length)
+{
+	// every lane in a group matched before the writers ran, so they can only differ in the
+	// bytes just written. the lanes that still match there stay together
+	uint32_t touched = 0;
+	for (uint32_t p = writers; p; p &= p - 1)
+	{
+		touched |= code_group[lowest_lane(p)];
+	}
+
+	while (touched)
+	{
+		uint32_t group = code_group[lowest_lane(touched)];
+		uint32_t group_writers = group & writers;
+		touched &= ~group;
+
+		while (group)
+		{
+			const uint8_t * first = lanes[lowest_lane(group)]->memory;
+			uint32_t same = 0;
+			for (uint32_t p = group; p; p &= p - 1)
+			{
+				int k = lowest_lane(p);
+				const uint8_t * other = lanes[k]->memory;
+				bool match = true;
+				for (uint32_t w = group_writers; w && match; w &= w - 1)
+				{
+					int at = address[lowest_lane(w)];
+					for (int i = 0; i < length; i++)
+					{
+						int a = (at + i) & (CHIP8_TOTAL_MEMSIZE - 1);
+						if (first[a] != other[a])
+						{
+							match = false;
+							break;
+						}
+					}
+				}
+				if (match)
+				{
+					same |= 1u << k;
+				}
+			}
+
+			for (uint32_t p = same; p; p &= p - 1)
+			{
+				code_group[lowest_lane(p)] = same;
+			}
+			group &= ~same;
+		}
+	}
+}
+
+uint32_t Chip8Lockstep::advance_timers(uint32_t steps)
+{
+	// end_tick()'s phase update for steps instructions, steps_until_tick() makes sure no
+	// lane passes its clock more than once. returns the lanes whose timers tick
+	const lane_vec add = vec_set1_32(steps * CHIP8_TIMER_HZ);
+	const lane_vec all = vec_set1_32(0xFFFFFFFFu);
+	uint32_t ticked = 0;
+	for (int c = 0; c < LANE_VEC32_CHUNKS; c++)
+	{
+		const int o = c * LANE_VEC32_WIDTH;
+		uint8_t * phase_row = (uint8_t *)(timer_phase + o);
+		lane_vec phase = vec_add32(vec_load(phase_row), vec_and(add, vec_load((const uint8_t *)(lane_words + o))));
+		lane_vec hz = vec_load((const uint8_t *)(cpu_hz + o));
+		lane_vec due = vec_xor(vec_cmpgt32(hz, phase), all);
+		vec_store(phase_row, vec_sub32(phase, vec_and(hz, due)));
+		ticked |= vec_movemask32(due) << o;
+	}
+	return ticked & lane_mask;
+}
+
+uint32_t Chip8Lockstep::steps_until_tick()
+{
+	// the smallest distance from a phase to its clock, then the instructions it takes to
+	// cover it. a lane already past its clock (a state loaded that way) ticks next time
+	lane_vec nearest = vec_set1_32(CHIP8_MAX_CPU_HZ);
+	for (int c = 0; c < LANE_VEC32_CHUNKS; c++)
+	{
+		const int o = c * LANE_VEC32_WIDTH;
+		lane_vec gap = vec_sub32(vec_load((const uint8_t *)(cpu_hz + o)), vec_load((const uint8_t *)(timer_phase + o)));
+		nearest = vec_select(vec_cmpgt32(nearest, gap), gap, nearest);
+	}
+
+	CHIP8_ALIGN(32) int32_t gaps[LANE_VEC32_WIDTH];
+	vec_store((uint8_t *)gaps, nearest);
+	int32_t gap = gaps[0];
+	for (int i = 1; i < LANE_VEC32_WIDTH; i++)
+	{
+		if (gaps[i] < gap) gap = gaps[i];
+	}
+
+	return gap <= CHIP8_TIMER_HZ ? 1 : (uint32_t)(gap + CHIP8_TIMER_HZ - 1) / CHIP8_TIMER_HZ;
+}
+
+bool Chip8Lockstep::is_vectorizable(uint8_t op)
+{
+	switch (op)
+	{
+	case CHIP8_OP_6XNN:
+	case CHIP8_OP_7XNN:
+	case CHIP8_OP_8XY0:
+	case CHIP8_OP_8XY1:
+	case CHIP8_OP_8XY2:
+	case CHIP8_OP_8XY3:
+	case CHIP8_OP_8XY4:
+	case CHIP8_OP_8XY5:
+	case CHIP8_OP_8XY7:
+	case CHIP8_OP_ANNN:
+	case CHIP8_OP_FX1E:
+	case CHIP8_OP_1NNN:
+	case CHIP8_OP_3XNN:
+	case CHIP8_OP_4XNN:
+	case CHIP8_OP_5XY0:
+	case CHIP8_OP_9XY0:
+		return true;
+	case CHIP8_OP_8XY6:
+	case CHIP8_OP_8XYE:
+		return uniform_shift_mode;
+	default:
+		return false;
+	}
+}
+
+void Chip8Lockstep::exec_vector(const chip8_instr & ins, unsigned short pc, uint32_t mask)
+{
+	// every lane in mask is at pc, so where each one goes next is one of two values
+	CHIP8_ALIGN(32) unsigned short mask_words[CHIP8_LOCKSTEP_MAX_LANES];
+	expand_mask16(mask, mask_words);
+
+	uint8_t * vx_row = v_reg[ins.X];
+	uint8_t * vy_row = v_reg[ins.Y];
+	uint8_t * vf_row = v_reg[CHIP8_V_REG_CARRYFLAG];
+
+	unsigned short next_pc = (unsigned short)(pc + 2);
+	uint32_t taken = 0;
+
+	if (ins.op == CHIP8_OP_1NNN)
+	{
+		next_pc = ins.NNN;
+	}
+	else if (ins.op == CHIP8_OP_3XNN || ins.op == CHIP8_OP_4XNN || ins.op == CHIP8_OP_5XY0 || ins.op == CHIP8_OP_9XY0)
+	{
+		// taken is the lanes that skip
+		bool against_nn = ins.op == CHIP8_OP_3XNN || ins.op == CHIP8_OP_4XNN;
+		for (int c = 0; c < LANE_VEC_CHUNKS; c++)
+		{
+			const int o = c * LANE_VEC_WIDTH;
+			lane_vec other = against_nn ? vec_set1(ins.NN) : vec_load(vy_row + o);
+			taken |= vec_movemask(vec_cmpeq(vec_load(vx_row + o), other)) << o;
+		}
+		if (ins.op == CHIP8_OP_4XNN || ins.op == CHIP8_OP_9XY0)
+		{
+			taken = ~taken;
+		}
+		taken &= mask;
+	}
+	else if (ins.op == CHIP8_OP_ANNN || ins.op == CHIP8_OP_FX1E)
+	{
+		// I is 16 bits a lane, FX1E adds VX widened to match
+		const lane_vec nnn = vec_set1_16(ins.NNN);
+		for (int c = 0; c < LANE_VEC16_CHUNKS; c++)
+		{
+			const int o = c * LANE_VEC16_WIDTH;
+			uint8_t * i_row = (uint8_t *)(index_reg + o);
+			const lane_vec m = vec_load((const uint8_t *)(mask_words + o));
+			lane_vec i = vec_load(i_row);
+			lane_vec value = ins.op == CHIP8_OP_ANNN ? nnn : vec_add16(i, vec_load_widen(vx_row + o));
+			vec_store(i_row, vec_select(m, value, i));
+		}
+	}
+	else
+	{
+		CHIP8_ALIGN(32) uint8_t mask_bytes[CHIP8_LOCKSTEP_MAX_LANES];
+		expand_mask(mask, mask_bytes);
+
+		// X or Y can be VF, so every write lands before the next read like the scalar handlers
+		for (int c = 0; c < LANE_VEC_CHUNKS; c++)
+		{
+			const int o = c * LANE_VEC_WIDTH;
+			const lane_vec m = vec_load(mask_bytes + o);
+			lane_vec vx = vec_load(vx_row + o);
+			lane_vec vy = vec_load(vy_row + o);
+
+			switch (ins.op)
+			{
+			case CHIP8_OP_6XNN:
+				vec_store(vx_row + o, vec_select(m, vec_set1(ins.NN), vx));
+				break;
+			case CHIP8_OP_7XNN:
+				vec_store(vx_row + o, vec_select(m, vec_add(vx, vec_set1(ins.NN)), vx));
+				break;
+			case CHIP8_OP_8XY0:
+				vec_store(vx_row + o, vec_select(m, vy, vx));
+				break;
+			case CHIP8_OP_8XY1:
+				vec_store(vx_row + o, vec_select(m, vec_or(vx, vy), vx));
+				break;
+			case CHIP8_OP_8XY2:
+				vec_store(vx_row + o, vec_select(m, vec_and(vx, vy), vx));
+				break;
+			case CHIP8_OP_8XY3:
+				vec_store(vx_row + o, vec_select(m, vec_xor(vx, vy), vx));
+				break;
+			case CHIP8_OP_8XY4:
+			{
+				// carried when the sum wrapped below VX
+				lane_vec sum = vec_add(vx, vy);
+				lane_vec no_carry = vec_cmpeq(vec_max(sum, vx), sum);
+				vec_store(vx_row + o, vec_select(m, sum, vx));
+				lane_vec vf = vec_load(vf_row + o);
+				vec_store(vf_row + o, vec_select(m, vec_and(vec_xor(no_carry, vec_set1(0xFF)), vec_set1(1)), vf));
+				break;
+			}
+			case CHIP8_OP_8XY5:
+			{
+				// VF = VX > VY
+				lane_vec not_greater = vec_cmpeq(vec_max(vx, vy), vy);
+				lane_vec vf = vec_load(vf_row + o);
+				vec_store(vf_row + o, vec_select(m, vec_and(vec_xor(not_greater, vec_set1(0xFF)), vec_set1(1)), vf));
+				vx = vec_load(vx_row + o);
+				vy = vec_load(vy_row + o);
+				vec_store(vx_row + o, vec_select(m, vec_sub(vx, vy), vx));
+				break;
+			}
+			case CHIP8_OP_8XY7:
+			{
+				// VF = VY >= VX
+				lane_vec not_less = vec_cmpeq(vec_max(vx, vy), vy);
+				lane_vec vf = vec_load(vf_row + o);
+				vec_store(vf_row + o, vec_select(m, vec_and(not_less, vec_set1(1)), vf));
+				vx = vec_load(vx_row + o);
+				vy = vec_load(vy_row + o);
+				vec_store(vx_row + o, vec_select(m, vec_sub(vy, vx), vx));
+				break;
+			}
+			case CHIP8_OP_8XY6:
+			case CHIP8_OP_8XYE:
+			{
+				if (shift_mode == AMBIG_8XY6_SHIFTMODE_SET_VX_TO_VY)
+				{
+					vec_store(vx_row + o, vec_select(m, vy, vx));
+					vx = vec_load(vx_row + o);
+				}
+				lane_vec vf = vec_load(vf_row + o);
+				lane_vec bit = ins.op == CHIP8_OP_8XY6 ? vec_and(vx, vec_set1(1)) : vec_shr7(vx);
+				vec_store(vf_row + o, vec_select(m, bit, vf));
+				vx = vec_load(vx_row + o);
+				vec_store(vx_row + o, vec_select(m, ins.op == CHIP8_OP_8XY6 ? vec_shr1(vx) : vec_add(vx, vx), vx));
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+
+	// the bookkeeping step() would have done, and the pc update
+	CHIP8_ALIGN(32) unsigned short taken_words[CHIP8_LOCKSTEP_MAX_LANES];
+	expand_mask16(taken, taken_words);
+
+	const lane_vec next = vec_set1_16(next_pc);
+	const lane_vec skip = vec_set1_16((unsigned short)(pc + 4));
+	const lane_vec op = vec_set1_16(ins.opcode);
+	for (int c = 0; c < LANE_VEC16_CHUNKS; c++)
+	{
+		const int o = c * LANE_VEC16_WIDTH;
+		uint8_t * pc_row = (uint8_t *)(prog_count + o);
+		uint8_t * op_row = (uint8_t *)(opcode + o);
+		uint8_t * last_row = (uint8_t *)(last_opcode + o);
+		const lane_vec m = vec_load((const uint8_t *)(mask_words + o));
+		lane_vec target = vec_select(vec_load((const uint8_t *)(taken_words + o)), skip, next);
+		lane_vec current = vec_load(op_row);
+		vec_store(pc_row, vec_select(m, target, vec_load(pc_row)));
+		vec_store(last_row, vec_select(m, current, vec_load(last_row)));
+		vec_store(op_row, vec_select(m, op, current));
+	}
+	vector_lane_ops += count_lanes(mask);
+}
+
+void Chip8Lockstep::exec_scalar(int lane, const chip8_instr & ins)
+{
+	// hand the lane's registers to its own Chip8 for one instruction, only what it uses
+	// goes across (worked out before it runs, it can write over its own decode)
+	Chip8 * c = lanes[lane];
+	uint16_t regs = scalar_regs(ins);
+	bool timers = ins.op == CHIP8_OP_FX07 || ins.op == CHIP8_OP_FX15 || ins.op == CHIP8_OP_FX18;
+	for (uint16_t r = regs; r; r &= r - 1)
+	{
+		int i = lowest_lane(r);
+		c->v_reg[i] = v_reg[i][lane];
+	}
+	if (timers)
+	{
+		c->delay_timer = delay_timer[lane];
+		c->sound_timer = sound_timer[lane];
+	}
+	c->index_reg = index_reg[lane];
+	c->prog_count = prog_count[lane];
+	c->system_ticks = system_ticks;
+
+	// the rest of step(), Run() already fetched it
+	c->last_opcode = opcode[lane];
+	c->opcode = ins.opcode;
+	c->execute_instr(ins);
+
+	for (uint16_t r = regs; r; r &= r - 1)
+	{
+		int i = lowest_lane(r);
+		v_reg[i][lane] = c->v_reg[i];
+	}
+	if (timers)
+	{
+		delay_timer[lane] = c->delay_timer;
+		sound_timer[lane] = c->sound_timer;
+	}
+	index_reg[lane] = c->index_reg;
+	prog_count[lane] = c->prog_count;
+	last_opcode[lane] = opcode[lane];
+	opcode[lane] = ins.opcode;
+
+	scalar_lane_ops++;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "chip8.h"
+
+// lockstep execution of many Chip8 machines
+// the CPU registers of every lane live here structure-of-arrays, one byte column per
+// V register, so when lanes hit the same ALU instruction (6XNN, 7XNN, 8XYN) it runs as
+// one SSE2/AVX2 operation across all of them, and jumps and skips (1NNN, 3XNN-9XY0) are a
+// vector compare and a vector pc update. each step the lanes are grouped by pc (a vector
+// compare against the lowest pending lane's), and only that lane's instruction is decoded
+// for the group, which is safe because lanes only share a group while their memory is
+// byte for byte the same. anything else runs through that lane's own Chip8 (which keeps
+// its memory, screen, stack and keys) one instruction at a time, with only the V
+// registers it uses copied across
+
+#define CHIP8_LOCKSTEP_MAX_LANES 32
+
+#if defined(_MSC_VER)
+#define CHIP8_ALIGN(n) __declspec(align(n))
+#else
+#define CHIP8_ALIGN(n) __attribute__((aligned(n)))
+#endif
+
+class Chip8Lockstep
+{
+public:
+	// lanes is 1 - CHIP8_LOCKSTEP_MAX_LANES, 8, 16 and 32 are the sizes that map onto vectors
+	Chip8Lockstep(int lanes);
+	~Chip8Lockstep();
+
+	Chip8Lockstep(const Chip8Lockstep &) = delete;
+	Chip8Lockstep & operator=(const Chip8Lockstep &) = delete;
+
+	int GetLaneCount();
+
+	// set lanes up (load roms, quirks, keys) through their Chip8 then call SyncFromLanes()
+	Chip8 * GetLane(int lane);
+	void SyncFromLanes();
+	// copies the registers back into each lane's Chip8 so it can be inspected
+	void SyncToLanes();
+
+	// every lane runs count instructions
+	long long Run(long long count);
+
+	// how many lane-instructions went down each path
+	long long GetVectorLaneOps();
+	long long GetScalarLaneOps();
+
+private:
+	bool is_vectorizable(uint8_t op);
+	uint32_t lanes_at(unsigned short pc);
+	void exec_vector(const chip8_instr & ins, unsigned short pc, uint32_t mask);
+	void exec_scalar(int lane, const chip8_instr & ins);
+	void split_code_groups(uint32_t writers, const unsigned short * address, int length);
+	uint32_t advance_timers(uint32_t steps);
+	uint32_t steps_until_tick();
+
+private:
+	int lane_count;
+	uint32_t lane_mask;
+
+	Chip8 * lanes[CHIP8_LOCKSTEP_MAX_LANES];
+
+	// structure of arrays register file, v_reg[register][lane]
+	CHIP8_ALIGN(32) uint8_t v_reg[CHIP8_TOTAL_V_REGS][CHIP8_LOCKSTEP_MAX_LANES];
+	CHIP8_ALIGN(32) uint8_t delay_timer[CHIP8_LOCKSTEP_MAX_LANES];
+	CHIP8_ALIGN(32) uint8_t sound_timer[CHIP8_LOCKSTEP_MAX_LANES];
+	// each lane's clock, so its timers tick at 60hz of its own emulated time. the phases
+	// are only brought up to date when some lane's timers are due, or at the end of Run()
+	CHIP8_ALIGN(32) uint32_t cpu_hz[CHIP8_LOCKSTEP_MAX_LANES];
+	CHIP8_ALIGN(32) uint32_t timer_phase[CHIP8_LOCKSTEP_MAX_LANES];
+	// all ones for the lanes in use, so the unused ones never come due
+	CHIP8_ALIGN(32) uint32_t lane_words[CHIP8_LOCKSTEP_MAX_LANES];
+	CHIP8_ALIGN(32) unsigned short index_reg[CHIP8_LOCKSTEP_MAX_LANES];
+	CHIP8_ALIGN(32) unsigned short prog_count[CHIP8_LOCKSTEP_MAX_LANES];
+	CHIP8_ALIGN(32) unsigned short opcode[CHIP8_LOCKSTEP_MAX_LANES];
+	CHIP8_ALIGN(32) unsigned short last_opcode[CHIP8_LOCKSTEP_MAX_LANES];
+
+	// the lanes whose memory is identical to this one's (itself included), the only
+	// lanes it can share a decoded instruction with
+	uint32_t code_group[CHIP8_LOCKSTEP_MAX_LANES];
+
+	// every lane steps together so they all share one tick count
+	long long system_ticks;
+
+	// 8XY6/8XYE only vectorize when every lane agrees on the shift quirk
+	bool uniform_shift_mode;
+	bool shift_mode;
+
+	long long vector_lane_ops;
+	long long scalar_lane_ops;
+};
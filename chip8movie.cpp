@@ -0,0 +1,291 @@
+#include "chip8movie.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CHIP8_MOVIE_KEY_BITS 4
+#define CHIP8_MOVIE_PRESSED_BIT 0x10
+#define CHIP8_MOVIE_DELTA_SHIFT 5
+// longest a 64 bit LEB128 varint gets
+#define CHIP8_MOVIE_MAX_VARINT 10
+
+Chip8Movie::Chip8Movie()
+{
+	Clear();
+}
+
+void Chip8Movie::Clear()
+{
+	mode = CHIP8_MOVIE_IDLE;
+	memset(&header, 0, sizeof(header));
+	header.magic = CHIP8_MOVIE_MAGIC;
+	header.version = CHIP8_MOVIE_VERSION;
+	inputs.clear();
+	next_input = 0;
+}
+
+void Chip8Movie::BeginRecording(Chip8 * chip8)
+{
+	Clear();
+
+	chip8->Reset();
+	header.boot_hash = HashMemory(chip8);
+	header.cpu_hz = chip8->GetCPUFrequency();
+	header.random_seed = chip8->GetRandomSeed();
+	if (chip8->GetConfig_8XY6_8XYE_VY_mode()) header.flags |= CHIP8_MOVIE_FLAG_8XY6;
+	if (chip8->GetConfig_BNNN_ADD_mode()) header.flags |= CHIP8_MOVIE_FLAG_BNNN;
+	if (chip8->GetConfig_FX55_FX65_VY_mode()) header.flags |= CHIP8_MOVIE_FLAG_FX55;
+
+	mode = CHIP8_MOVIE_RECORDING;
+}
+
+void Chip8Movie::RecordKey(Chip8 * chip8, uint8_t key, bool pressed)
+{
+	if (mode != CHIP8_MOVIE_RECORDING || key >= CHIP8_INPUT_KEYS)
+	{
+		return;
+	}
+
+	chip8_batch_input input;
+	input.at = chip8->GetInstructionCount();
+	input.key = key;
+	input.pressed = pressed;
+	inputs.push_back(input);
+}
+
+void Chip8Movie::EndRecording(Chip8 * chip8)
+{
+	if (mode != CHIP8_MOVIE_RECORDING)
+	{
+		return;
+	}
+
+	header.length = chip8->GetInstructionCount();
+	header.input_count = (uint32_t)inputs.size();
+	mode = CHIP8_MOVIE_IDLE;
+}
+
+bool Chip8Movie::BeginPlayback(Chip8 * chip8)
+{
+	apply_settings(chip8);
+	chip8->Reset();
+	if (HashMemory(chip8) != header.boot_hash)
+	{
+		mode = CHIP8_MOVIE_IDLE;
+		return false;
+	}
+
+	next_input = 0;
+	mode = CHIP8_MOVIE_PLAYING;
+	return true;
+}
+
+long long Chip8Movie::Play(Chip8 * chip8, long long count)
+{
+	if (mode != CHIP8_MOVIE_PLAYING)
+	{
+		return chip8->Run(count);
+	}
+
+	// run up to each key change, apply it, carry on
+	long long done = 0;
+	while (done < count)
+	{
+		long long now = chip8->GetInstructionCount();
+		while (next_input < inputs.size() && inputs[next_input].at <= now)
+		{
+			chip8->SetKey(inputs[next_input].key, inputs[next_input].pressed);
+			next_input++;
+		}
+
+		long long run = count - done;
+		if (next_input < inputs.size() && inputs[next_input].at - now < run)
+		{
+			run = inputs[next_input].at - now;
+		}
+
+		done += chip8->Run(run);
+	}
+
+	if (next_input >= inputs.size() && chip8->GetInstructionCount() >= header.length)
+	{
+		mode = CHIP8_MOVIE_IDLE;
+	}
+
+	return done;
+}
+
+void Chip8Movie::EndPlayback()
+{
+	if (mode == CHIP8_MOVIE_PLAYING)
+	{
+		mode = CHIP8_MOVIE_IDLE;
+	}
+}
+
+void Chip8Movie::Truncate(long long instruction)
+{
+	while (!inputs.empty() && inputs.back().at > instruction)
+	{
+		inputs.pop_back();
+	}
+	if (next_input > inputs.size())
+	{
+		next_input = inputs.size();
+	}
+	header.input_count = (uint32_t)inputs.size();
+	if (header.length > instruction)
+	{
+		header.length = instruction;
+	}
+}
+
+void Chip8Movie::Seek(long long instruction)
+{
+	next_input = 0;
+	while (next_input < inputs.size() && inputs[next_input].at < instruction)
+	{
+		next_input++;
+	}
+}
+
+uint8_t Chip8Movie::GetMode()
+{
+	return mode;
+}
+
+long long Chip8Movie::GetLength()
+{
+	return header.length;
+}
+
+int Chip8Movie::GetInputCount()
+{
+	return (int)inputs.size();
+}
+
+const chip8_batch_input * Chip8Movie::GetInputs()
+{
+	return inputs.data();
+}
+
+uint32_t Chip8Movie::GetCPUFrequency()
+{
+	return header.cpu_hz;
+}
+
+uint8_t Chip8Movie::GetQuirkFlags()
+{
+	return header.flags;
+}
+
+uint64_t Chip8Movie::GetRandomSeed()
+{
+	return header.random_seed;
+}
+
+bool Chip8Movie::SaveToFile(const char * path)
+{
+	FILE * fp = fopen(path, "wb");
+	if (!fp)
+	{
+		return false;
+	}
+
+	header.input_count = (uint32_t)inputs.size();
+	bool success = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+	long long last = 0;
+	for (size_t i = 0; i < inputs.size() && success; i++)
+	{
+		uint64_t value = ((uint64_t)(inputs[i].at - last) << CHIP8_MOVIE_DELTA_SHIFT) |
+			(inputs[i].pressed ? CHIP8_MOVIE_PRESSED_BIT : 0) | inputs[i].key;
+		last = inputs[i].at;
+
+		uint8_t bytes[CHIP8_MOVIE_MAX_VARINT];
+		int length = 0;
+		do
+		{
+			bytes[length] = value & 0x7F;
+			value >>= 7;
+			if (value) bytes[length] |= 0x80;
+			length++;
+		} while (value);
+
+		success = fwrite(bytes, 1, length, fp) == (size_t)length;
+	}
+
+	fclose(fp);
+	return success;
+}
+
+bool Chip8Movie::LoadFromFile(const char * path)
+{
+	Clear();
+
+	FILE * fp = fopen(path, "rb");
+	if (!fp)
+	{
+		return false;
+	}
+
+	bool success = fread(&header, sizeof(header), 1, fp) == 1 &&
+		header.magic == CHIP8_MOVIE_MAGIC && header.version == CHIP8_MOVIE_VERSION &&
+		header.cpu_hz >= CHIP8_MIN_CPU_HZ && header.cpu_hz <= CHIP8_MAX_CPU_HZ && header.length >= 0;
+
+	long long last = 0;
+	for (uint32_t i = 0; i < header.input_count && success; i++)
+	{
+		uint64_t value = 0;
+		int shift = 0;
+		int c;
+		do
+		{
+			c = fgetc(fp);
+			if (c == EOF || shift >= 64)
+			{
+				success = false;
+				break;
+			}
+			value |= (uint64_t)(c & 0x7F) << shift;
+			shift += 7;
+		} while (c & 0x80);
+
+		chip8_batch_input input;
+		input.at = last + (long long)(value >> CHIP8_MOVIE_DELTA_SHIFT);
+		input.key = value & ((1 << CHIP8_MOVIE_KEY_BITS) - 1);
+		input.pressed = (value & CHIP8_MOVIE_PRESSED_BIT) != 0;
+		last = input.at;
+		inputs.push_back(input);
+	}
+
+	fclose(fp);
+
+	if (!success)
+	{
+		Clear();
+	}
+	return success;
+}
+
+uint64_t Chip8Movie::HashMemory(Chip8 * chip8)
+{
+	const uint8_t * memory = chip8->GetMemory();
+	long size = chip8->GetMemorySize();
+
+	uint64_t hash = 14695981039346656037ULL;
+	for (long i = 0; i < size; i++)
+	{
+		hash ^= memory[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+void Chip8Movie::apply_settings(Chip8 * chip8)
+{
+	chip8->SetCPUFrequency(header.cpu_hz);
+	chip8->SetConfig_8XY6_8XYE_VY_mode((header.flags & CHIP8_MOVIE_FLAG_8XY6) != 0);
+	chip8->SetConfig_BNNN_ADD_mode((header.flags & CHIP8_MOVIE_FLAG_BNNN) != 0);
+	chip8->SetConfig_FX55_FX65_VY_mode((header.flags & CHIP8_MOVIE_FLAG_FX55) != 0);
+	chip8->SetRandomSeed(header.random_seed);
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "chip8.h"
+#include "chip8batch.h"
+#include <vector>
+
+// input movies
+// a movie is every key change made during a run, keyed by how many instructions had run
+// since the reset it started from, plus what it needs to start the same way: a hash of
+// memory right after that reset (rom + font) and the settings that change what the rom
+// does (cpu frequency, quirks, the cxnn seed). the generator restarts from that seed on
+// the reset, so feeding the keys back at the same counts reproduces the run exactly, on
+// any core, in the app or headless. changing settings part way through a recording isn't
+// captured
+//
+// on disk it's a chip8_movie_header then one record per key change: a LEB128 varint of
+// (instructions since the previous change << 5) | (pressed << 4) | key, so a
+// typical press is 2 or 3 bytes
+
+#define CHIP8_MOVIE_MAGIC 0x564D4843 // "CHMV"
+#define CHIP8_MOVIE_VERSION 2
+
+#define CHIP8_MOVIE_FLAG_8XY6 0x01
+#define CHIP8_MOVIE_FLAG_BNNN 0x02
+#define CHIP8_MOVIE_FLAG_FX55 0x04
+
+#define CHIP8_MOVIE_IDLE 0
+#define CHIP8_MOVIE_RECORDING 1
+#define CHIP8_MOVIE_PLAYING 2
+
+struct chip8_movie_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t boot_hash;
+	uint32_t cpu_hz;
+	uint8_t flags; // CHIP8_MOVIE_FLAG_ quirk bits
+	uint8_t reserved[3];
+	int64_t length; // instructions
+	uint32_t input_count;
+	uint32_t reserved2;
+	uint64_t random_seed;
+};
+
+class Chip8Movie
+{
+public:
+	Chip8Movie();
+
+	void Clear();
+
+	// resets chip8 and starts capturing from there
+	void BeginRecording(Chip8 * chip8);
+	// call with the key change just before chip8 sees it
+	void RecordKey(Chip8 * chip8, uint8_t key, bool pressed);
+	// the movie ends at however far chip8 has got
+	void EndRecording(Chip8 * chip8);
+
+	// applies the movie's settings and resets chip8. false if chip8 doesn't boot into the
+	// same memory the movie was recorded on (a different rom)
+	bool BeginPlayback(Chip8 * chip8);
+	// runs count instructions, feeding in each key change at the instruction it was
+	// recorded at. once past the end it carries on running without input
+	long long Play(Chip8 * chip8, long long count);
+	void EndPlayback();
+
+	// drops every key change after instruction, for carrying on recording after a rewind
+	void Truncate(long long instruction);
+	// carries on playing from instruction, after a rewind. the keys held at that point
+	// come back with the snapshot
+	void Seek(long long instruction);
+
+	uint8_t GetMode();
+	long long GetLength();
+	int GetInputCount();
+	// the key changes in the shape a chip8_batch_job takes
+	const chip8_batch_input * GetInputs();
+	// settings from the header, for setting up a batch job
+	uint32_t GetCPUFrequency();
+	uint8_t GetQuirkFlags();
+	uint64_t GetRandomSeed();
+
+	bool SaveToFile(const char * path);
+	bool LoadFromFile(const char * path);
+
+	// FNV-1a of all of memory, after a reset it identifies the rom
+	static uint64_t HashMemory(Chip8 * chip8);
+
+private:
+	void apply_settings(Chip8 * chip8);
+
+private:
+	uint8_t mode;
+	chip8_movie_header header;
+	std::vector<chip8_batch_input> inputs;
+	size_t next_input;
+};
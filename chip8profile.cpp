@@ -0,0 +1,84 @@
+#include "chip8profile.h"
+#include <string.h>
+#include <algorithm>
+
+Chip8Profile::Chip8Profile()
+{
+	Clear();
+}
+
+void Chip8Profile::Clear()
+{
+	memset(op_counts, 0, sizeof(op_counts));
+	memset(op_sample_ns, 0, sizeof(op_sample_ns));
+	memset(op_samples, 0, sizeof(op_samples));
+	memset(address_counts, 0, sizeof(address_counts));
+	total = 0;
+
+	sample_countdown = CHIP8_PROFILE_SAMPLE_INTERVAL;
+	sample_rng = 1;
+}
+
+uint64_t Chip8Profile::GetTotal()
+{
+	return total;
+}
+
+uint64_t Chip8Profile::GetOpCount(uint8_t op)
+{
+	return op < CHIP8_PROFILE_MAX_OPS ? op_counts[op] : 0;
+}
+
+double Chip8Profile::GetOpAverageNs(uint8_t op)
+{
+	if (op >= CHIP8_PROFILE_MAX_OPS || op_samples[op] == 0)
+	{
+		return 0.0;
+	}
+	return (double)op_sample_ns[op] / op_samples[op];
+}
+
+double Chip8Profile::GetOpEstimatedNs(uint8_t op)
+{
+	return GetOpAverageNs(op) * GetOpCount(op);
+}
+
+uint64_t Chip8Profile::GetAddressCount(uint16_t address)
+{
+	return address_counts[address & (CHIP8_PROFILE_ADDRESSES - 1)];
+}
+
+uint64_t Chip8Profile::GetMaxAddressCount()
+{
+	uint64_t max = 0;
+	for (int i = 0; i < CHIP8_PROFILE_ADDRESSES; i++)
+	{
+		if (address_counts[i] > max)
+		{
+			max = address_counts[i];
+		}
+	}
+	return max;
+}
+
+int Chip8Profile::GetHottest(uint16_t * addresses, int max)
+{
+	uint16_t order[CHIP8_PROFILE_ADDRESSES];
+	int found = 0;
+	for (int i = 0; i < CHIP8_PROFILE_ADDRESSES; i++)
+	{
+		if (address_counts[i])
+		{
+			order[found++] = (uint16_t)i;
+		}
+	}
+
+	int count = found < max ? found : max;
+	std::partial_sort(order, order + count, order + found, [this](uint16_t a, uint16_t b)
+	{
+		return address_counts[a] > address_counts[b] || (address_counts[a] == address_counts[b] && a < b);
+	});
+
+	memcpy(addresses, order, count * sizeof(uint16_t));
+	return count;
+}
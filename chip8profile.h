@@ -0,0 +1,74 @@
+#pragma once
+#include <stdint.h>
+
+// execution profile for the Chip8 core
+// counts every executed instruction per decoded op (chip8_op) and per address, and times
+// about one instruction in every CHIP8_PROFILE_SAMPLE_INTERVAL to estimate where the host
+// time goes. it's only allocated and only touched while profiling is on, with it off the
+// cores don't check for it at all
+
+// big enough for every chip8_op
+#define CHIP8_PROFILE_MAX_OPS 64
+// one counter per byte of chip8 memory, jumps can land on odd addresses
+#define CHIP8_PROFILE_ADDRESSES 4096
+
+// average, must be a power of two
+#define CHIP8_PROFILE_SAMPLE_INTERVAL 64
+
+class Chip8Profile
+{
+public:
+	Chip8Profile();
+
+	void Count(uint8_t op, uint16_t pc)
+	{
+		op_counts[op]++;
+		address_counts[pc & (CHIP8_PROFILE_ADDRESSES - 1)]++;
+		total++;
+	}
+
+	// true when the next instruction should be timed. the gap is jittered, a fixed one
+	// would keep landing on the same instructions of any loop whose length divides it
+	bool SampleDue()
+	{
+		if (--sample_countdown)
+		{
+			return false;
+		}
+		sample_rng = sample_rng * 1664525u + 1013904223u;
+		sample_countdown = CHIP8_PROFILE_SAMPLE_INTERVAL / 2 + ((sample_rng >> 16) & (CHIP8_PROFILE_SAMPLE_INTERVAL - 1));
+		return true;
+	}
+
+	void Sample(uint8_t op, uint64_t nanoseconds)
+	{
+		op_sample_ns[op] += nanoseconds;
+		op_samples[op]++;
+	}
+
+	void Clear();
+
+	// instructions counted since the last Clear()
+	uint64_t GetTotal();
+	uint64_t GetOpCount(uint8_t op);
+	// average of the sampled runs of op, 0 if it never got sampled
+	double GetOpAverageNs(uint8_t op);
+	// average * count, what op is estimated to have cost in total
+	double GetOpEstimatedNs(uint8_t op);
+	uint64_t GetAddressCount(uint16_t address);
+	uint64_t GetMaxAddressCount();
+
+	// fills addresses with up to max of the most executed addresses, hottest first,
+	// returns how many it found
+	int GetHottest(uint16_t * addresses, int max);
+
+private:
+	uint64_t op_counts[CHIP8_PROFILE_MAX_OPS];
+	uint64_t op_sample_ns[CHIP8_PROFILE_MAX_OPS];
+	uint64_t op_samples[CHIP8_PROFILE_MAX_OPS];
+	uint64_t address_counts[CHIP8_PROFILE_ADDRESSES];
+	uint64_t total;
+
+	uint32_t sample_countdown;
+	uint32_t sample_rng;
+};
@@ -0,0 +1,215 @@
+#include "chip8quirks.h"
+#include <math.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// score weights. the screen can earn at most 1.5, a single fault costs 2, so a fork that ran
+// clean always beats one that didn't and the screen only decides between healthy forks
+#define CHIP8_QUIRKS_FAULT_WEIGHT 2.0f
+#define CHIP8_QUIRKS_STRAY_WEIGHT 2.0f
+#define CHIP8_QUIRKS_CHANGE_WEIGHT 0.5f
+
+static int count_bits(uint64_t v)
+{
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((v * 0x0101010101010101ULL) >> 56);
+}
+
+static uint64_t hash_step(uint64_t hash, uint64_t value)
+{
+	hash ^= value;
+	hash *= 1099511628211ULL;
+	return hash;
+}
+
+Chip8QuirkDetect::Chip8QuirkDetect(int threads)
+{
+	if (threads <= 0)
+	{
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	thread_count = threads < 1 ? 1 : (threads > CHIP8_QUIRK_POLICIES ? CHIP8_QUIRK_POLICIES : threads);
+
+	cpu_hz = CHIP8_DEFAULT_CPU_HZ;
+	seed = CHIP8_DEFAULT_RANDOM_SEED;
+	best = 0;
+	memset(candidates, 0, sizeof(candidates));
+}
+
+bool Chip8QuirkDetect::Run(Chip8 * chip8, long long frames)
+{
+	rom = chip8->GetROMImage();
+	if (!rom)
+	{
+		return false;
+	}
+	cpu_hz = chip8->GetCPUFrequency();
+	seed = chip8->GetRandomSeed();
+
+	int current = chip8->GetQuirkPolicy();
+
+	// every fork shares the one rom image, each worker reuses its Chip8 between forks
+	std::atomic<int> next(0);
+	auto worker = [&]()
+	{
+		Chip8 * fork = new Chip8();
+		for (int i = next++; i < CHIP8_QUIRK_POLICIES; i = next++)
+		{
+			candidates[i].combination = (uint8_t)i;
+			run_candidate(fork, candidates[i], frames);
+		}
+		delete fork;
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < thread_count; t++)
+	{
+		workers.emplace_back(worker);
+	}
+	worker();
+	for (std::thread & t : workers)
+	{
+		t.join();
+	}
+
+	best = current;
+	for (int i = 0; i < CHIP8_QUIRK_POLICIES; i++)
+	{
+		if (candidates[i].score > candidates[best].score)
+		{
+			best = i;
+		}
+	}
+	return true;
+}
+
+void Chip8QuirkDetect::run_candidate(Chip8 * chip8, chip8_quirk_candidate & candidate, long long frames)
+{
+	chip8->SetQuirkPolicy(candidate.combination);
+	chip8->SetCPUFrequency(cpu_hz);
+	chip8->SetRandomSeed(seed);
+	chip8->LoadROMImage(rom);
+	chip8->Reset();
+
+	int rom_end = CHIP8_WORK_MEM_START + rom->GetSize();
+	uint64_t signature = 14695981039346656037ULL;
+	uint64_t last_screen = chip8->GetScreenHash();
+	double entropy = 0.0;
+	uint8_t held = 0xFF;
+
+	candidate.stray_frames = 0;
+	candidate.distinct_frames = 0;
+
+	for (long long f = 0; f < frames; f++)
+	{
+		long long phase = f % CHIP8_QUIRKS_KEY_PERIOD;
+		if (phase == 0)
+		{
+			held = (uint8_t)((f / CHIP8_QUIRKS_KEY_PERIOD) % CHIP8_INPUT_KEYS);
+			chip8->SetKey(held, true);
+		}
+		else if (phase == CHIP8_QUIRKS_KEY_PERIOD / 2)
+		{
+			chip8->SetKey(held, false);
+		}
+
+		chip8->RunFrame();
+
+		// code is allowed anywhere in ram, but a pc outside the rom usually means it
+		// jumped somewhere it shouldn't have
+		int pc = (unsigned short)chip8->GetProgCount();
+		if (pc < CHIP8_WORK_MEM_START || pc >= rom_end)
+		{
+			candidate.stray_frames++;
+		}
+
+		uint64_t screen = chip8->GetScreenHash();
+		if (screen != last_screen)
+		{
+			candidate.distinct_frames++;
+			last_screen = screen;
+		}
+		signature = hash_step(signature, screen);
+
+		// whatever isn't on screen at this resolution is blank
+		int lit = 0;
+		const uint64_t * rows = chip8->GetScreenRows();
+		for (int i = 0; i < CHIP8_HIRES_HEIGHT * CHIP8_SCREEN_ROW_WORDS; i++)
+		{
+			lit += count_bits(rows[i]);
+		}
+		double p = (double)lit / (chip8->GetScreenWidth() * chip8->GetScreenHeight());
+		if (p > 0.0 && p < 1.0)
+		{
+			entropy += -p * log2(p) - (1.0 - p) * log2(1.0 - p);
+		}
+	}
+
+	const uint8_t * v = chip8->GetVRegs();
+	for (int i = 0; i < CHIP8_TOTAL_V_REGS; i++)
+	{
+		signature = hash_step(signature, v[i]);
+	}
+	signature = hash_step(signature, (unsigned short)chip8->GetProgCount());
+	signature = hash_step(signature, (unsigned short)chip8->GetIndexRef());
+
+	candidate.unknown_opcodes = chip8->GetErrorCount(CHIP8_TRACE_EVENT_UNKNOWN_OPCODE) + chip8->GetErrorCount(CHIP8_TRACE_EVENT_NULL_OPCODE);
+	candidate.stack_faults = chip8->GetErrorCount(CHIP8_TRACE_EVENT_STACK_OVERFLOW) + chip8->GetErrorCount(CHIP8_TRACE_EVENT_STACK_UNDERFLOW);
+	candidate.entropy = frames > 0 ? (float)(entropy / frames) : 0.0f;
+	candidate.signature = signature;
+
+	float changes = frames > 0 ? (float)candidate.distinct_frames / frames : 0.0f;
+	float stray = frames > 0 ? (float)candidate.stray_frames / frames : 0.0f;
+	candidate.score = candidate.entropy + CHIP8_QUIRKS_CHANGE_WEIGHT * changes -
+		CHIP8_QUIRKS_FAULT_WEIGHT * log2f(1.0f + candidate.unknown_opcodes + candidate.stack_faults) -
+		CHIP8_QUIRKS_STRAY_WEIGHT * stray;
+}
+
+const chip8_quirk_candidate & Chip8QuirkDetect::GetCandidate(int combination)
+{
+	return candidates[combination & (CHIP8_QUIRK_POLICIES - 1)];
+}
+
+int Chip8QuirkDetect::GetBest()
+{
+	return best;
+}
+
+chip8_rom_profile Chip8QuirkDetect::GetProfile()
+{
+	chip8_rom_profile profile = Chip8ROMDatabase::MakeProfile();
+	int8_t * modes[3] = { &profile.quirk_8xy6, &profile.quirk_bnnn, &profile.quirk_fx55 };
+
+	for (int m = 0; m < 3; m++)
+	{
+		// a mode matters if flipping it changed any run
+		int bit = 1 << m;
+		bool matters = false;
+		for (int i = 0; i < CHIP8_QUIRK_POLICIES; i++)
+		{
+			if (candidates[i].signature != candidates[i ^ bit].signature)
+			{
+				matters = true;
+				break;
+			}
+		}
+
+		if (matters)
+		{
+			*modes[m] = (best & bit) != 0;
+		}
+	}
+	return profile;
+}
+
+void Chip8QuirkDetect::Apply(Chip8 * chip8)
+{
+	chip8_rom_profile profile = GetProfile();
+	if (profile.quirk_8xy6 >= 0) chip8->SetConfig_8XY6_8XYE_VY_mode(profile.quirk_8xy6 != 0);
+	if (profile.quirk_bnnn >= 0) chip8->SetConfig_BNNN_ADD_mode(profile.quirk_bnnn != 0);
+	if (profile.quirk_fx55 >= 0) chip8->SetConfig_FX55_FX65_VY_mode(profile.quirk_fx55 != 0);
+}
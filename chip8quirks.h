@@ -0,0 +1,62 @@
+#pragma once
+#include "chip8.h"
+#include "chip8romdb.h"
+
+// quirk detection
+// forks a rom into all 8 combinations of the 8XY6/8XYE, BNNN and FX55/FX65 modes, runs
+// every fork for the same number of frames with the same scripted key presses, in parallel,
+// and ranks them: unknown opcodes, stack faults and the pc wandering out of the rom count
+// against a fork, a screen that's neither blank nor solid and keeps changing counts for it.
+// a mode that made no difference to any run is left unset in the detected profile
+
+// 30 seconds of emulated time
+#define CHIP8_QUIRKS_DEFAULT_FRAMES 1800
+
+// the key script, key (frame / period) % 16 is held for the first half of each period so
+// roms waiting on input get past their title screens
+#define CHIP8_QUIRKS_KEY_PERIOD 20
+
+struct chip8_quirk_candidate
+{
+	uint8_t combination; // a quirk policy, CHIP8_QUIRK_* bits
+	// what went wrong
+	uint32_t unknown_opcodes; // 0000 included
+	uint32_t stack_faults;
+	uint32_t stray_frames; // frames that ended with the pc outside the rom
+	// what it drew
+	uint32_t distinct_frames; // frames whose screen differed from the one before
+	float entropy; // mean over frames of the lit pixel entropy, 0 blank or solid, 1 half lit
+	// the screen every frame and the final registers, equal signatures ran the same
+	uint64_t signature;
+	float score;
+};
+
+class Chip8QuirkDetect
+{
+public:
+	// 0 threads = one per hardware thread, no more than one per combination
+	Chip8QuirkDetect(int threads = 0);
+
+	// forks chip8's rom, clock and seed, chip8 itself isn't touched. false if no rom
+	bool Run(Chip8 * chip8, long long frames = CHIP8_QUIRKS_DEFAULT_FRAMES);
+
+	// by combination, valid after Run()
+	const chip8_quirk_candidate & GetCandidate(int combination);
+	// highest score, ties go to the modes chip8 already had
+	int GetBest();
+	// the best combination, with modes that made no difference left at -1
+	chip8_rom_profile GetProfile();
+	// sets chip8's modes to the best combination, the ones that made no difference are left
+	void Apply(Chip8 * chip8);
+
+private:
+	void run_candidate(Chip8 * chip8, chip8_quirk_candidate & candidate, long long frames);
+
+private:
+	int thread_count;
+	std::shared_ptr<const Chip8ROMImage> rom;
+	uint32_t cpu_hz;
+	uint64_t seed;
+	int best;
+	chip8_quirk_candidate candidates[CHIP8_QUIRK_POLICIES];
+};
@@ -0,0 +1,243 @@
+#include "chip8rewind.h"
+#include <string.h>
+
+// smallest a delta can be, the mask plus the register chunk that changes every frame
+#define CHIP8_REWIND_MIN_RECORD (CHIP8_REWIND_MASK_WORDS * 8 + CHIP8_REWIND_CHUNK)
+
+Chip8Rewind::Chip8Rewind(long budget, int keyframe_interval)
+{
+	if (budget < CHIP8_REWIND_MIN_BUDGET) budget = CHIP8_REWIND_MIN_BUDGET;
+	if (keyframe_interval < 1) keyframe_interval = 1;
+	if (keyframe_interval > 0xFFFF) keyframe_interval = 0xFFFF;
+
+	data_size = budget;
+	data = new uint8_t[data_size];
+
+	frame_capacity = budget / CHIP8_REWIND_MIN_RECORD;
+	frames = new rewind_frame[frame_capacity];
+
+	this->keyframe_interval = keyframe_interval;
+
+	Clear();
+}
+
+Chip8Rewind::~Chip8Rewind()
+{
+	delete[] data;
+	delete[] frames;
+}
+
+void Chip8Rewind::Clear()
+{
+	head = 0;
+	used = 0;
+	first_frame = 0;
+	end_frame = 0;
+	last_keyframe = -1;
+	memset(key_state, 0, sizeof(key_state));
+	memset(scratch, 0, sizeof(scratch));
+}
+
+void Chip8Rewind::Record(Chip8 * chip8)
+{
+	chip8->SaveState(scratch, CHIP8_SAVESTATE_SIZE);
+
+	long long frame = end_frame;
+	bool keyframe = last_keyframe < first_frame || frame - last_keyframe >= keyframe_interval;
+
+	if (!keyframe)
+	{
+		uint64_t mask[CHIP8_REWIND_MASK_WORDS] = {};
+		int dirty = 0;
+		for (int i = 0; i < CHIP8_REWIND_CHUNKS; i++)
+		{
+			int offset = i * CHIP8_REWIND_CHUNK;
+			if (memcmp(scratch + offset, key_state + offset, CHIP8_REWIND_CHUNK) != 0)
+			{
+				mask[i / 64] |= 1ull << (i % 64);
+				dirty++;
+			}
+		}
+
+		long size = sizeof(mask) + dirty * CHIP8_REWIND_CHUNK;
+		long offset = alloc_record(size);
+
+		// making room ate the keyframe this was going to be a delta of
+		if (last_keyframe < first_frame)
+		{
+			head = offset;
+			keyframe = true;
+		}
+		else
+		{
+			uint8_t * out = data + offset;
+			memcpy(out, mask, sizeof(mask));
+			out += sizeof(mask);
+			for (int i = 0; i < CHIP8_REWIND_CHUNKS; i++)
+			{
+				if (mask[i / 64] & (1ull << (i % 64)))
+				{
+					memcpy(out, scratch + i * CHIP8_REWIND_CHUNK, CHIP8_REWIND_CHUNK);
+					out += CHIP8_REWIND_CHUNK;
+				}
+			}
+
+			rewind_frame & f = get_frame(frame);
+			f.offset = (uint32_t)offset;
+			f.size = (uint16_t)size;
+			f.keyframe_distance = (uint16_t)(frame - last_keyframe);
+		}
+	}
+
+	if (keyframe)
+	{
+		long offset = alloc_record(CHIP8_REWIND_STATE_SIZE);
+		memcpy(data + offset, scratch, CHIP8_REWIND_STATE_SIZE);
+		memcpy(key_state, scratch, CHIP8_REWIND_STATE_SIZE);
+		last_keyframe = frame;
+
+		rewind_frame & f = get_frame(frame);
+		f.offset = (uint32_t)offset;
+		f.size = (uint16_t)CHIP8_REWIND_STATE_SIZE;
+		f.keyframe_distance = 0;
+	}
+
+	used += get_frame(frame).size;
+	end_frame++;
+}
+
+long long Chip8Rewind::GetFirstFrame()
+{
+	return first_frame;
+}
+
+long long Chip8Rewind::GetLastFrame()
+{
+	return end_frame - 1;
+}
+
+long long Chip8Rewind::GetFrameCount()
+{
+	return end_frame - first_frame;
+}
+
+bool Chip8Rewind::Seek(long long frame, Chip8 * chip8)
+{
+	if (frame < first_frame || frame >= end_frame)
+	{
+		return false;
+	}
+
+	rewind_frame & f = get_frame(frame);
+	const uint8_t * key = data + get_frame(frame - f.keyframe_distance).offset;
+	if (f.keyframe_distance == 0)
+	{
+		return chip8->LoadState(key, CHIP8_SAVESTATE_SIZE);
+	}
+
+	// keyframe, then the chunks this frame changed on top
+	memcpy(scratch, key, CHIP8_REWIND_STATE_SIZE);
+
+	uint64_t mask[CHIP8_REWIND_MASK_WORDS];
+	const uint8_t * in = data + f.offset;
+	memcpy(mask, in, sizeof(mask));
+	in += sizeof(mask);
+	for (int i = 0; i < CHIP8_REWIND_CHUNKS; i++)
+	{
+		if (mask[i / 64] & (1ull << (i % 64)))
+		{
+			memcpy(scratch + i * CHIP8_REWIND_CHUNK, in, CHIP8_REWIND_CHUNK);
+			in += CHIP8_REWIND_CHUNK;
+		}
+	}
+
+	return chip8->LoadState(scratch, CHIP8_SAVESTATE_SIZE);
+}
+
+void Chip8Rewind::Truncate(long long frame)
+{
+	if (frame < first_frame)
+	{
+		Clear();
+		return;
+	}
+	if (end_frame == first_frame)
+	{
+		// nothing recorded, so no last frame to carry on from
+		return;
+	}
+
+	while (end_frame > frame + 1)
+	{
+		end_frame--;
+		used -= get_frame(end_frame).size;
+	}
+
+	// carry on writing straight after what's left, against its keyframe
+	rewind_frame & last = get_frame(end_frame - 1);
+	head = last.offset + last.size;
+	last_keyframe = end_frame - 1 - last.keyframe_distance;
+	memcpy(key_state, data + get_frame(last_keyframe).offset, CHIP8_REWIND_STATE_SIZE);
+}
+
+long Chip8Rewind::GetBytesUsed()
+{
+	return used;
+}
+
+long Chip8Rewind::GetBudget()
+{
+	return data_size;
+}
+
+Chip8Rewind::rewind_frame & Chip8Rewind::get_frame(long long frame)
+{
+	return frames[frame % frame_capacity];
+}
+
+long Chip8Rewind::alloc_record(long size)
+{
+	if (end_frame - first_frame >= frame_capacity)
+	{
+		drop_oldest();
+	}
+
+	// records never straddle the end of the ring. when it wraps, whatever is left
+	// between head and the end is the oldest data there is, so it goes first
+	long offset = head;
+	if (offset + size > data_size)
+	{
+		while (end_frame > first_frame && get_frame(first_frame).offset >= head)
+		{
+			drop_oldest();
+		}
+		offset = 0;
+	}
+
+	// then anything the new record lands on
+	while (end_frame > first_frame)
+	{
+		rewind_frame & oldest = get_frame(first_frame);
+		if (oldest.offset >= offset + size || oldest.offset + oldest.size <= offset)
+		{
+			break;
+		}
+		drop_oldest();
+	}
+
+	head = offset + size;
+	return offset;
+}
+
+void Chip8Rewind::drop_oldest()
+{
+	used -= get_frame(first_frame).size;
+	first_frame++;
+
+	// deltas are no use without their keyframe
+	while (first_frame < end_frame && get_frame(first_frame).keyframe_distance != 0)
+	{
+		used -= get_frame(first_frame).size;
+		first_frame++;
+	}
+}
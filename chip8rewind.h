@@ -0,0 +1,80 @@
+#pragma once
+#include "chip8.h"
+
+// rewind history for a Chip8
+// Record() once a frame keeps a snapshot in a fixed size ring. every
+// CHIP8_REWIND_DEFAULT_KEYFRAME_INTERVAL frames a whole SaveState() goes in, the frames in
+// between only keep the CHIP8_REWIND_CHUNK byte chunks of the snapshot that differ from
+// that keyframe (dirty memory, changed screen rows, registers). seeking anywhere is one
+// keyframe copy plus one delta. when the ring fills up the oldest keyframe goes, along
+// with every delta that depended on it
+
+#define CHIP8_REWIND_DEFAULT_BUDGET (4 * 1024 * 1024)
+#define CHIP8_REWIND_DEFAULT_KEYFRAME_INTERVAL 120
+#define CHIP8_REWIND_MIN_BUDGET (64 * 1024)
+
+#define CHIP8_REWIND_CHUNK 32
+#define CHIP8_REWIND_CHUNKS ((CHIP8_SAVESTATE_SIZE + CHIP8_REWIND_CHUNK - 1) / CHIP8_REWIND_CHUNK)
+#define CHIP8_REWIND_MASK_WORDS ((CHIP8_REWIND_CHUNKS + 63) / 64)
+#define CHIP8_REWIND_STATE_SIZE (CHIP8_REWIND_CHUNKS * CHIP8_REWIND_CHUNK)
+
+class Chip8Rewind
+{
+public:
+	// budget is the bytes of snapshot data kept. on top of that the frame index has room for as
+	// many frames as the smallest record fits in the budget, budget / CHIP8_REWIND_MIN_RECORD
+	// rewind_frame entries
+	Chip8Rewind(long budget = CHIP8_REWIND_DEFAULT_BUDGET, int keyframe_interval = CHIP8_REWIND_DEFAULT_KEYFRAME_INTERVAL);
+	~Chip8Rewind();
+
+	Chip8Rewind(const Chip8Rewind &) = delete;
+	Chip8Rewind & operator=(const Chip8Rewind &) = delete;
+
+	void Clear();
+
+	// snapshot the machine as the next frame
+	void Record(Chip8 * chip8);
+
+	// frames held are GetFirstFrame() .. GetLastFrame(), numbered from the first Record()
+	long long GetFirstFrame();
+	long long GetLastFrame();
+	long long GetFrameCount();
+
+	// puts the machine back the way it was at frame
+	bool Seek(long long frame, Chip8 * chip8);
+	// throws away everything after frame, so recording carries on from there after a Seek()
+	void Truncate(long long frame);
+
+	long GetBytesUsed();
+	long GetBudget();
+
+private:
+	struct rewind_frame
+	{
+		uint32_t offset;
+		uint16_t size;
+		uint16_t keyframe_distance; // frames back to the keyframe this one is a delta of, 0 for keyframes
+	};
+
+	rewind_frame & get_frame(long long frame);
+	long alloc_record(long size);
+	void drop_oldest();
+
+private:
+	uint8_t * data;
+	long data_size;
+	long head;
+	long used;
+
+	rewind_frame * frames;
+	long frame_capacity;
+	long long first_frame;
+	long long end_frame;
+
+	int keyframe_interval;
+	long long last_keyframe;
+
+	// the current keyframe, and somewhere to build states
+	uint8_t key_state[CHIP8_REWIND_STATE_SIZE];
+	uint8_t scratch[CHIP8_REWIND_STATE_SIZE];
+};
@@ -0,0 +1,355 @@
+#include "chip8romdb.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <filesystem>
+#include <unordered_set>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+// long enough for any sane path
+#define CHIP8_ROMDB_MAX_LINE 8192
+
+static bool is_rom_file(const std::filesystem::path & path)
+{
+	std::string ext = path.extension().string();
+	for (char & c : ext)
+	{
+		c = (char)tolower((unsigned char)c);
+	}
+	return ext == ".ch8" || ext == ".c8" || ext == ".sc8";
+}
+
+Chip8ROMDatabase::Chip8ROMDatabase()
+{
+}
+
+chip8_rom_profile Chip8ROMDatabase::MakeProfile()
+{
+	chip8_rom_profile profile;
+	profile.quirk_8xy6 = -1;
+	profile.quirk_bnnn = -1;
+	profile.quirk_fx55 = -1;
+	profile.cpu_hz = 0;
+	return profile;
+}
+
+bool Chip8ROMDatabase::Load(const char * path)
+{
+	Clear();
+
+	std::error_code ec;
+	if (!std::filesystem::exists(path, ec))
+	{
+		return !ec;
+	}
+
+	FILE * fp = fopen(path, "r");
+	if (!fp)
+	{
+		return false;
+	}
+
+	char line[CHIP8_ROMDB_MAX_LINE];
+	int version = 0;
+	if (!fgets(line, sizeof(line), fp) || sscanf(line, "chip8romdb %d", &version) != 1 || version < 1 || version > CHIP8_ROMDB_VERSION)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		unsigned long long hash;
+		if (strncmp(line, "profile ", 8) == 0)
+		{
+			int q8xy6, qbnnn, qfx55;
+			unsigned int hz;
+			if (sscanf(line + 8, "%llx %d %d %d %u", &hash, &q8xy6, &qbnnn, &qfx55, &hz) == 5)
+			{
+				chip8_rom_profile & profile = profiles[hash];
+				profile.quirk_8xy6 = (int8_t)(q8xy6 < 0 ? -1 : q8xy6 != 0);
+				profile.quirk_bnnn = (int8_t)(qbnnn < 0 ? -1 : qbnnn != 0);
+				profile.quirk_fx55 = (int8_t)(qfx55 < 0 ? -1 : qfx55 != 0);
+				profile.cpu_hz = hz;
+			}
+		}
+		else if (strncmp(line, "file ", 5) == 0)
+		{
+			unsigned long long size;
+			long long mtime;
+			int path_start = 0;
+			if (sscanf(line + 5, "%llx %llu %lld %n", &hash, &size, &mtime, &path_start) == 3 && path_start > 0)
+			{
+				// the path is the rest of the line, spaces and all
+				std::string file_path = line + 5 + path_start;
+				while (!file_path.empty() && (file_path.back() == '\n' || file_path.back() == '\r'))
+				{
+					file_path.pop_back();
+				}
+				if (!file_path.empty())
+				{
+					chip8_rom_file & file = files[file_path];
+					file.hash = hash;
+					file.size = size;
+					file.mtime = mtime;
+				}
+			}
+		}
+		// anything else (comments, blank lines, records from a newer version) is skipped
+	}
+
+	fclose(fp);
+	return true;
+}
+
+bool Chip8ROMDatabase::Save(const char * path)
+{
+	// a crash halfway through leaves the old database, not half of a new one
+	std::string temp_path = std::string(path) + ".tmp";
+	FILE * fp = fopen(temp_path.c_str(), "w");
+	if (!fp)
+	{
+		return false;
+	}
+
+	fprintf(fp, "chip8romdb %d\n", CHIP8_ROMDB_VERSION);
+	for (const auto & it : profiles)
+	{
+		const chip8_rom_profile & profile = it.second;
+		fprintf(fp, "profile %016llX %d %d %d %u\n", (unsigned long long)it.first, profile.quirk_8xy6, profile.quirk_bnnn, profile.quirk_fx55, profile.cpu_hz);
+	}
+	for (const auto & it : files)
+	{
+		const chip8_rom_file & file = it.second;
+		fprintf(fp, "file %016llX %llu %lld %s\n", (unsigned long long)file.hash, (unsigned long long)file.size, (long long)file.mtime, it.first.c_str());
+	}
+
+	bool success = ferror(fp) == 0;
+	success = fclose(fp) == 0 && success;
+
+	std::error_code ec;
+	if (success)
+	{
+		std::filesystem::rename(temp_path, path, ec);
+	}
+	if (!success || ec)
+	{
+		std::filesystem::remove(temp_path, ec);
+		return false;
+	}
+	return true;
+}
+
+void Chip8ROMDatabase::Clear()
+{
+	profiles.clear();
+	files.clear();
+}
+
+int Chip8ROMDatabase::Scan(const char * dir, int threads)
+{
+	namespace fs = std::filesystem;
+
+	std::error_code ec;
+	fs::path root = fs::absolute(dir, ec);
+	if (ec || !fs::is_directory(root, ec))
+	{
+		return -1;
+	}
+	root = root.lexically_normal();
+
+	// everything under here that wasn't seen this time has been deleted or moved
+	std::string prefix = root.generic_string();
+	if (prefix.empty() || prefix.back() != '/')
+	{
+		prefix += '/';
+	}
+
+	struct scan_work
+	{
+		std::string path;
+		chip8_rom_file file;
+		bool loaded;
+	};
+	std::vector<scan_work> work;
+	std::unordered_set<std::string> seen;
+
+	// the walk is only stats, and only the files that are new or changed get opened
+	fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec);
+	for (fs::recursive_directory_iterator end; !ec && it != end; it.increment(ec))
+	{
+		const fs::directory_entry & entry = *it;
+		std::error_code entry_ec;
+		if (!entry.is_regular_file(entry_ec) || !is_rom_file(entry.path()))
+		{
+			continue;
+		}
+
+		scan_work w;
+		w.path = entry.path().generic_string();
+		w.file.hash = 0;
+		w.file.size = entry.file_size(entry_ec);
+		w.file.mtime = (int64_t)entry.last_write_time(entry_ec).time_since_epoch().count();
+		w.loaded = false;
+		// empty or too big to be a rom, the size is enough to tell without opening it
+		if (entry_ec || w.file.size == 0 || w.file.size > CHIP8_ROM_IMAGE_MAX_SIZE)
+		{
+			continue;
+		}
+
+		seen.insert(w.path);
+		auto known = files.find(w.path);
+		if (known != files.end() && known->second.size == w.file.size && known->second.mtime == w.file.mtime)
+		{
+			continue;
+		}
+		work.push_back(w);
+	}
+	if (ec)
+	{
+		// the walk stopped partway, so not being seen doesn't mean a file has gone. leave
+		// the index as it was rather than prune everything that wasn't reached
+		return -1;
+	}
+
+	// hash in parallel, each rom is read into its image and hashed there
+	if (threads <= 0)
+	{
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	if (threads > (int)work.size())
+	{
+		threads = (int)work.size();
+	}
+
+	std::atomic<size_t> next(0);
+	auto hash_files = [&]()
+	{
+		for (size_t i = next++; i < work.size(); i = next++)
+		{
+			std::shared_ptr<const Chip8ROMImage> image = Chip8ROMImage::Load(work[i].path.c_str());
+			if (image)
+			{
+				work[i].file.hash = image->GetHash();
+				work[i].loaded = true;
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads; t++)
+	{
+		workers.emplace_back(hash_files);
+	}
+	hash_files();
+	for (std::thread & worker : workers)
+	{
+		worker.join();
+	}
+
+	for (scan_work & w : work)
+	{
+		if (w.loaded)
+		{
+			files[w.path] = w.file;
+		}
+		else
+		{
+			// went away or couldn't be read
+			files.erase(w.path);
+		}
+	}
+
+	for (auto file = files.lower_bound(prefix); file != files.end() && file->first.compare(0, prefix.size(), prefix) == 0; )
+	{
+		if (seen.count(file->first) == 0)
+		{
+			file = files.erase(file);
+		}
+		else
+		{
+			++file;
+		}
+	}
+
+	return (int)work.size();
+}
+
+bool Chip8ROMDatabase::FindProfile(uint64_t hash, chip8_rom_profile & profile)
+{
+	auto it = profiles.find(hash);
+	if (it == profiles.end())
+	{
+		return false;
+	}
+	profile = it->second;
+	return true;
+}
+
+void Chip8ROMDatabase::SetProfile(uint64_t hash, const chip8_rom_profile & profile)
+{
+	profiles[hash] = profile;
+}
+
+void Chip8ROMDatabase::RemoveProfile(uint64_t hash)
+{
+	profiles.erase(hash);
+}
+
+int Chip8ROMDatabase::GetProfileCount()
+{
+	return (int)profiles.size();
+}
+
+const chip8_rom_file * Chip8ROMDatabase::FindFile(const char * path)
+{
+	std::error_code ec;
+	std::filesystem::path full = std::filesystem::absolute(path, ec);
+	if (ec)
+	{
+		return nullptr;
+	}
+
+	auto it = files.find(full.lexically_normal().generic_string());
+	return it != files.end() ? &it->second : nullptr;
+}
+
+const std::map<std::string, chip8_rom_file> & Chip8ROMDatabase::GetFiles()
+{
+	return files;
+}
+
+bool Chip8ROMDatabase::Apply(Chip8 * chip8)
+{
+	std::shared_ptr<const Chip8ROMImage> image = chip8->GetROMImage();
+	chip8_rom_profile profile;
+	if (!image || !FindProfile(image->GetHash(), profile))
+	{
+		return false;
+	}
+
+	if (profile.quirk_8xy6 >= 0) chip8->SetConfig_8XY6_8XYE_VY_mode(profile.quirk_8xy6 != 0);
+	if (profile.quirk_bnnn >= 0) chip8->SetConfig_BNNN_ADD_mode(profile.quirk_bnnn != 0);
+	if (profile.quirk_fx55 >= 0) chip8->SetConfig_FX55_FX65_VY_mode(profile.quirk_fx55 != 0);
+	if (profile.cpu_hz >= CHIP8_MIN_CPU_HZ && profile.cpu_hz <= CHIP8_MAX_CPU_HZ) chip8->SetCPUFrequency(profile.cpu_hz);
+	return true;
+}
+
+bool Chip8ROMDatabase::Store(Chip8 * chip8)
+{
+	std::shared_ptr<const Chip8ROMImage> image = chip8->GetROMImage();
+	if (!image)
+	{
+		return false;
+	}
+
+	chip8_rom_profile profile;
+	profile.quirk_8xy6 = chip8->GetConfig_8XY6_8XYE_VY_mode();
+	profile.quirk_bnnn = chip8->GetConfig_BNNN_ADD_mode();
+	profile.quirk_fx55 = chip8->GetConfig_FX55_FX65_VY_mode();
+	profile.cpu_hz = chip8->GetCPUFrequency();
+	SetProfile(image->GetHash(), profile);
+	return true;
+}
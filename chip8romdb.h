@@ -0,0 +1,76 @@
+#pragma once
+#include "chip8.h"
+#include <string>
+#include <map>
+
+// rom database
+// the settings a rom needs (the three ambiguous opcode modes and a clock) keyed by a hash of
+// its contents, so a rom gets them back however it's named or wherever it's copied, plus an
+// index of the rom files under the library folders that were scanned. Scan() hashes new
+// files in parallel and only rehashes files whose size or modified time changed, a big
+// library that was scanned before costs a stat per file
+//
+// saved as text, one line per record, so profiles can be edited by hand:
+//   chip8romdb 1
+//   profile <hash> <8xy6> <bnnn> <fx55> <hz>      (-1 / 0 hz for "leave it")
+//   file <hash> <size> <mtime> <path>
+
+#define CHIP8_ROMDB_DEFAULT_FILE "chip8roms.db"
+#define CHIP8_ROMDB_VERSION 1
+
+struct chip8_rom_profile
+{
+	// -1 leaves the Chip8's setting alone
+	int8_t quirk_8xy6;
+	int8_t quirk_bnnn;
+	int8_t quirk_fx55;
+	// 0 leaves it
+	uint32_t cpu_hz;
+};
+
+struct chip8_rom_file
+{
+	uint64_t hash;
+	uint64_t size;
+	// std::filesystem's clock, only ever compared for equality
+	int64_t mtime;
+};
+
+class Chip8ROMDatabase
+{
+public:
+	Chip8ROMDatabase();
+
+	static chip8_rom_profile MakeProfile();
+
+	// a missing file is an empty database, false only if it exists and can't be read
+	bool Load(const char * path);
+	// writes a temp file next to path and renames it over
+	bool Save(const char * path);
+	void Clear();
+
+	// indexes the roms (.ch8, .c8, .sc8) under dir, dropping files that have gone. returns
+	// how many files were hashed, -1 if dir can't be read or the walk fails partway (nothing
+	// is changed then). 0 threads = one per hardware thread
+	int Scan(const char * dir, int threads = 0);
+
+	bool FindProfile(uint64_t hash, chip8_rom_profile & profile);
+	void SetProfile(uint64_t hash, const chip8_rom_profile & profile);
+	void RemoveProfile(uint64_t hash);
+	int GetProfileCount();
+
+	// null if path hasn't been indexed
+	const chip8_rom_file * FindFile(const char * path);
+	const std::map<std::string, chip8_rom_file> & GetFiles();
+
+	// applies the profile of the rom chip8 has loaded, false if it has none
+	bool Apply(Chip8 * chip8);
+	// makes chip8's current settings the profile of the rom it has loaded
+	bool Store(Chip8 * chip8);
+
+private:
+	// both sorted so saves come out in a stable order
+	std::map<uint64_t, chip8_rom_profile> profiles;
+	// by absolute path
+	std::map<std::string, chip8_rom_file> files;
+};
@@ -0,0 +1,85 @@
+#include "chip8romimage.h"
+#include <stdio.h>
+#include <string.h>
+
+Chip8ROMImage::Chip8ROMImage()
+{
+	data = nullptr;
+	size = 0;
+	hash = 0;
+}
+
+Chip8ROMImage::~Chip8ROMImage()
+{
+	delete[] data;
+}
+
+std::shared_ptr<const Chip8ROMImage> Chip8ROMImage::Load(const char * path)
+{
+	if (path == nullptr)
+	{
+		return nullptr;
+	}
+
+	FILE * file = fopen(path, "rb");
+	if (file == nullptr)
+	{
+		return nullptr;
+	}
+
+	// read a byte past the biggest rom, so a file that's too big shows without a stat
+	// that could already be out of date by the time the bytes are read
+	uint8_t buffer[CHIP8_ROM_IMAGE_MAX_SIZE + 1];
+	size_t read = fread(buffer, 1, sizeof(buffer), file);
+	bool failed = ferror(file) != 0;
+	fclose(file);
+
+	if (failed || read == 0 || read > CHIP8_ROM_IMAGE_MAX_SIZE)
+	{
+		return nullptr;
+	}
+	return Copy(buffer, (long)read);
+}
+
+std::shared_ptr<const Chip8ROMImage> Chip8ROMImage::Copy(const uint8_t * data, long size)
+{
+	if (data == nullptr || size <= 0 || size > CHIP8_ROM_IMAGE_MAX_SIZE)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<Chip8ROMImage> image(new Chip8ROMImage());
+	uint8_t * copy = new uint8_t[size];
+	memcpy(copy, data, size);
+	image->data = copy;
+	image->size = size;
+	image->hash = Hash(copy, size);
+	return image;
+}
+
+const uint8_t * Chip8ROMImage::GetData() const
+{
+	return data;
+}
+
+long Chip8ROMImage::GetSize() const
+{
+	return size;
+}
+
+uint64_t Chip8ROMImage::GetHash() const
+{
+	return hash;
+}
+
+uint64_t Chip8ROMImage::Hash(const uint8_t * data, long size)
+{
+	// fnv-1a, like the screen hash
+	uint64_t h = 14695981039346656037ULL;
+	for (long i = 0; i < size; i++)
+	{
+		h ^= data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
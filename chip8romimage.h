@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+
+// read only rom image
+// a rom file is read once into the image and that copy is what every Chip8 that loads it
+// reads from, so a batch of a thousand machines on one rom holds one copy of it and
+// Reset() is a bulk copy out of the image. the bytes are owned rather than mapped, a rom
+// is at most a few KB and a mapping could change under the hash (or fault) if the file
+// was rewritten. images are immutable once made and handed around as shared_ptr, any
+// number of Chip8s on any number of threads can share one
+
+// biggest rom that fits in work ram
+#define CHIP8_ROM_IMAGE_MAX_SIZE (4096 - 0x200)
+
+class Chip8ROMImage
+{
+public:
+	~Chip8ROMImage();
+
+	Chip8ROMImage(const Chip8ROMImage &) = delete;
+	Chip8ROMImage & operator=(const Chip8ROMImage &) = delete;
+
+	// reads path, null if it can't be read, is empty or is too big to be a rom
+	static std::shared_ptr<const Chip8ROMImage> Load(const char * path);
+	// takes a copy of data, for roms that didn't come from a file
+	static std::shared_ptr<const Chip8ROMImage> Copy(const uint8_t * data, long size);
+
+	const uint8_t * GetData() const;
+	long GetSize() const;
+	// of the contents, worked out once when the image is made. byte at a time so it's the
+	// same on every host, Chip8ROMDatabase keys on it
+	uint64_t GetHash() const;
+
+	static uint64_t Hash(const uint8_t * data, long size);
+
+private:
+	Chip8ROMImage();
+
+private:
+	const uint8_t * data;
+	long size;
+	uint64_t hash;
+};
@@ -0,0 +1,323 @@
+#include "chip8runner.h"
+#include <string.h>
+
+// set on middle when it holds a frame the reader hasn't picked up
+#define CHIP8_RUNNER_FRAME_FRESH 0x80
+#define CHIP8_RUNNER_KEY_PRESSED 0x80
+
+Chip8Runner::Chip8Runner(Chip8 * chip8, Chip8Rewind * rewind, Chip8Movie * movie)
+{
+	this->chip8 = chip8;
+	this->rewind = rewind;
+	this->movie = movie;
+
+	running = false;
+	paused = true;
+	unthrottled = false;
+	steps = 0;
+	waiters = 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		frames[i].frame = 0;
+		frames[i].ips = 0.0;
+
+		chip8_runner_info & info = frames[i].info;
+		info.rewind_first_frame = 0;
+		info.rewind_last_frame = 0;
+		info.rewind_frame_count = 0;
+		info.rewind_bytes_used = 0;
+		info.rewind_budget = 0;
+		info.movie_mode = CHIP8_MOVIE_IDLE;
+		info.movie_length = 0;
+		info.movie_input_count = 0;
+		info.trace_file_open = false;
+		info.trace_file_failed = false;
+		info.trace_file_count = 0;
+		info.tracing = false;
+		info.profiling = false;
+		memset(frames[i].state, 0, sizeof(frames[i].state));
+	}
+	back = 0;
+	middle = 1;
+	front = 2;
+
+	input_head = 0;
+	input_tail = 0;
+
+	frame_number = 0;
+	instructions_counted = 0;
+	measured_ips = 0.0;
+}
+
+Chip8Runner::~Chip8Runner()
+{
+	Stop();
+}
+
+void Chip8Runner::Start()
+{
+	if (running)
+	{
+		return;
+	}
+
+	running = true;
+	thread = std::thread(&Chip8Runner::thread_main, this);
+}
+
+void Chip8Runner::Stop()
+{
+	running = false;
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+}
+
+std::unique_lock<std::mutex> Chip8Runner::Lock()
+{
+	// std::mutex isn't fair, this tells the emulation thread to stand aside
+	waiters++;
+	std::unique_lock<std::mutex> guard(lock);
+	waiters--;
+	return guard;
+}
+
+void Chip8Runner::SetPaused(bool paused)
+{
+	this->paused = paused;
+}
+
+bool Chip8Runner::IsPaused()
+{
+	return paused;
+}
+
+void Chip8Runner::Step()
+{
+	paused = true;
+	steps++;
+}
+
+void Chip8Runner::SetUnthrottled(bool unthrottled)
+{
+	this->unthrottled = unthrottled;
+}
+
+bool Chip8Runner::IsUnthrottled()
+{
+	return unthrottled;
+}
+
+bool Chip8Runner::PushKey(uint8_t key, bool pressed)
+{
+	uint32_t head = input_head.load(std::memory_order_relaxed);
+	if (head - input_tail.load(std::memory_order_acquire) >= CHIP8_RUNNER_INPUT_QUEUE_SIZE)
+	{
+		return false;
+	}
+
+	input[head & (CHIP8_RUNNER_INPUT_QUEUE_SIZE - 1)] = key | (pressed ? CHIP8_RUNNER_KEY_PRESSED : 0);
+	input_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+bool Chip8Runner::AcquireFrame(Chip8 * view)
+{
+	if (!(middle.load(std::memory_order_relaxed) & CHIP8_RUNNER_FRAME_FRESH))
+	{
+		return false;
+	}
+
+	front = middle.exchange(front, std::memory_order_acq_rel) & ~CHIP8_RUNNER_FRAME_FRESH;
+	return view->LoadState(frames[front].state, CHIP8_SAVESTATE_SIZE);
+}
+
+long long Chip8Runner::GetFrameNumber()
+{
+	return frames[front].frame;
+}
+
+double Chip8Runner::GetMeasuredIPS()
+{
+	return frames[front].ips;
+}
+
+chip8_runner_info & Chip8Runner::GetInfo()
+{
+	return frames[front].info;
+}
+
+void Chip8Runner::thread_main()
+{
+	using clock = std::chrono::steady_clock;
+
+	// deadlines kept in a unit that holds clock ticks and 1/60ths exactly, like AppBase::Run
+	const auto frame_time = std::chrono::duration<long long, std::ratio<1, 60>>(1);
+	typedef std::common_type_t<clock::duration, decltype(frame_time)> deadline_duration;
+	std::chrono::time_point<clock, deadline_duration> next = clock::now();
+
+	count_start = clock::now();
+
+	while (running)
+	{
+		wait_for_waiters();
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			drain_input();
+
+			long long executed = 0;
+			int pending_steps = steps.exchange(0);
+			if (pending_steps > 0)
+			{
+				executed = run(pending_steps);
+				if (rewind) rewind->Record(chip8);
+			}
+			else if (!paused)
+			{
+				if (unthrottled)
+				{
+					// the timers still tick every cpu_hz / 60 instructions of emulated time.
+					// someone waiting on the lock cuts the frame short, it's let in before the next one
+					auto start = clock::now();
+					do
+					{
+						executed += run(CHIP8_RUNNER_UNTHROTTLED_CHUNK);
+					} while (clock::now() - start < CHIP8_RUNNER_UNTHROTTLED_BUDGET && waiters.load(std::memory_order_relaxed) == 0);
+				}
+				else
+				{
+					executed = run(chip8->StartFrame());
+				}
+
+				frame_number++;
+				if (rewind) rewind->Record(chip8);
+			}
+
+			instructions_counted += executed;
+			auto now = clock::now();
+			if (now - count_start >= std::chrono::seconds(1))
+			{
+				measured_ips = instructions_counted / std::chrono::duration<double>(now - count_start).count();
+				instructions_counted = 0;
+				count_start = now;
+			}
+
+			// paused frames go out too, so resets, rom loads and rewind seeks made under
+			// Lock() show up on the render thread
+			publish_frame();
+		}
+
+		if (unthrottled && !paused)
+		{
+			next = clock::now();
+			continue;
+		}
+
+		// behind the deadline runs the next frame straight away, so a late frame is made up
+		// rather than dropped. too far behind and the missed time is written off
+		next += frame_time;
+		auto now = clock::now();
+		if (now - next > CHIP8_RUNNER_MAX_CATCHUP_FRAMES * frame_time)
+		{
+			next = now;
+		}
+		else if (next > now)
+		{
+			std::this_thread::sleep_until(next);
+		}
+	}
+}
+
+long long Chip8Runner::run(long long count)
+{
+	if (movie && movie->GetMode() == CHIP8_MOVIE_PLAYING)
+	{
+		return movie->Play(chip8, count);
+	}
+	return chip8->Run(count);
+}
+
+void Chip8Runner::drain_input()
+{
+	bool recording = movie && movie->GetMode() == CHIP8_MOVIE_RECORDING;
+	bool playing = movie && movie->GetMode() == CHIP8_MOVIE_PLAYING;
+
+	uint32_t tail = input_tail.load(std::memory_order_relaxed);
+	uint32_t head = input_head.load(std::memory_order_acquire);
+	while (tail != head)
+	{
+		uint8_t event = input[tail & (CHIP8_RUNNER_INPUT_QUEUE_SIZE - 1)];
+		uint8_t key = event & ~CHIP8_RUNNER_KEY_PRESSED;
+		bool pressed = (event & CHIP8_RUNNER_KEY_PRESSED) != 0;
+		tail++;
+
+		if (playing)
+		{
+			continue;
+		}
+		if (recording)
+		{
+			movie->RecordKey(chip8, key, pressed);
+		}
+		chip8->SetKey(key, pressed);
+	}
+	input_tail.store(tail, std::memory_order_release);
+}
+
+void Chip8Runner::wait_for_waiters()
+{
+	// unlocking and locking straight away again would usually win the mutex back before a
+	// thread woken up in Lock() gets to it, so wait until it's actually got it
+	while (waiters.load(std::memory_order_acquire) > 0 && running)
+	{
+		std::this_thread::yield();
+	}
+}
+
+void Chip8Runner::publish_frame()
+{
+	runner_frame & f = frames[back];
+	f.frame = frame_number;
+	f.ips = measured_ips;
+	chip8->SaveState(f.state, CHIP8_SAVESTATE_SIZE);
+
+	chip8_runner_info & info = f.info;
+	if (rewind)
+	{
+		info.rewind_first_frame = rewind->GetFirstFrame();
+		info.rewind_last_frame = rewind->GetLastFrame();
+		info.rewind_frame_count = rewind->GetFrameCount();
+		info.rewind_bytes_used = rewind->GetBytesUsed();
+		info.rewind_budget = rewind->GetBudget();
+	}
+	if (movie)
+	{
+		info.movie_mode = movie->GetMode();
+		info.movie_length = movie->GetLength();
+		info.movie_input_count = movie->GetInputCount();
+	}
+
+	Chip8TraceFile * trace_file = chip8->GetTraceFile();
+	info.trace_file_open = trace_file != nullptr;
+	info.trace_file_failed = trace_file && trace_file->Failed();
+	info.trace_file_count = trace_file ? trace_file->GetCount() : 0;
+
+	// the ring is 48KB and the profile 34KB, both only copied while they're turned on
+	Chip8TraceRing * trace = chip8->GetTrace();
+	info.tracing = trace != nullptr;
+	if (trace)
+	{
+		info.trace = *trace;
+	}
+	info.profiling = chip8->GetProfiling() && chip8->GetProfile();
+	if (info.profiling)
+	{
+		info.profile = *chip8->GetProfile();
+	}
+
+	back = middle.exchange(back | CHIP8_RUNNER_FRAME_FRESH, std::memory_order_acq_rel) & ~CHIP8_RUNNER_FRAME_FRESH;
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include "chip8.h"
+#include "chip8rewind.h"
+#include "chip8movie.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// runs a Chip8 on its own thread
+// the emulation thread keeps its own 60hz deadline, so a stalled swap, a slow ui frame or a
+// blocking file dialog on the render thread never drops or delays emulated cycles. after every
+// frame it publishes a SaveState() snapshot through a lock free triple buffer, the render
+// thread picks up the newest one into a Chip8 of its own and draws / inspects that. key
+// presses go the other way through a lock free single producer single consumer queue.
+// with a movie recording they get captured on the way in, with one playing they're
+// ignored and the movie drives the keys
+//
+// anything else that changes the running Chip8 (loading a rom, reset, quirks, rewind seeks,
+// starting movies) does it while holding Lock(), which the emulation thread only takes
+// between frames. what the ui only reads (the rewind range, the movie, the trace ring and
+// the profile) goes out with every published frame instead, see GetInfo()
+
+// frames the emulation thread will run back to back to catch up before it gives up on
+// the missed time (the thread itself got starved, a debugger break, a sleeping laptop)
+#define CHIP8_RUNNER_MAX_CATCHUP_FRAMES 15
+// unthrottled, how long the thread runs between publishing frames. it's run in chunks and a
+// frame ends early after any chunk while another thread is waiting in Lock()
+#define CHIP8_RUNNER_UNTHROTTLED_BUDGET std::chrono::milliseconds(12)
+#define CHIP8_RUNNER_UNTHROTTLED_CHUNK 16384
+
+// power of 2, key changes queued between two emulation frames
+#define CHIP8_RUNNER_INPUT_QUEUE_SIZE 64
+
+// everything the ui shows besides the machine itself, copied out by the emulation thread
+// along with each frame's snapshot
+struct chip8_runner_info
+{
+	long long rewind_first_frame;
+	long long rewind_last_frame;
+	long long rewind_frame_count;
+	long rewind_bytes_used;
+	long rewind_budget;
+
+	uint8_t movie_mode;
+	long long movie_length;
+	int movie_input_count;
+
+	bool trace_file_open;
+	bool trace_file_failed;
+	uint64_t trace_file_count;
+
+	// only copied while the Chip8 has a trace ring / is profiling
+	bool tracing;
+	bool profiling;
+	Chip8TraceRing trace;
+	Chip8Profile profile;
+};
+
+class Chip8Runner
+{
+public:
+	// none are owned. rewind is optional, a frame gets recorded after every emulated frame.
+	// so is movie, it's only used while recording or playing
+	Chip8Runner(Chip8 * chip8, Chip8Rewind * rewind = nullptr, Chip8Movie * movie = nullptr);
+	~Chip8Runner();
+
+	Chip8Runner(const Chip8Runner &) = delete;
+	Chip8Runner & operator=(const Chip8Runner &) = delete;
+
+	void Start();
+	void Stop();
+
+	// exclusive access to the Chip8 (and the rewind history) from any other thread
+	std::unique_lock<std::mutex> Lock();
+
+	void SetPaused(bool paused);
+	bool IsPaused();
+	// runs one instruction on the next emulation frame and stays paused
+	void Step();
+	// as fast as the host allows instead of at the cpu frequency
+	void SetUnthrottled(bool unthrottled);
+	bool IsUnthrottled();
+
+	// queued for the emulation thread, false if the queue is full. one producer thread only
+	bool PushKey(uint8_t key, bool pressed);
+
+	// loads the newest published frame into view if there's one the caller hasn't seen yet.
+	// one consumer thread only
+	bool AcquireFrame(Chip8 * view);
+
+	// emulated frames published so far, and instructions per second of wall time measured by
+	// the emulation thread, both as of the last AcquireFrame()
+	long long GetFrameNumber();
+	double GetMeasuredIPS();
+	// belongs to the consumer thread until its next AcquireFrame()
+	chip8_runner_info & GetInfo();
+
+private:
+	struct runner_frame
+	{
+		long long frame;
+		double ips;
+		chip8_runner_info info;
+		alignas(64) uint8_t state[CHIP8_SAVESTATE_SIZE];
+	};
+
+	void thread_main();
+	long long run(long long count);
+	void drain_input();
+	void publish_frame();
+	void wait_for_waiters();
+
+private:
+	Chip8 * chip8;
+	Chip8Rewind * rewind;
+	Chip8Movie * movie;
+
+	std::thread thread;
+	std::mutex lock;
+	std::atomic<bool> running;
+	std::atomic<bool> paused;
+	std::atomic<bool> unthrottled;
+	std::atomic<int> steps;
+	// threads blocked in Lock(), the emulation thread backs off while there are any
+	std::atomic<int> waiters;
+
+	// triple buffer. the writer owns back, the reader owns front and the two swap through
+	// middle, whose CHIP8_RUNNER_FRAME_FRESH bit says it holds a frame the reader hasn't had
+	runner_frame frames[3];
+	uint8_t back;
+	uint8_t front;
+	alignas(64) std::atomic<uint8_t> middle;
+
+	// key events, bit 7 set for pressed. head is written by the producer, tail by the consumer
+	uint8_t input[CHIP8_RUNNER_INPUT_QUEUE_SIZE];
+	alignas(64) std::atomic<uint32_t> input_head;
+	alignas(64) std::atomic<uint32_t> input_tail;
+
+	// emulation thread only
+	long long frame_number;
+	long long instructions_counted;
+	std::chrono::steady_clock::time_point count_start;
+	double measured_ips;
+};
@@ -0,0 +1,62 @@
+#include "chip8trace.h"
+#include <stdio.h>
+
+Chip8TraceRing::Chip8TraceRing()
+{
+	Clear();
+}
+
+void Chip8TraceRing::Clear()
+{
+	head = 0;
+}
+
+uint32_t Chip8TraceRing::GetCount()
+{
+	return head < CHIP8_TRACE_RING_SIZE ? (uint32_t)head : CHIP8_TRACE_RING_SIZE;
+}
+
+const chip8_trace_record & Chip8TraceRing::Get(uint32_t i)
+{
+	uint64_t oldest = head - GetCount();
+	return records[(oldest + i) & (CHIP8_TRACE_RING_SIZE - 1)];
+}
+
+uint64_t Chip8TraceRing::GetTotal()
+{
+	return head;
+}
+
+int Chip8TraceRing::Format(const chip8_trace_record & rec, char * buf, int size)
+{
+	return snprintf(buf, size, "%08X  PC:%03X  OP:%04X  I:%03X  %s %s",
+		rec.tick, rec.pc, rec.opcode, rec.index_reg, GetLevelName(rec.level), GetEventName(rec.event));
+}
+
+const char * Chip8TraceRing::GetLevelName(uint8_t level)
+{
+	switch (level)
+	{
+		case CHIP8_TRACE_NONE: return "NONE";
+		case CHIP8_TRACE_ERROR: return "ERROR";
+		case CHIP8_TRACE_INFO: return "INFO";
+		case CHIP8_TRACE_INSTR: return "INSTR";
+		default: return "?";
+	}
+}
+
+const char * Chip8TraceRing::GetEventName(uint8_t event)
+{
+	switch (event)
+	{
+		case CHIP8_TRACE_EVENT_EXEC: return "exec";
+		case CHIP8_TRACE_EVENT_UNKNOWN_OPCODE: return "unknown opcode";
+		case CHIP8_TRACE_EVENT_NULL_OPCODE: return "null opcode";
+		case CHIP8_TRACE_EVENT_RESET: return "reset";
+		case CHIP8_TRACE_EVENT_ROM_LOADED: return "rom loaded";
+		case CHIP8_TRACE_EVENT_STACK_OVERFLOW: return "stack overflow";
+		case CHIP8_TRACE_EVENT_STACK_UNDERFLOW: return "stack underflow";
+		case CHIP8_TRACE_EVENT_STATE_LOADED: return "state loaded";
+		default: return "?";
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <stdint.h>
+
+// leveled tracing for the Chip8 core
+// levels above CHIP8_TRACE_MAX_LEVEL are compiled out entirely, the rest cost one
+// compare against the runtime level when they're off. enabled traces go into a
+// fixed size ring of binary records, text is only produced when someone reads them
+
+#define CHIP8_TRACE_NONE 0
+#define CHIP8_TRACE_ERROR 1		// unknown opcodes and other things that shouldn't happen
+#define CHIP8_TRACE_INFO 2		// resets, rom and state loads
+#define CHIP8_TRACE_INSTR 3		// every executed instruction
+#define CHIP8_TRACE_LEVEL_COUNT 4
+
+// build with -DCHIP8_TRACE_MAX_LEVEL=0 to strip every trace out of the core
+#ifndef CHIP8_TRACE_MAX_LEVEL
+#define CHIP8_TRACE_MAX_LEVEL CHIP8_TRACE_INSTR
+#endif
+
+// trace events
+#define CHIP8_TRACE_EVENT_EXEC 0
+#define CHIP8_TRACE_EVENT_UNKNOWN_OPCODE 1
+#define CHIP8_TRACE_EVENT_NULL_OPCODE 2
+#define CHIP8_TRACE_EVENT_RESET 3
+#define CHIP8_TRACE_EVENT_ROM_LOADED 4
+#define CHIP8_TRACE_EVENT_STACK_OVERFLOW 5
+#define CHIP8_TRACE_EVENT_STACK_UNDERFLOW 6
+#define CHIP8_TRACE_EVENT_STATE_LOADED 7
+#define CHIP8_TRACE_EVENT_COUNT 8
+
+// must be a power of two
+#define CHIP8_TRACE_RING_SIZE 4096
+
+struct chip8_trace_record
+{
+	uint32_t tick; // low 32 bits of the system tick
+	uint16_t pc;
+	uint16_t opcode;
+	uint16_t index_reg;
+	uint8_t level;
+	uint8_t event;
+};
+
+class Chip8TraceRing
+{
+public:
+	Chip8TraceRing();
+
+	void Push(uint8_t level, uint8_t event, uint32_t tick, uint16_t pc, uint16_t opcode, uint16_t index_reg)
+	{
+		chip8_trace_record & rec = records[head & (CHIP8_TRACE_RING_SIZE - 1)];
+		rec.tick = tick;
+		rec.pc = pc;
+		rec.opcode = opcode;
+		rec.index_reg = index_reg;
+		rec.level = level;
+		rec.event = event;
+		head++;
+	}
+
+	void Clear();
+
+	// number of records held, oldest is 0
+	uint32_t GetCount();
+	const chip8_trace_record & Get(uint32_t i);
+	// total records ever pushed, including the ones that have been overwritten
+	uint64_t GetTotal();
+
+	// writes a one line description of rec into buf, returns the length
+	static int Format(const chip8_trace_record & rec, char * buf, int size);
+	static const char * GetLevelName(uint8_t level);
+	static const char * GetEventName(uint8_t event);
+
+private:
+	chip8_trace_record records[CHIP8_TRACE_RING_SIZE];
+	uint64_t head;
+};
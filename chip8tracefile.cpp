@@ -0,0 +1,442 @@
+#include "chip8tracefile.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CHIP8_TRACE_FILE_CHUNK_BYTES ((uint64_t)CHIP8_TRACE_FILE_CHUNK_RECORDS * sizeof(chip8_trace_file_record))
+// the smallest page anything runs on, touching more often than needed is harmless
+#define CHIP8_TRACE_FILE_PAGE_SIZE 4096
+
+Chip8TraceFile::Chip8TraceFile()
+{
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+#else
+	file = -1;
+#endif
+	open = false;
+	failed = false;
+	current = nullptr;
+	current_chunk = 0;
+	stopping = false;
+	ahead_wanted = false;
+	ahead_ready = false;
+	ahead_chunk = 0;
+	ahead = nullptr;
+	retired = nullptr;
+	cursor = &scratch;
+	end = &scratch + 1;
+}
+
+Chip8TraceFile::~Chip8TraceFile()
+{
+	Close();
+}
+
+bool Chip8TraceFile::Open(const char * path)
+{
+	Close();
+
+#ifdef _WIN32
+	file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+#else
+	file = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+	{
+		return false;
+	}
+#endif
+
+	open = true;
+	failed = false;
+	current_chunk = 0;
+	stopping = false;
+	ahead_ready = false;
+	ahead = nullptr;
+	retired = nullptr;
+
+	if (!map_chunk(0, &current))
+	{
+		Close();
+		return false;
+	}
+
+	// the helper starts on chunk 1 straight away
+	ahead_wanted = true;
+	ahead_chunk = 1;
+	helper = std::thread(&Chip8TraceFile::helper_main, this);
+
+	// the header's slot stays empty until Close()
+	cursor = current + 1;
+	end = current + CHIP8_TRACE_FILE_CHUNK_RECORDS;
+	return true;
+}
+
+void Chip8TraceFile::Close()
+{
+	if (!open)
+	{
+		return;
+	}
+
+	if (helper.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		changed.notify_all();
+		helper.join();
+	}
+
+	// slots used, header included
+	uint64_t used = failed ? current_chunk * CHIP8_TRACE_FILE_CHUNK_RECORDS :
+		current_chunk * CHIP8_TRACE_FILE_CHUNK_RECORDS + (cursor - current);
+
+	unmap_chunk(current);
+	unmap_chunk(ahead);
+	unmap_chunk(retired);
+	current = nullptr;
+	ahead = nullptr;
+	retired = nullptr;
+
+	chip8_trace_file_header header;
+	header.magic = CHIP8_TRACE_FILE_MAGIC;
+	header.version = CHIP8_TRACE_FILE_VERSION;
+	header.record_size = sizeof(chip8_trace_file_record);
+	header.count = used > 0 ? used - 1 : 0;
+
+#ifdef _WIN32
+	LARGE_INTEGER position;
+	position.QuadPart = (LONGLONG)(used * sizeof(chip8_trace_file_record));
+	SetFilePointerEx(file, position, nullptr, FILE_BEGIN);
+	SetEndOfFile(file);
+
+	DWORD written = 0;
+	position.QuadPart = 0;
+	SetFilePointerEx(file, position, nullptr, FILE_BEGIN);
+	WriteFile(file, &header, sizeof(header), &written, nullptr);
+	CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (ftruncate(file, (off_t)(used * sizeof(chip8_trace_file_record))) != 0 ||
+		pwrite(file, &header, sizeof(header), 0) != sizeof(header))
+	{
+		printf("Chip8 trace file couldn't be finished, it will read back without a count\n");
+	}
+	::close(file);
+	file = -1;
+#endif
+
+	open = false;
+	cursor = &scratch;
+	end = &scratch + 1;
+}
+
+bool Chip8TraceFile::IsOpen()
+{
+	return open;
+}
+
+uint64_t Chip8TraceFile::GetCount()
+{
+	if (!open)
+	{
+		return 0;
+	}
+	if (failed)
+	{
+		return current_chunk * CHIP8_TRACE_FILE_CHUNK_RECORDS - 1;
+	}
+	return current_chunk * CHIP8_TRACE_FILE_CHUNK_RECORDS + (cursor - current) - 1;
+}
+
+bool Chip8TraceFile::Failed()
+{
+	return failed;
+}
+
+void Chip8TraceFile::next_chunk()
+{
+	if (!open || failed)
+	{
+		cursor = &scratch;
+		end = &scratch + 1;
+		return;
+	}
+
+	{
+		// normally the helper finished this long ago
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [this] { return ahead_ready; });
+
+		retired = current;
+		current = ahead;
+		ahead = nullptr;
+		ahead_ready = false;
+		current_chunk++;
+
+		ahead_wanted = current != nullptr;
+		ahead_chunk = current_chunk + 1;
+	}
+	changed.notify_all();
+
+	if (current == nullptr)
+	{
+		// the file couldn't grow
+		failed = true;
+		cursor = &scratch;
+		end = &scratch + 1;
+		return;
+	}
+
+	cursor = current;
+	end = current + CHIP8_TRACE_FILE_CHUNK_RECORDS;
+}
+
+void Chip8TraceFile::helper_main()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (true)
+	{
+		changed.wait(guard, [this] { return stopping || retired || ahead_wanted; });
+
+		if (retired)
+		{
+			chip8_trace_file_record * view = retired;
+			retired = nullptr;
+			guard.unlock();
+			unmap_chunk(view);
+			guard.lock();
+		}
+
+		if (ahead_wanted)
+		{
+			uint64_t chunk = ahead_chunk;
+			ahead_wanted = false;
+			guard.unlock();
+
+			chip8_trace_file_record * view = nullptr;
+			if (map_chunk(chunk, &view))
+			{
+				// fault every page in now, a write each so they come in writable
+				volatile uint8_t * bytes = (volatile uint8_t*)view;
+				for (uint64_t i = 0; i < CHIP8_TRACE_FILE_CHUNK_BYTES; i += CHIP8_TRACE_FILE_PAGE_SIZE)
+				{
+					bytes[i] = 0;
+				}
+			}
+
+			guard.lock();
+			ahead = view;
+			ahead_ready = true;
+			changed.notify_all();
+		}
+
+		if (stopping)
+		{
+			return;
+		}
+	}
+}
+
+bool Chip8TraceFile::map_chunk(uint64_t chunk, chip8_trace_file_record ** view)
+{
+	uint64_t offset = chunk * CHIP8_TRACE_FILE_CHUNK_BYTES;
+	uint64_t length = offset + CHIP8_TRACE_FILE_CHUNK_BYTES;
+
+#ifdef _WIN32
+	// a mapping object as big as the file needs to be grows the file, the view keeps it
+	// alive after the handle is closed
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)(length >> 32), (DWORD)length, nullptr);
+	if (mapping == nullptr)
+	{
+		*view = nullptr;
+		return false;
+	}
+	void * p = MapViewOfFile(mapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, (SIZE_T)CHIP8_TRACE_FILE_CHUNK_BYTES);
+	CloseHandle(mapping);
+	*view = (chip8_trace_file_record*)p;
+	return p != nullptr;
+#else
+	if (ftruncate(file, (off_t)length) != 0)
+	{
+		*view = nullptr;
+		return false;
+	}
+	void * p = mmap(nullptr, CHIP8_TRACE_FILE_CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, file, (off_t)offset);
+	if (p == MAP_FAILED)
+	{
+		*view = nullptr;
+		return false;
+	}
+	*view = (chip8_trace_file_record*)p;
+	return true;
+#endif
+}
+
+void Chip8TraceFile::unmap_chunk(chip8_trace_file_record * view)
+{
+	if (view == nullptr)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(view);
+#else
+	munmap(view, CHIP8_TRACE_FILE_CHUNK_BYTES);
+#endif
+}
+
+Chip8TraceReader::Chip8TraceReader()
+{
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = nullptr;
+#else
+	file = -1;
+#endif
+	data = nullptr;
+	size = 0;
+	count = 0;
+}
+
+Chip8TraceReader::~Chip8TraceReader()
+{
+	Close();
+}
+
+bool Chip8TraceReader::Open(const char * path)
+{
+	Close();
+
+#ifdef _WIN32
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(chip8_trace_file_header))
+	{
+		Close();
+		return false;
+	}
+	size = (uint64_t)file_size.QuadPart;
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	data = mapping ? (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+	file = ::open(path, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(file, &st) != 0 || st.st_size < (off_t)sizeof(chip8_trace_file_header))
+	{
+		Close();
+		return false;
+	}
+	size = (uint64_t)st.st_size;
+
+	void * p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	data = p != MAP_FAILED ? (const uint8_t*)p : nullptr;
+	if (data)
+	{
+		madvise(p, size, MADV_SEQUENTIAL);
+	}
+#endif
+
+	if (data == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	const chip8_trace_file_header * header = (const chip8_trace_file_header*)data;
+	if (header->magic != CHIP8_TRACE_FILE_MAGIC && header->magic != 0)
+	{
+		Close();
+		return false;
+	}
+
+	// a file that was never closed has an empty header, every slot after it up to the
+	// first empty one is a record
+	uint64_t slots = size / sizeof(chip8_trace_file_record) - 1;
+	if (header->magic == CHIP8_TRACE_FILE_MAGIC)
+	{
+		if (header->version != CHIP8_TRACE_FILE_VERSION || header->record_size != sizeof(chip8_trace_file_record))
+		{
+			Close();
+			return false;
+		}
+		count = header->count < slots ? header->count : slots;
+	}
+	else
+	{
+		const chip8_trace_file_record * records = (const chip8_trace_file_record*)data + 1;
+		count = 0;
+		while (count < slots && (records[count].opcode != 0 || records[count].pc != 0))
+		{
+			count++;
+		}
+	}
+
+	return true;
+}
+
+void Chip8TraceReader::Close()
+{
+#ifdef _WIN32
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (data) munmap((void*)data, size);
+	if (file >= 0) ::close(file);
+	file = -1;
+#endif
+	data = nullptr;
+	size = 0;
+	count = 0;
+}
+
+uint64_t Chip8TraceReader::GetCount()
+{
+	return count;
+}
+
+const chip8_trace_file_record & Chip8TraceReader::Get(uint64_t i)
+{
+	return ((const chip8_trace_file_record*)data)[i + 1];
+}
+
+int Chip8TraceReader::Format(const chip8_trace_file_record & rec, char * buf, int size)
+{
+	if (rec.reg != CHIP8_TRACE_FILE_NO_REG)
+	{
+		return snprintf(buf, size, "%08X  PC:%03X  OP:%04X  I:%03X  SP:%X  VF:%02X  V%X=%02X  changed:%04X",
+			rec.tick, rec.pc, rec.opcode, rec.index_reg, rec.sp, rec.vf, rec.reg, rec.value, rec.changed);
+	}
+	return snprintf(buf, size, "%08X  PC:%03X  OP:%04X  I:%03X  SP:%X  VF:%02X         changed:%04X",
+		rec.tick, rec.pc, rec.opcode, rec.index_reg, rec.sp, rec.vf, rec.changed);
+}
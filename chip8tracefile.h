@@ -0,0 +1,147 @@
+#pragma once
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// execution trace files
+// one fixed size record per executed instruction, streamed into a memory mapped file so
+// capturing is a handful of stores per instruction with no syscalls. the file is mapped
+// a chunk at a time and double buffered: while one chunk is being filled a helper thread
+// maps the next one and touches every page of it, and unmaps the one before, so running
+// off the end of a chunk is a pointer swap and the writer never takes a page fault
+//
+// the file is a chip8_trace_file_header then the records, both native endian. the header
+// (and so the record count) is only written on close, a trace from a run that crashed
+// has a count of 0 and the reader falls back to the file size
+
+#define CHIP8_TRACE_FILE_MAGIC 0x52543843 // "C8TR"
+#define CHIP8_TRACE_FILE_VERSION 1
+
+// records per mapped chunk, 1MB
+#define CHIP8_TRACE_FILE_CHUNK_RECORDS 65536
+
+// no register changed
+#define CHIP8_TRACE_FILE_NO_REG 0xFF
+
+// the header is the size of one record, so the file is a whole number of record slots
+struct chip8_trace_file_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint64_t count;
+};
+
+struct chip8_trace_file_record
+{
+	uint32_t tick; // low 32 bits of the system tick the instruction ran on
+	uint16_t pc; // where it ran from
+	uint16_t opcode;
+	uint16_t index_reg; // after it ran
+	uint16_t changed; // bit n set if Vn changed
+	uint8_t reg; // lowest numbered V register other than VF that changed, or CHIP8_TRACE_FILE_NO_REG
+	uint8_t value; // reg's new value
+	uint8_t vf; // VF after it ran
+	uint8_t sp; // stack pointer after it ran
+};
+
+static_assert(sizeof(chip8_trace_file_header) == sizeof(chip8_trace_file_record), "trace file header must be one record slot");
+
+class Chip8TraceFile
+{
+public:
+	Chip8TraceFile();
+	~Chip8TraceFile();
+
+	Chip8TraceFile(const Chip8TraceFile &) = delete;
+	Chip8TraceFile & operator=(const Chip8TraceFile &) = delete;
+
+	// creates (or truncates) path
+	bool Open(const char * path);
+	// writes the header and trims the file to the records written
+	void Close();
+	bool IsOpen();
+
+	// the slot for the next record. if the file can't grow any further the writes go
+	// into a scratch record, see Failed()
+	chip8_trace_file_record * Next()
+	{
+		if (cursor == end)
+		{
+			next_chunk();
+		}
+		return cursor++;
+	}
+
+	uint64_t GetCount();
+	// true once a chunk couldn't be mapped, records after that were dropped
+	bool Failed();
+
+private:
+	void next_chunk();
+	void helper_main();
+	bool map_chunk(uint64_t chunk, chip8_trace_file_record ** view);
+	void unmap_chunk(chip8_trace_file_record * view);
+
+private:
+#ifdef _WIN32
+	void * file;
+#else
+	int file;
+#endif
+	bool open;
+	bool failed;
+
+	// the chunk being written, writer only
+	chip8_trace_file_record * current;
+	uint64_t current_chunk;
+
+	// handed between the writer and the helper under lock. the writer asks for
+	// ahead_chunk and waits on ahead_ready when it needs it, retired is a full chunk for
+	// the helper to unmap
+	std::thread helper;
+	std::mutex lock;
+	std::condition_variable changed;
+	bool stopping;
+	bool ahead_wanted;
+	bool ahead_ready;
+	uint64_t ahead_chunk;
+	chip8_trace_file_record * ahead;
+	chip8_trace_file_record * retired;
+
+	chip8_trace_file_record * cursor;
+	chip8_trace_file_record * end;
+	chip8_trace_file_record scratch;
+};
+
+// read only view of a whole trace file
+class Chip8TraceReader
+{
+public:
+	Chip8TraceReader();
+	~Chip8TraceReader();
+
+	Chip8TraceReader(const Chip8TraceReader &) = delete;
+	Chip8TraceReader & operator=(const Chip8TraceReader &) = delete;
+
+	bool Open(const char * path);
+	void Close();
+
+	uint64_t GetCount();
+	const chip8_trace_file_record & Get(uint64_t i);
+
+	// writes a one line description of rec into buf, returns the length
+	static int Format(const chip8_trace_file_record & rec, char * buf, int size);
+
+private:
+#ifdef _WIN32
+	void * file;
+	void * mapping;
+#else
+	int file;
+#endif
+	const uint8_t * data;
+	uint64_t size;
+	uint64_t count;
+};
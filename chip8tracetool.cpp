@@ -0,0 +1,238 @@
+// Chip8 trace file tool
+// reads the trace files Chip8::BeginTraceFile() writes (chip8headless -tracefile, or TRACE
+// in the app). dump prints the records that pass the filters, diff walks two traces side
+// by side and shows where they first part ways, with the records leading up to it
+//
+// usage: chip8tracetool dump <trace> [filters]
+//        chip8tracetool diff <trace a> <trace b> [filters] [-context <n>]
+
+#include "chip8tracefile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACETOOL_DEFAULT_CONTEXT 8
+// diff lists this many differing records before it only counts them
+#define TRACETOOL_MAX_LISTED 16
+
+struct tracetool_filter
+{
+	uint64_t from;
+	uint64_t to; // exclusive
+	int pc_low;
+	int pc_high;
+	// opcode & op_mask == op_value, built from a pattern like 8XY4 or D??? where
+	// anything that isn't a hex digit matches any nibble
+	uint16_t op_mask;
+	uint16_t op_value;
+	uint16_t changed; // any of these registers changed, 0 for any record
+};
+
+static void print_usage(const char * exe)
+{
+	printf("usage: %s dump <trace> [filters]\n", exe);
+	printf("       %s diff <trace a> <trace b> [filters] [-context <n>]\n", exe);
+	printf("filters:\n");
+	printf("  -from <n>         skip the first n records\n");
+	printf("  -count <n>        stop after n records\n");
+	printf("  -pc <addr>[-<addr>] only instructions at addr, or in the range (hex)\n");
+	printf("  -op <pattern>     only opcodes matching the pattern, eg 8XY4, DXYN, 00E0\n");
+	printf("  -changed <reg>    only instructions that changed V<reg> (hex)\n");
+	printf("  -context <n>      diff, records shown before the first difference (default %d)\n", TRACETOOL_DEFAULT_CONTEXT);
+}
+
+static bool parse_op_pattern(const char * pattern, tracetool_filter & filter)
+{
+	if (strlen(pattern) != 4)
+	{
+		return false;
+	}
+
+	filter.op_mask = 0;
+	filter.op_value = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		char c = pattern[i];
+		int nibble = -1;
+		if (c >= '0' && c <= '9') nibble = c - '0';
+		else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+		else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+
+		// X, Y, N, ? and the like match anything
+		if (nibble >= 0)
+		{
+			int shift = (3 - i) * 4;
+			filter.op_mask |= 0xF << shift;
+			filter.op_value |= nibble << shift;
+		}
+	}
+	return true;
+}
+
+static bool matches(const tracetool_filter & filter, const chip8_trace_file_record & rec)
+{
+	return rec.pc >= filter.pc_low && rec.pc <= filter.pc_high &&
+		(rec.opcode & filter.op_mask) == filter.op_value &&
+		(filter.changed == 0 || (rec.changed & filter.changed) != 0);
+}
+
+static bool same_record(const chip8_trace_file_record & a, const chip8_trace_file_record & b)
+{
+	return memcmp(&a, &b, sizeof(chip8_trace_file_record)) == 0;
+}
+
+static int dump(Chip8TraceReader & trace, const tracetool_filter & filter)
+{
+	uint64_t end = filter.to < trace.GetCount() ? filter.to : trace.GetCount();
+	uint64_t shown = 0;
+	char line[160];
+
+	for (uint64_t i = filter.from; i < end; i++)
+	{
+		const chip8_trace_file_record & rec = trace.Get(i);
+		if (matches(filter, rec))
+		{
+			Chip8TraceReader::Format(rec, line, sizeof(line));
+			printf("%10llu  %s\n", (unsigned long long)i, line);
+			shown++;
+		}
+	}
+
+	printf("\n%llu of %llu records\n", (unsigned long long)shown, (unsigned long long)trace.GetCount());
+	return 0;
+}
+
+static int diff(Chip8TraceReader & a, Chip8TraceReader & b, const tracetool_filter & filter, int context)
+{
+	uint64_t count = a.GetCount() < b.GetCount() ? a.GetCount() : b.GetCount();
+	uint64_t end = filter.to < count ? filter.to : count;
+	char line[160];
+
+	// records are compared by position, once two runs have gone different ways every
+	// record after tends to differ, so only the first few get listed
+	uint64_t first = end;
+	uint64_t differing = 0;
+	for (uint64_t i = filter.from; i < end; i++)
+	{
+		const chip8_trace_file_record & ra = a.Get(i);
+		const chip8_trace_file_record & rb = b.Get(i);
+		if ((matches(filter, ra) || matches(filter, rb)) && !same_record(ra, rb))
+		{
+			if (first == end)
+			{
+				first = i;
+				uint64_t start = i > filter.from + context ? i - context : filter.from;
+				printf("first difference at record %llu\n\n", (unsigned long long)i);
+				for (uint64_t j = start; j < i; j++)
+				{
+					Chip8TraceReader::Format(a.Get(j), line, sizeof(line));
+					printf("  %10llu  %s\n", (unsigned long long)j, line);
+				}
+			}
+
+			if (differing < TRACETOOL_MAX_LISTED)
+			{
+				Chip8TraceReader::Format(ra, line, sizeof(line));
+				printf("< %10llu  %s\n", (unsigned long long)i, line);
+				Chip8TraceReader::Format(rb, line, sizeof(line));
+				printf("> %10llu  %s\n", (unsigned long long)i, line);
+			}
+			differing++;
+		}
+	}
+
+	if (a.GetCount() != b.GetCount())
+	{
+		printf("\nlengths differ: %llu and %llu records\n", (unsigned long long)a.GetCount(), (unsigned long long)b.GetCount());
+	}
+
+	if (differing == 0)
+	{
+		printf("no differences in %llu records\n", (unsigned long long)(end > filter.from ? end - filter.from : 0));
+		return a.GetCount() != b.GetCount() ? 1 : 0;
+	}
+
+	printf("\n%llu differing records\n", (unsigned long long)differing);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	bool is_diff = strcmp(argv[1], "diff") == 0;
+	if (!is_diff && strcmp(argv[1], "dump") != 0)
+	{
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	int files = is_diff ? 2 : 1;
+	if (argc < 2 + files)
+	{
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	tracetool_filter filter;
+	filter.from = 0;
+	filter.to = UINT64_MAX;
+	filter.pc_low = 0;
+	filter.pc_high = 0xFFFF;
+	filter.op_mask = 0;
+	filter.op_value = 0;
+	filter.changed = 0;
+	long long count = -1;
+	int context = TRACETOOL_DEFAULT_CONTEXT;
+
+	for (int i = 2 + files; i < argc; i++)
+	{
+		const char * arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (strcmp(arg, "-from") == 0 && has_value) { filter.from = strtoull(argv[++i], nullptr, 0); }
+		else if (strcmp(arg, "-count") == 0 && has_value) { count = atoll(argv[++i]); }
+		else if (strcmp(arg, "-changed") == 0 && has_value) { filter.changed |= 1 << (strtol(argv[++i], nullptr, 16) & 0xF); }
+		else if (strcmp(arg, "-context") == 0 && has_value) { context = atoi(argv[++i]); }
+		else if (strcmp(arg, "-pc") == 0 && has_value)
+		{
+			char * rest;
+			filter.pc_low = (int)strtol(argv[++i], &rest, 16);
+			filter.pc_high = *rest == '-' ? (int)strtol(rest + 1, nullptr, 16) : filter.pc_low;
+		}
+		else if (strcmp(arg, "-op") == 0 && has_value)
+		{
+			if (!parse_op_pattern(argv[++i], filter))
+			{
+				printf("opcode patterns are 4 characters: %s\n", argv[i]);
+				return 2;
+			}
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (count >= 0)
+	{
+		filter.to = filter.from + (uint64_t)count;
+	}
+
+	Chip8TraceReader traces[2];
+	for (int f = 0; f < files; f++)
+	{
+		if (!traces[f].Open(argv[2 + f]))
+		{
+			printf("could not open trace file: %s\n", argv[2 + f]);
+			return 2;
+		}
+	}
+
+	return is_diff ? diff(traces[0], traces[1], filter, context < 0 ? 0 : context) : dump(traces[0], filter);
+}